@@ -5,18 +5,103 @@
 #include "memory.h"
 #include "vm.h"
 
+void initLineTable(LineTable* table) {
+    table->count = 0;
+    table->capacity = 0;
+    table->starts = NULL;
+}
+
+void freeLineTable(LineTable* table) {
+    FREE_ARRAY(LineStart, table->starts, table->capacity);
+    initLineTable(table);
+}
+
+// Code at `offset` and after, until the next addLine(), is from `line`. Code is
+// written in order, so anything recorded at or past `offset` is from code that was
+// cut off and has been written over since.
+void addLine(LineTable* table, int offset, int line) {
+    while (table->count > 0 && table->starts[table->count - 1].offset >= offset) {
+        table->count--;
+    }
+    if (table->count > 0 && table->starts[table->count - 1].line == line) return;
+
+    if (table->capacity < table->count + 1) {
+        int oldCapacity = table->capacity;
+        table->capacity = GROW_CAPACITY(oldCapacity);
+        table->starts = GROW_ARRAY(LineStart, table->starts, oldCapacity, table->capacity);
+    }
+
+    table->starts[table->count].offset = offset;
+    table->starts[table->count].line = line;
+    table->count++;
+}
+
+// The line of the last run starting at or before `offset`
+int getLine(LineTable* table, int offset) {
+    int low = 0;
+    int high = table->count - 1;
+    while (low < high) {
+        int middle = low + (high - low + 1) / 2;
+        if (table->starts[middle].offset <= offset) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return table->count > 0 ? table->starts[low].line : 0;
+}
+
+// For `length` bytes from `line` put in at `offset` of the first `count`, moving
+// the lines of everything after them along
+void insertLines(LineTable* table, int count, int offset, int length, int line) {
+    LineTable moved;
+    initLineTable(&moved);
+    for (int i = 0; i < table->count && table->starts[i].offset < count; i++) {
+        LineStart* start = &table->starts[i];
+        int end = i + 1 < table->count && table->starts[i + 1].offset < count ? table->starts[i + 1].offset : count;
+        if (start->offset < offset) addLine(&moved, start->offset, start->line);
+        if (start->offset <= offset && offset < end) addLine(&moved, offset, line);
+        if (end > offset) addLine(&moved, (start->offset > offset ? start->offset : offset) + length, start->line);
+    }
+    if (offset == count) addLine(&moved, offset, line);
+
+    freeLineTable(table);
+    *table = moved;
+}
+
 void initChunk(Chunk* chunk) {
     chunk->count = 0;
     chunk->capacity = 0;
     chunk->code = NULL;
-    chunk->lines = NULL;
+    initLineTable(&chunk->lines);
     initValueArray(&chunk->constants);
+    chunk->constantIndex = NULL;
+    chunk->constantIndexCapacity = 0;
+    chunk->inlinedCalls = NULL;
+    chunk->inlinedCount = 0;
+    chunk->inlinedCapacity = 0;
+    chunk->switches = NULL;
+    chunk->switchCount = 0;
+    chunk->switchCapacity = 0;
+    chunk->handlers = NULL;
+    chunk->handlerCount = 0;
+    chunk->handlerCapacity = 0;
 }
 
 void freeChunk(Chunk* chunk) {
     FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-    FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    freeLineTable(&chunk->lines);
     freeValueArray(&chunk->constants);
+    FREE_ARRAY(int, chunk->constantIndex, chunk->constantIndexCapacity);
+    FREE_ARRAY(InlinedCall, chunk->inlinedCalls, chunk->inlinedCapacity);
+    for (int i = 0; i < chunk->switchCount; i++) {
+        SwitchTable* table = &chunk->switches[i];
+        FREE_ARRAY(int, table->dense, table->denseCount);
+        FREE_ARRAY(SwitchCase, table->numbers, table->numberCapacity);
+        freeTable(&table->strings);
+    }
+    FREE_ARRAY(SwitchTable, chunk->switches, chunk->switchCapacity);
+    FREE_ARRAY(ExceptionHandler, chunk->handlers, chunk->handlerCapacity);
     initChunk(chunk);
 }
 
@@ -25,17 +110,533 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line) {
         int oldCapacity = chunk->capacity;
         chunk->capacity = GROW_CAPACITY(oldCapacity);
         chunk->code = GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity);
-        chunk->lines = GROW_ARRAY(int, chunk->lines, oldCapacity, chunk->capacity);
     }
 
     chunk->code[chunk->count] = byte;
-    chunk->lines[chunk->count] = line;
+    addLine(&chunk->lines, chunk->count, line);
     chunk->count++;
 }
 
+// The constant index is an open addressed set of positions in the constant
+// pool, keyed on the raw Value bits, so equal constants share one slot.
+// Interned strings compare by pointer and 0 and -0 stay apart.
+static uint32_t hashValue(Value value) {
+    uint64_t hash = value;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    return (uint32_t)hash;
+}
+
+static int* findConstantSlot(int* index, int capacity, ValueArray* constants, Value value) {
+    uint32_t slot = hashValue(value) & (capacity - 1);
+    for (;;) {
+        if (index[slot] == -1 || constants->values[index[slot]] == value) {
+            return &index[slot];
+        }
+
+        slot = (slot + 1) & (capacity - 1);
+    }
+}
+
+static void growConstantIndex(Chunk* chunk) {
+    int capacity = GROW_CAPACITY(chunk->constantIndexCapacity);
+    int* index = ALLOCATE(int, capacity);
+    for (int i = 0; i < capacity; i++) {
+        index[i] = -1;
+    }
+
+    for (int i = 0; i < chunk->constants.count; i++) {
+        *findConstantSlot(index, capacity, &chunk->constants, chunk->constants.values[i]) = i;
+    }
+
+    FREE_ARRAY(int, chunk->constantIndex, chunk->constantIndexCapacity);
+    chunk->constantIndex = index;
+    chunk->constantIndexCapacity = capacity;
+}
+
+// Where value already is in the pool, or -1
+int findConstant(Chunk* chunk, Value value) {
+    if (chunk->constantIndexCapacity == 0) return -1;
+    return *findConstantSlot(chunk->constantIndex, chunk->constantIndexCapacity, &chunk->constants, value);
+}
+
 int addConstant(Chunk* chunk, Value value) {
+    if (chunk->constantIndexCapacity > 0) {
+        int* slot = findConstantSlot(chunk->constantIndex, chunk->constantIndexCapacity, &chunk->constants, value);
+        if (*slot != -1) return *slot;
+    }
+
     push(value);
     writeValueArray(&chunk->constants, value);
     pop();
-    return chunk->constants.count - 1;
-}
\ No newline at end of file
+
+    int constant = chunk->constants.count - 1;
+    if ((chunk->constants.count) * 2 > chunk->constantIndexCapacity) {
+        growConstantIndex(chunk);
+    } else {
+        *findConstantSlot(chunk->constantIndex, chunk->constantIndexCapacity, &chunk->constants, value) = constant;
+    }
+
+    return constant;
+}
+
+void addInlinedCall(Chunk* chunk, int start, int end, int line, ObjString* name) {
+    if (chunk->inlinedCapacity < chunk->inlinedCount + 1) {
+        int oldCapacity = chunk->inlinedCapacity;
+        chunk->inlinedCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->inlinedCalls = GROW_ARRAY(InlinedCall, chunk->inlinedCalls, oldCapacity, chunk->inlinedCapacity);
+    }
+
+    InlinedCall* call = &chunk->inlinedCalls[chunk->inlinedCount++];
+    call->start = start;
+    call->end = end;
+    call->line = line;
+    call->name = name;
+}
+
+// The inlined copy a frame resuming at `resume` is in, if any. A caller resuming at
+// a copy's end is waiting on the call its failed guard made, but the frame that was
+// running can have stopped on the copy's last instruction: a loop out of fuel.
+InlinedCall* findInlinedCall(InlinedCall* calls, int count, int resume, bool running) {
+    for (int i = 0; i < count; i++) {
+        if (resume > calls[i].start && (resume < calls[i].end || (running && resume == calls[i].end))) {
+            return &calls[i];
+        }
+    }
+    return NULL;
+}
+
+void addHandler(Chunk* chunk, int start, int end, int handler, int depth) {
+    if (chunk->handlerCapacity < chunk->handlerCount + 1) {
+        int oldCapacity = chunk->handlerCapacity;
+        chunk->handlerCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->handlers = GROW_ARRAY(ExceptionHandler, chunk->handlers, oldCapacity, chunk->handlerCapacity);
+    }
+
+    ExceptionHandler* entry = &chunk->handlers[chunk->handlerCount++];
+    entry->start = start;
+    entry->end = end;
+    entry->handler = handler;
+    entry->depth = depth;
+}
+
+// The innermost try around the instruction at `offset`, if any
+ExceptionHandler* findHandler(Chunk* chunk, int offset) {
+    for (int i = 0; i < chunk->handlerCount; i++) {
+        if (offset >= chunk->handlers[i].start && offset < chunk->handlers[i].end) return &chunk->handlers[i];
+    }
+    return NULL;
+}
+
+int addSwitch(Chunk* chunk) {
+    if (chunk->switchCapacity < chunk->switchCount + 1) {
+        int oldCapacity = chunk->switchCapacity;
+        chunk->switchCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->switches = GROW_ARRAY(SwitchTable, chunk->switches, oldCapacity, chunk->switchCapacity);
+    }
+
+    SwitchTable* table = &chunk->switches[chunk->switchCount];
+    table->jumpCount = 0;
+    table->low = 0;
+    table->dense = NULL;
+    table->denseCount = 0;
+    table->numbers = NULL;
+    table->numberCount = 0;
+    table->numberCapacity = 0;
+    initTable(&table->strings);
+    return chunk->switchCount++;
+}
+
+// Returns false if the table already has a case for key. Only numbers and strings are keys.
+bool addSwitchCase(Chunk* chunk, int table, Value key, int index) {
+    SwitchTable* cases = &chunk->switches[table];
+    if (IS_STRING(key)) {
+        Value existing;
+        if (tableGet(&cases->strings, AS_STRING(key), &existing)) return false;
+
+        push(key);
+        tableSet(&cases->strings, AS_STRING(key), NUMBER_VAL(index));
+        pop();
+        return true;
+    }
+
+    for (int i = 0; i < cases->numberCount; i++) {
+        if (AS_NUMBER(cases->numbers[i].key) == AS_NUMBER(key)) return false;
+    }
+    if (cases->numberCapacity < cases->numberCount + 1) {
+        int oldCapacity = cases->numberCapacity;
+        cases->numberCapacity = GROW_CAPACITY(oldCapacity);
+        cases->numbers = GROW_ARRAY(SwitchCase, cases->numbers, oldCapacity, cases->numberCapacity);
+    }
+    cases->numbers[cases->numberCount].key = key;
+    cases->numbers[cases->numberCount].index = index;
+    cases->numberCount++;
+    return true;
+}
+
+static int compareCases(const void* a, const void* b) {
+    double x = AS_NUMBER(((const SwitchCase*)a)->key);
+    double y = AS_NUMBER(((const SwitchCase*)b)->key);
+    return (x > y) - (x < y);
+}
+
+// Once every case is in: sorts the numbers and builds the dense array when they allow it
+void finishSwitch(Chunk* chunk, int table, int jumpCount) {
+    SwitchTable* cases = &chunk->switches[table];
+    cases->jumpCount = jumpCount;
+    if (cases->numberCount == 0) return;
+
+    qsort(cases->numbers, cases->numberCount, sizeof(SwitchCase), compareCases);
+    double low = AS_NUMBER(cases->numbers[0].key);
+    double high = AS_NUMBER(cases->numbers[cases->numberCount - 1].key);
+    if (high - low >= cases->numberCount * 2.0 || low < INT32_MIN || high > INT32_MAX) return;
+    for (int i = 0; i < cases->numberCount; i++) {
+        double key = AS_NUMBER(cases->numbers[i].key);
+        if (key != (double)(int)key) return;
+    }
+
+    cases->low = low;
+    cases->denseCount = (int)(high - low) + 1;
+    cases->dense = ALLOCATE(int, cases->denseCount);
+    for (int i = 0; i < cases->denseCount; i++) {
+        cases->dense[i] = jumpCount - 1;
+    }
+    for (int i = 0; i < cases->numberCount; i++) {
+        cases->dense[(int)(AS_NUMBER(cases->numbers[i].key) - low)] = cases->numbers[i].index;
+    }
+}
+
+// Which of the jumps after the OP_SWITCH value takes
+int findSwitchCase(SwitchTable* table, Value value) {
+    int fallback = table->jumpCount - 1;
+    if (IS_NUMBER(value)) {
+        double number = AS_NUMBER(value);
+        if (table->dense != NULL) {
+            double at = number - table->low;
+            if (!(at >= 0 && at < table->denseCount) || at != (double)(int)at) return fallback;
+            return table->dense[(int)at];
+        }
+
+        int low = 0;
+        int high = table->numberCount - 1;
+        while (low <= high) {
+            int middle = (low + high) / 2;
+            double key = AS_NUMBER(table->numbers[middle].key);
+            if (key == number) return table->numbers[middle].index;
+            if (key < number) low = middle + 1;
+            else high = middle - 1;
+        }
+        return fallback;
+    }
+
+    Value index;
+    if (IS_STRING(value) && tableGet(&table->strings, AS_STRING(value), &index)) return (int)AS_NUMBER(index);
+    return fallback;
+}
+
+// The jumps that follow the OP_SWITCH at `offset`, default included
+int switchJumpCount(Chunk* chunk, int offset) {
+    return chunk->switches[chunk->code[offset + 1]].jumpCount;
+}
+
+// How many bytes the instruction at `offset` takes, operands included
+int instructionLength(Chunk* chunk, int offset) {
+    switch (chunk->code[offset]) {
+        case OP_CONSTANT:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_SET_LOCAL_POP:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_GET_PROPERTY:
+        case OP_FRAME_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_GET_SUPER:
+        case OP_CONCAT_N:
+        case OP_CHECK_TYPE:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_SWITCH:
+        case OP_CLASS:
+        case OP_METHOD:
+            return 2;
+        case OP_DEFINE_GLOBAL:
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+        case OP_INVOKE:
+        case OP_SUPER_INVOKE:
+        case OP_MATH:
+        case OP_MEMO_STORE:
+            return 3;
+        case OP_INLINE_RETURN:
+        case OP_MEMO:
+            return 4;
+        case OP_CALL_INLINED:
+            return 5;
+        case OP_INVOKE_INLINED:
+            return 6;
+        case OP_FOR_STEP:
+            return 9;
+        case OP_CLOSURE:
+        case OP_FRAME_CLOSURE: {
+            ObjFunction* function = AS_FUNCTION(chunk->constants.values[chunk->code[offset + 1]]);
+            return 2 + function->upvalueCount * 2;
+        }
+        default:
+            return 1;
+    }
+}
+
+bool isJumpInstruction(uint8_t instruction) {
+    switch (instruction) {
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+        case OP_FOR_STEP:
+        case OP_CALL_INLINED:
+        case OP_INVOKE_INLINED:
+        case OP_INLINE_RETURN:
+        case OP_MEMO:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool isBackwardJump(uint8_t instruction) {
+    return instruction == OP_LOOP || instruction == OP_FOR_STEP;
+}
+
+// Whether operand byte i of the instruction at offset is a local slot
+bool isLocalOperand(uint8_t* code, int offset, int i) {
+    switch (code[offset]) {
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_SET_LOCAL_POP:
+        case OP_MEMO:
+        case OP_MEMO_STORE:
+            return i == 1;
+        case OP_FOR_STEP:
+            return i == 1 || (i == 6 && code[offset + 5] == OP_GET_LOCAL);
+        default:
+            return false;
+    }
+}
+
+// Whether operand byte i of the instruction at offset indexes the constant pool
+bool isConstantOperand(uint8_t* code, int offset, int i) {
+    switch (code[offset]) {
+        case OP_CONSTANT:
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_PROPERTY:
+        case OP_FRAME_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_INVOKE:
+        case OP_MATH:
+            return i == 1;
+        case OP_FOR_STEP:
+            return i == 2 || (i == 6 && code[offset + 5] != OP_GET_LOCAL);
+        default:
+            return false;
+    }
+}
+
+// Jumps keep their distance in the last two bytes and measure it from the next instruction
+static int jumpLength(uint8_t instruction) {
+    switch (instruction) {
+        case OP_INLINE_RETURN:
+        case OP_MEMO:           return 4;
+        case OP_CALL_INLINED:   return 5;
+        case OP_INVOKE_INLINED: return 6;
+        case OP_FOR_STEP:       return 9;
+        default:                return 3;
+    }
+}
+
+// Where the jump at `offset` lands
+int jumpTarget(Chunk* chunk, int offset) {
+    int next = offset + jumpLength(chunk->code[offset]);
+    uint16_t jump = (uint16_t)((chunk->code[next - 2] << 8) | chunk->code[next - 1]);
+    return isBackwardJump(chunk->code[offset]) ? next - jump : next + jump;
+}
+
+void setJumpTarget(uint8_t* code, int offset, int target) {
+    int next = offset + jumpLength(code[offset]);
+    int jump = isBackwardJump(code[offset]) ? next - target : target - next;
+    code[next - 2] = (jump >> 8) & 0xff;
+    code[next - 1] = jump & 0xff;
+}
+
+// How many values an instruction takes off the stack and how many it puts back
+void stackEffect(Chunk* chunk, int offset, int* pops, int* pushes) {
+    uint8_t* code = chunk->code;
+    *pops = 0;
+    *pushes = 0;
+
+    switch (code[offset]) {
+        case OP_CONSTANT:
+        case OP_NULL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_GET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_CLOSURE:
+        case OP_FRAME_CLOSURE:
+        case OP_CLASS:
+            *pushes = 1;
+            break;
+        case OP_POP:
+        case OP_SET_LOCAL_POP:
+        case OP_MEMO_STORE:
+        case OP_SWITCH:
+        case OP_DEFINE_GLOBAL:
+        case OP_CLOSE_UPVALUE:
+        case OP_RELEASE:
+        case OP_RETURN:
+        case OP_THROW:
+        case OP_INHERIT:
+        case OP_METHOD:
+            *pops = 1;
+            break;
+        case OP_SET_LOCAL:
+        case OP_SET_GLOBAL:
+        case OP_SET_UPVALUE:
+        case OP_GET_PROPERTY:
+        case OP_FRAME_PROPERTY:
+        case OP_NOT:
+        case OP_NEGATE:
+        case OP_BIT_NOT:
+        case OP_CHECK_TYPE:
+            *pops = 1;
+            *pushes = 1;
+            break;
+        case OP_SET_PROPERTY:
+        case OP_GET_SUPER:
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+        case OP_GREATER:
+        case OP_NOT_GREATER:
+        case OP_LESS:
+        case OP_NOT_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_MODULO:
+        case OP_INT_DIVIDE:
+        case OP_BIT_AND:
+        case OP_BIT_OR:
+        case OP_BIT_XOR:
+        case OP_SHIFT_LEFT:
+        case OP_SHIFT_RIGHT:
+        case OP_GREATER_NUM:
+        case OP_NOT_GREATER_NUM:
+        case OP_LESS_NUM:
+        case OP_NOT_LESS_NUM:
+        case OP_ADD_NUM:
+        case OP_SUBTRACT_NUM:
+        case OP_MULTIPLY_NUM:
+        case OP_DIVIDE_NUM:
+            *pops = 2;
+            *pushes = 1;
+            break;
+        case OP_CONCAT_N:
+            *pops = code[offset + 1];
+            *pushes = 1;
+            break;
+        case OP_CALL:
+        case OP_TAIL_CALL:
+            *pops = code[offset + 1] + 1;
+            *pushes = 1;
+            break;
+        case OP_INVOKE:
+        case OP_MATH:
+            *pops = code[offset + 2] + 1;
+            *pushes = 1;
+            break;
+        case OP_SUPER_INVOKE:
+            *pops = code[offset + 2] + 2;
+            *pushes = 1;
+            break;
+        default:
+            break;
+    }
+}
+
+static bool mergeDepth(int* depths, int offset, int depth, bool* changed) {
+    if (depths[offset] == -1) {
+        depths[offset] = depth;
+        *changed = true;
+    }
+    return depths[offset] == depth;
+}
+
+// The stack depth before every instruction, -1 for code nothing reaches. A for
+// loop's increment is only reached by a LOOP further down, hence the repeats.
+bool computeStackDepths(Chunk* chunk, int entryDepth, int* depths, int* maxDepth) {
+    for (int offset = 0; offset <= chunk->count; offset++) {
+        depths[offset] = -1;
+    }
+    depths[0] = entryDepth;
+    *maxDepth = entryDepth;
+
+    // A handler is only reached by unwinding, with the error on top of its try's locals
+    for (int i = 0; i < chunk->handlerCount; i++) {
+        ExceptionHandler* handler = &chunk->handlers[i];
+        depths[handler->handler] = handler->depth + 1;
+        if (handler->depth + 1 > *maxDepth) *maxDepth = handler->depth + 1;
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+            if (depths[offset] == -1) continue;
+
+            uint8_t instruction = chunk->code[offset];
+            int pops, pushes;
+            stackEffect(chunk, offset, &pops, &pushes);
+            int depth = depths[offset] - pops + pushes;
+            if (depths[offset] - pops < 0) return false;
+            if (depth > *maxDepth) *maxDepth = depth;
+
+            if (isJumpInstruction(instruction) && !mergeDepth(depths, jumpTarget(chunk, offset), depth, &changed)) {
+                return false;
+            }
+            // Past the first, a switch's jumps are only reached from the switch
+            if (instruction == OP_SWITCH) {
+                for (int i = 1; i < switchJumpCount(chunk, offset); i++) {
+                    if (!mergeDepth(depths, offset + 2 + 3 * i, depth, &changed)) return false;
+                }
+            }
+
+            bool fallsThrough = instruction != OP_JUMP && instruction != OP_LOOP && instruction != OP_RETURN &&
+                                instruction != OP_THROW && instruction != OP_INLINE_RETURN;
+            int next = offset + instructionLength(chunk, offset);
+            if (fallsThrough && !mergeDepth(depths, next, depth, &changed)) return false;
+        }
+    }
+    return true;
+}
+
+// Captured locals can change behind our back (any call may run the closure), so the -O passes skip such functions
+bool capturesLocals(Chunk* chunk) {
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        uint8_t instruction = chunk->code[offset];
+        if (instruction == OP_CLOSE_UPVALUE) return true;
+        if (instruction != OP_CLOSURE && instruction != OP_FRAME_CLOSURE) continue;
+
+        int length = instructionLength(chunk, offset);
+        for (int i = offset + 2; i < offset + length; i += 2) {
+            if (chunk->code[i]) return true;
+        }
+    }
+    return false;
+}
@@ -2,6 +2,7 @@
 #define npp_chunk_h
 
 #include "common.h"
+#include "table.h"
 #include "value.h"
 
 typedef enum {
@@ -18,42 +19,200 @@ typedef enum {
     OP_GET_UPVALUE,
     OP_SET_UPVALUE,
     OP_GET_PROPERTY,
+    OP_FRAME_PROPERTY,
     OP_SET_PROPERTY,
     OP_GET_SUPER,
+    OP_SET_LOCAL_POP,
     OP_EQUAL,
+    OP_NOT_EQUAL,
     OP_GREATER,
+    OP_NOT_GREATER,
     OP_LESS,
+    OP_NOT_LESS,
     OP_ADD,
+    OP_CONCAT_N,
     OP_SUBTRACT,
     OP_MULTIPLY,
     OP_DIVIDE,
+    OP_MODULO,
+    OP_INT_DIVIDE,
+    OP_BIT_AND,
+    OP_BIT_OR,
+    OP_BIT_XOR,
+    OP_SHIFT_LEFT,
+    OP_SHIFT_RIGHT,
+    OP_GREATER_NUM,
+    OP_NOT_GREATER_NUM,
+    OP_LESS_NUM,
+    OP_NOT_LESS_NUM,
+    OP_ADD_NUM,
+    OP_SUBTRACT_NUM,
+    OP_MULTIPLY_NUM,
+    OP_DIVIDE_NUM,
     OP_NOT,
     OP_NEGATE,
+    OP_BIT_NOT,
+    OP_CHECK_TYPE,
     OP_JUMP,
     OP_JUMP_IF_FALSE,
     OP_LOOP,
+    OP_FOR_STEP,
+    OP_SWITCH,
     OP_CALL,
+    OP_TAIL_CALL,
     OP_INVOKE,
     OP_SUPER_INVOKE,
+    OP_MATH,
+    OP_CALL_INLINED,
+    OP_INVOKE_INLINED,
+    OP_INLINE_RETURN,
+    OP_MEMO,
+    OP_MEMO_STORE,
     OP_CLOSURE,
+    OP_FRAME_CLOSURE,
     OP_CLOSE_UPVALUE,
+    OP_RELEASE,
     OP_RETURN,
+    OP_THROW,
     OP_CLASS,
     OP_INHERIT,
     OP_METHOD
 } OpCode;
 
+// * OP_FOR_STEP counter step stepOp compareOp loadOp bound hi lo
+// * A counted loop's increment and condition in one: counter = counter stepOp
+// * K[step], then loop back if counter compareOp <bound> holds, where the bound
+// * is whatever loadOp (GET_LOCAL, CONSTANT or GET_GLOBAL) of `bound` reads.
+
+// * OP_GREATER_NUM through OP_DIVIDE_NUM
+// * The comparisons and arithmetic for operands the compiler already knows are
+// * numbers, from num annotations or constants, so they skip the type checks.
+
+// * OP_DEFINE_GLOBAL name type
+// * Defines the global `name` and records the ValueType its declaration was
+// * annotated with, which every SET_GLOBAL to it checks from then on.
+
+// * OP_CHECK_TYPE type
+// * Fails unless the value on top of the stack is of ValueType `type`. Left in
+// * front of stores the compiler can't prove match their annotation.
+
+// * OP_MATH name argCount
+// * A call to the math native global `name` is, while the global still holds it.
+// * The callee's slot under the arguments is left empty: the math runs in place,
+// * or if the name has been rebound since, whatever it holds now is called.
+
+// * OP_FRAME_CLOSURE and OP_FRAME_PROPERTY
+// * OP_CLOSURE and OP_GET_PROPERTY for a local the compiler saw is only ever
+// * called, so the closure or bound method goes in the frame's scratch space.
+// * OP_RELEASE pops such a local when its scope ends and gives the space back.
+
+// * OP_SWITCH table
+// * Pops a value and finds its case in switches[table]. One OP_JUMP per case
+// * follows, then one for default, and the switch takes the jump of the case.
+
+// * OP_THROW
+// * Pops a value and raises it. The frames are searched for a try covering the
+// * instruction that failed and unwound to its handler, see ExceptionHandler.
+
+// A case value and the jump after its OP_SWITCH it takes
+typedef struct {
+    Value key;
+    int index;
+} SwitchCase;
+
+// How an OP_SWITCH finds the case for a value. Integers in a range that is at least half
+// full index an array, strings are looked up by their interned pointer, and any other
+// number is found by binary search. Whatever isn't a case takes the last jump, default.
+typedef struct {
+    int jumpCount;
+    double low;
+    int* dense;    // the jump for integer n at dense[n - low], NULL if too sparse
+    int denseCount;
+    SwitchCase* numbers; // sorted by key
+    int numberCount;
+    int numberCapacity;
+    Table strings; // jump index by string
+} SwitchTable;
+
+// A stretch of code that is an inlined copy of another function, kept for stack traces
+typedef struct {
+    int start;
+    int end;
+    int line;        // of the call it replaced
+    ObjString* name; // of the function it copied
+} InlinedCall;
+
+// A try block: a throw or runtime error between start and end goes to handler, with
+// the stack cut back to `depth` slots and the error pushed on top. Inner blocks come
+// first. Nothing runs on entering a try, the table is only read when something fails.
+typedef struct {
+    int start;
+    int end;
+    int handler;
+    int depth;
+} ExceptionHandler;
+
+// Line numbers, one entry per run of code from the same line: the run starts at
+// `offset` and lasts until the next entry's. Only error reporting, the disassembler
+// and the passes that rewrite code read them, so looking one up is a binary search.
+typedef struct {
+    int offset;
+    int line;
+} LineStart;
+
+typedef struct {
+    int count;
+    int capacity;
+    LineStart* starts;
+} LineTable;
+
 typedef struct {
     int count;
     int capacity;
     uint8_t* code;
-    int* lines;
+    LineTable lines;
     ValueArray constants;
+    int* constantIndex;
+    int constantIndexCapacity;
+    InlinedCall* inlinedCalls;
+    int inlinedCount;
+    int inlinedCapacity;
+    SwitchTable* switches;
+    int switchCount;
+    int switchCapacity;
+    ExceptionHandler* handlers;
+    int handlerCount;
+    int handlerCapacity;
 } Chunk;
 
+void initLineTable(LineTable* table);
+void freeLineTable(LineTable* table);
+void addLine(LineTable* table, int offset, int line);
+int getLine(LineTable* table, int offset);
+void insertLines(LineTable* table, int count, int offset, int length, int line);
 void initChunk(Chunk* chunk);
 void freeChunk(Chunk* chunk);
 void writeChunk(Chunk* chunk, uint8_t byte, int line);
+int findConstant(Chunk* chunk, Value value);
 int addConstant(Chunk* chunk, Value value);
+int instructionLength(Chunk* chunk, int offset);
+bool isJumpInstruction(uint8_t instruction);
+bool isBackwardJump(uint8_t instruction);
+bool isLocalOperand(uint8_t* code, int offset, int i);
+bool isConstantOperand(uint8_t* code, int offset, int i);
+int jumpTarget(Chunk* chunk, int offset);
+void setJumpTarget(uint8_t* code, int offset, int target);
+void addInlinedCall(Chunk* chunk, int start, int end, int line, ObjString* name);
+InlinedCall* findInlinedCall(InlinedCall* calls, int count, int resume, bool running);
+void addHandler(Chunk* chunk, int start, int end, int handler, int depth);
+ExceptionHandler* findHandler(Chunk* chunk, int offset);
+int addSwitch(Chunk* chunk);
+bool addSwitchCase(Chunk* chunk, int table, Value key, int index);
+void finishSwitch(Chunk* chunk, int table, int jumpCount);
+int findSwitchCase(SwitchTable* table, Value value);
+int switchJumpCount(Chunk* chunk, int offset);
+void stackEffect(Chunk* chunk, int offset, int* pops, int* pushes);
+bool computeStackDepths(Chunk* chunk, int entryDepth, int* depths, int* maxDepth);
+bool capturesLocals(Chunk* chunk);
 
 #endif
\ No newline at end of file
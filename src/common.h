@@ -10,6 +10,9 @@
 
 #define UINT8_COUNT (UINT8_MAX + 1)
 
+// Prints every function's bytecode before and after the peephole pass
+// #define DEBUG_PRINT_CODE
+
 static inline bool hasSuffix(const char *str, const char *suffix) {
     size_t fileLen = strlen(str);
     size_t suffixLen = strlen(suffix);
@@ -4,8 +4,19 @@
 
 #include "common.h"
 #include "compiler.h"
+#include "inliner.h"
+#include "loops.h"
 #include "memory.h"
+#include "native.h"
+#include "optimizer.h"
+#include "registers.h"
 #include "scanner.h"
+#include "ssa.h"
+#include "vm.h"
+
+#ifdef DEBUG_PRINT_CODE
+#include "debug.h"
+#endif
 
 typedef struct {
     Token current;
@@ -21,6 +32,10 @@ typedef enum {
     PREC_AND,
     PREC_EQUALITY,
     PREC_COMPARISON,
+    PREC_BIT_OR,
+    PREC_BIT_XOR,
+    PREC_BIT_AND,
+    PREC_SHIFT,
     PREC_TERM,
     PREC_FACTOR,
     PREC_UNARY,
@@ -40,6 +55,12 @@ typedef struct {
     Token name;
     int depth;
     bool isCaptured;
+    bool isConst;
+    bool isFolded; // a const whose value is known, every use reads `constant` instead
+    Value constant;
+    ValueType type;
+    int producer; // the OP_CLOSURE or OP_GET_PROPERTY that made its value, -1 if there isn't one
+    bool escapes; // read as anything but the callee of a call, or assigned to
 } Local;
 
 typedef struct {
@@ -54,6 +75,12 @@ typedef enum {
     TYPE_SCRIPT
 } FunctionType;
 
+// A constant load that was just emitted, remembered so it can be folded
+typedef struct {
+    int offset;
+    Value value;
+} ConstantLoad;
+
 typedef struct Compiler {
     struct Compiler* enclosing;
     ObjFunction* function;
@@ -62,6 +89,13 @@ typedef struct Compiler {
     int localCount;
     Upvalue upvalues[UINT8_COUNT];
     int scopeDepth;
+    ConstantLoad constants[2];
+    int typedEnd;        // where the last expression whose type is known ends
+    ValueType typedAs;   // and what that type is
+    int lastJumpTarget;
+    int tryDepth; // how many try blocks the code being compiled is in
+    int lastCall;
+    int lastProperty;
 } Compiler;
 
 typedef struct ClassCompiler {
@@ -72,6 +106,7 @@ typedef struct ClassCompiler {
 Parser parser;
 Compiler* current = NULL;
 ClassCompiler* currentClass = NULL;
+ObjString* unitSource = NULL; // the text being compiled under -l, kept for bodies compiled later
 
 static Chunk* currentChunk() {
     return &current->function->chunk;
@@ -166,6 +201,9 @@ static void emitReturn() {
         emitByte(OP_NULL);
     }
 
+    // Running off the end of a function with a return type is an error, if it's reachable
+    ValueType returnType = current->function->returnType;
+    if (returnType != VALUE_ANY) emitBytes(OP_CHECK_TYPE, (uint8_t)returnType);
     emitByte(OP_RETURN);
 }
 
@@ -179,12 +217,160 @@ static uint8_t makeConstant(Value value) {
     return (uint8_t)constant;
 }
 
+static void noteType(ValueType type) {
+    current->typedEnd = currentChunk()->count;
+    current->typedAs = type;
+}
+
+// The type of the value the code emitted so far leaves on top, if the compiler knows it.
+// A jump landing at the end could bring a value from anywhere, so then it doesn't.
+static ValueType tailType() {
+    if (current->typedEnd != currentChunk()->count || current->lastJumpTarget >= current->typedEnd) {
+        return VALUE_ANY;
+    }
+    return current->typedAs;
+}
+
+static void noteConstant(int offset, Value value) {
+    current->constants[0] = current->constants[1];
+    current->constants[1].offset = offset;
+    current->constants[1].value = value;
+}
+
 static void emitConstant(Value value) {
-    emitBytes(OP_CONSTANT, makeConstant(value));
+    int offset = currentChunk()->count;
+    if (IS_NULL(value)) {
+        emitByte(OP_NULL);
+    } else if (IS_BOOL(value)) {
+        emitByte(AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+    } else {
+        emitBytes(OP_CONSTANT, makeConstant(value));
+    }
+
+    noteConstant(offset, value);
+    if (IS_NUMBER(value)) noteType(VALUE_NUMBER);
+    else if (IS_BOOL(value)) noteType(VALUE_BOOL);
+    else if (IS_STRING(value)) noteType(VALUE_STRING);
+}
+
+static int constantLoadLength(ConstantLoad* load) {
+    return IS_NULL(load->value) || IS_BOOL(load->value) ? 1 : 2;
+}
+
+// Checks that the last `count` instructions are constant loads that no jump lands
+// inside of, and returns where the first of them starts (or -1).
+static int constantTail(int count) {
+    ConstantLoad* last = &current->constants[1];
+    ConstantLoad* previous = &current->constants[0];
+    if (last->offset == -1 || last->offset + constantLoadLength(last) != currentChunk()->count) {
+        return -1;
+    }
+
+    int start = last->offset;
+    if (count == 2) {
+        if (previous->offset == -1 || previous->offset + constantLoadLength(previous) != last->offset) {
+            return -1;
+        }
+        start = previous->offset;
+    }
+
+    return current->lastJumpTarget <= start ? start : -1;
+}
+
+// Throws away the constant loads from `start` on and emits `value` in their place
+static void replaceWithConstant(int start, Value value) {
+    currentChunk()->count = start;
+    current->constants[0].offset = -1;
+    current->constants[1].offset = -1;
+    current->typedEnd = -1;
+    emitConstant(value);
+}
+
+static bool isBitwise(TokenType type) {
+    return type == TOKEN_AMPERSAND || type == TOKEN_PIPE || type == TOKEN_CARET ||
+           type == TOKEN_LESS_LESS || type == TOKEN_GREATER_GREATER;
+}
+
+static bool foldBinary(TokenType operatorType) {
+    int start = constantTail(2);
+    if (start == -1) return false;
+
+    Value a = current->constants[0].value;
+    Value b = current->constants[1].value;
+    Value result;
+
+    if (operatorType == TOKEN_EQUAL_EQUAL || operatorType == TOKEN_BANG_EQUAL) {
+        bool equal = valuesEqual(a, b);
+        result = BOOL_VAL(operatorType == TOKEN_EQUAL_EQUAL ? equal : !equal);
+    } else if (isBitwise(operatorType)) {
+        int32_t x, y;
+        if (!bothToBits(a, b, &x, &y)) return false;
+        switch (operatorType) {
+            case TOKEN_AMPERSAND:         result = INT_VAL(x & y); break;
+            case TOKEN_PIPE:              result = INT_VAL(x | y); break;
+            case TOKEN_CARET:             result = INT_VAL(x ^ y); break;
+            case TOKEN_LESS_LESS:         result = INT_VAL(shiftLeft(x, y)); break;
+            default:                      result = INT_VAL(shiftRight(x, y)); break;
+        }
+    } else if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        double x = AS_NUMBER(a);
+        double y = AS_NUMBER(b);
+        switch (operatorType) {
+            case TOKEN_PLUS:          result = addNumbers(a, b); break;
+            case TOKEN_MINUS:         result = subtractNumbers(a, b); break;
+            case TOKEN_STAR:          result = multiplyNumbers(a, b); break;
+            case TOKEN_SLASH:         result = divideNumbers(a, b); break;
+            case TOKEN_PERCENT:       result = moduloNumbers(a, b); break;
+            case TOKEN_TILDE_SLASH:   result = intDivideNumbers(a, b); break;
+            case TOKEN_GREATER:       result = BOOL_VAL(x > y); break;
+            case TOKEN_GREATER_EQUAL: result = BOOL_VAL(!(x < y)); break;
+            case TOKEN_LESS:          result = BOOL_VAL(x < y); break;
+            case TOKEN_LESS_EQUAL:    result = BOOL_VAL(!(x > y)); break;
+            default: return false;
+        }
+    } else if (operatorType == TOKEN_PLUS && IS_STRING(a) && IS_STRING(b)) {
+        ObjString* left = AS_STRING(a);
+        ObjString* right = AS_STRING(b);
+        ObjString* joined = makeString(left->length + right->length);
+        memcpy(joined->chars, left->chars, left->length);
+        memcpy(joined->chars + left->length, right->chars, right->length);
+        result = OBJ_VAL(internString(joined));
+    } else {
+        // Leave it for the VM to report
+        return false;
+    }
+
+    replaceWithConstant(start, result);
+    return true;
+}
+
+static bool foldUnary(TokenType operatorType) {
+    int start = constantTail(1);
+    if (start == -1) return false;
+
+    Value value = current->constants[1].value;
+    switch (operatorType) {
+        case TOKEN_BANG:
+            replaceWithConstant(start, BOOL_VAL(isFalsey(value)));
+            return true;
+        case TOKEN_MINUS:
+            if (!IS_NUMBER(value)) return false;
+            replaceWithConstant(start, negateNumber(value));
+            return true;
+        case TOKEN_TILDE: {
+            int32_t bits;
+            if (!toBits(value, &bits)) return false;
+            replaceWithConstant(start, INT_VAL(~bits));
+            return true;
+        }
+        default:
+            return false;
+    }
 }
 
 static void patchJump(int offset) {
     int jump = currentChunk()->count - offset - 2;
+    current->lastJumpTarget = currentChunk()->count;
 
     if (jump > UINT16_MAX) {
         error("Too much code to jump over.");
@@ -200,6 +386,13 @@ static void initCompiler(Compiler* compiler, FunctionType type) {
     compiler->type = type;
     compiler->localCount = 0;
     compiler->scopeDepth = 0;
+    compiler->constants[0].offset = -1;
+    compiler->constants[1].offset = -1;
+    compiler->typedEnd = -1;
+    compiler->lastJumpTarget = 0;
+    compiler->tryDepth = 0;
+    compiler->lastCall = -1;
+    compiler->lastProperty = -1;
     compiler->function = newFunction();
     current = compiler;
     if (type != TYPE_SCRIPT) {
@@ -209,6 +402,11 @@ static void initCompiler(Compiler* compiler, FunctionType type) {
     Local* local = &current->locals[current->localCount++];
     local->depth = 0;
     local->isCaptured = false;
+    local->isConst = false;
+    local->isFolded = false;
+    local->type = VALUE_ANY;
+    local->producer = -1;
+    local->escapes = false;
     if (type != TYPE_FUNCTION) {
         local->name.start = "this";
         local->name.length = 4;
@@ -218,9 +416,37 @@ static void initCompiler(Compiler* compiler, FunctionType type) {
     }
 }
 
+// A closure or bound method that lives in a local and is only ever called can't outlive
+// the frame, so its producer is switched over to the frame's scratch space
+static bool keepInFrame(Local* local) {
+    if (local->producer == -1 || local->escapes || local->isCaptured) return false;
+
+    uint8_t* producer = &currentChunk()->code[local->producer];
+    *producer = *producer == OP_CLOSURE ? OP_FRAME_CLOSURE : OP_FRAME_PROPERTY;
+    return true;
+}
+
 static ObjFunction* endCompiler() {
+    // What's still in scope is given back when the frame returns
+    for (int i = 1; i < current->localCount; i++) {
+        keepInFrame(&current->locals[i]);
+    }
     emitReturn();
     ObjFunction* function = current->function;
+
+    if (!parser.hadError) {
+#ifdef DEBUG_PRINT_CODE
+        const char* name = function->name != NULL ? function->name->chars : "<script>";
+        int before = countInstructions(currentChunk());
+        disassembleChunk(currentChunk(), name);
+#endif
+        optimizeChunk(currentChunk());
+#ifdef DEBUG_PRINT_CODE
+        disassembleChunk(currentChunk(), "after peephole");
+        printf("== %s: %d -> %d instructions ==\n\n", name, before, countInstructions(currentChunk()));
+#endif
+    }
+
     current = current->enclosing;
     return function;
 }
@@ -233,8 +459,11 @@ static void endScope() {
     current->scopeDepth--;
 
     while (current->localCount > 0 && current->locals[current->localCount - 1].depth > current->scopeDepth) {
-        if (current->locals[current->localCount - 1].isCaptured) {
+        Local* local = &current->locals[current->localCount - 1];
+        if (local->isCaptured) {
             emitByte(OP_CLOSE_UPVALUE);
+        } else if (keepInFrame(local)) {
+            emitByte(OP_RELEASE);
         } else {
             emitByte(OP_POP);
         }
@@ -318,6 +547,11 @@ static void addLocal(Token name) {
     local->name = name;
     local->depth = -1;
     local->isCaptured = false;
+    local->isConst = false;
+    local->isFolded = false;
+    local->type = VALUE_ANY;
+    local->producer = -1;
+    local->escapes = false;
 }
 
 static void declareVariable() {
@@ -344,7 +578,12 @@ static uint8_t parseVariable(const char* errorMessage) {
     declareVariable();
     if (current->scopeDepth > 0) return 0;
 
-    return identifierConstant(&parser.previous);
+    uint8_t global = identifierConstant(&parser.previous);
+    ObjString* name = AS_STRING(currentChunk()->constants.values[global]);
+    if (name->isConst) {
+        error("Already a constant with this name.");
+    }
+    return global;
 }
 
 static void markInitialized() {
@@ -352,13 +591,21 @@ static void markInitialized() {
     current->locals[current->localCount - 1].depth = current->scopeDepth;
 }
 
-static void defineVariable(uint8_t global) {
+// A global's type is only set once its declaration runs, so stores that run before
+// it are checked against the declaration before, if any
+static void defineTypedVariable(uint8_t global, ValueType type) {
     if (current->scopeDepth > 0) {
         markInitialized();
         return;
     }
 
+    AS_STRING(currentChunk()->constants.values[global])->isDeclared = true;
     emitBytes(OP_DEFINE_GLOBAL, global);
+    emitByte((uint8_t)type);
+}
+
+static void defineVariable(uint8_t global) {
+    defineTypedVariable(global, VALUE_ANY);
 }
 
 static uint8_t argumentList() {
@@ -383,28 +630,80 @@ static void and_(bool canAssign) {
     patchJump(endJump);
 }
 
+// A run like a + b + c + d is gathered into one OP_CONCAT_N, so building a
+// string doesn't allocate and intern every intermediate result.
+static void addition() {
+    int operands = 1;
+    ValueType left = tailType();
+    ValueType right = VALUE_ANY;
+    do {
+        parsePrecedence(PREC_FACTOR);
+        operands++;
+        right = tailType();
+
+        // Only a constant prefix folds: x + 1 + 2 isn't x + 3 for doubles. Numbers
+        // known to be numbers are added as they come, a run of them is no concatenation.
+        if (operands == 2 && foldBinary(TOKEN_PLUS)) {
+            operands = 1;
+            left = tailType();
+        } else if (operands == 2 && left == VALUE_NUMBER && right == VALUE_NUMBER) {
+            emitByte(OP_ADD_NUM);
+            noteType(VALUE_NUMBER);
+            operands = 1;
+        }
+    } while (operands < UINT8_MAX && match(TOKEN_PLUS));
+
+    if (operands == 1) {
+        return;
+    } else if (operands == 2) {
+        emitByte(OP_ADD);
+        if (left == VALUE_STRING && right == VALUE_STRING) noteType(VALUE_STRING);
+    } else {
+        emitBytes(OP_CONCAT_N, (uint8_t)operands);
+    }
+}
+
 static void binary(bool canAssign) {
     TokenType operatorType = parser.previous.type;
+    if (operatorType == TOKEN_PLUS) {
+        addition();
+        return;
+    }
+
+    ValueType left = tailType();
     ParseRule* rule = getRule(operatorType);
     parsePrecedence((Precedence)(rule->precedence + 1));
+    if (foldBinary(operatorType)) return;
 
+    // Operands that are known numbers need no checking
+    bool isNumeric = left == VALUE_NUMBER && tailType() == VALUE_NUMBER;
     switch (operatorType) {
         case TOKEN_BANG_EQUAL:    emitBytes(OP_EQUAL, OP_NOT); break;
         case TOKEN_EQUAL_EQUAL:   emitByte(OP_EQUAL); break;
-        case TOKEN_GREATER:       emitByte(OP_GREATER); break;
-        case TOKEN_GREATER_EQUAL: emitBytes(OP_LESS, OP_NOT); break;
-        case TOKEN_LESS:          emitByte(OP_LESS); break;
-        case TOKEN_LESS_EQUAL:    emitBytes(OP_GREATER, OP_NOT); break;
-        case TOKEN_PLUS:          emitByte(OP_ADD); break;
-        case TOKEN_MINUS:         emitByte(OP_SUBTRACT); break;
-        case TOKEN_STAR:          emitByte(OP_MULTIPLY); break;
-        case TOKEN_SLASH:         emitByte(OP_DIVIDE); break;
+        case TOKEN_GREATER:       emitByte(isNumeric ? OP_GREATER_NUM : OP_GREATER); break;
+        case TOKEN_GREATER_EQUAL: emitBytes(isNumeric ? OP_LESS_NUM : OP_LESS, OP_NOT); break;
+        case TOKEN_LESS:          emitByte(isNumeric ? OP_LESS_NUM : OP_LESS); break;
+        case TOKEN_LESS_EQUAL:    emitBytes(isNumeric ? OP_GREATER_NUM : OP_GREATER, OP_NOT); break;
+        case TOKEN_MINUS:         emitByte(isNumeric ? OP_SUBTRACT_NUM : OP_SUBTRACT); break;
+        case TOKEN_STAR:          emitByte(isNumeric ? OP_MULTIPLY_NUM : OP_MULTIPLY); break;
+        case TOKEN_SLASH:         emitByte(isNumeric ? OP_DIVIDE_NUM : OP_DIVIDE); break;
+        case TOKEN_PERCENT:       emitByte(OP_MODULO); break;
+        case TOKEN_TILDE_SLASH:   emitByte(OP_INT_DIVIDE); break;
+        case TOKEN_AMPERSAND:     emitByte(OP_BIT_AND); break;
+        case TOKEN_PIPE:          emitByte(OP_BIT_OR); break;
+        case TOKEN_CARET:         emitByte(OP_BIT_XOR); break;
+        case TOKEN_LESS_LESS:     emitByte(OP_SHIFT_LEFT); break;
+        case TOKEN_GREATER_GREATER: emitByte(OP_SHIFT_RIGHT); break;
         default: return;
     }
+
+    // Arithmetic that didn't fail gave a number, and every comparison gives a bool
+    noteType(rule->precedence <= PREC_COMPARISON ? VALUE_BOOL : VALUE_NUMBER);
 }
 
 static void call(bool canAssign) {
     uint8_t argCount = argumentList();
+    current->lastCall = currentChunk()->count;
     emitBytes(OP_CALL, argCount);
 }
 
@@ -420,15 +719,16 @@ static void dot(bool canAssign) {
         emitBytes(OP_INVOKE, name);
         emitByte(argCount);
     } else {
+        current->lastProperty = currentChunk()->count;
         emitBytes(OP_GET_PROPERTY, name);
     }
 }
 
 static void literal(bool canAssign) {
     switch (parser.previous.type) {
-        case TOKEN_FALSE: emitByte(OP_FALSE); break;
-        case TOKEN_NULL: emitByte(OP_NULL); break;
-        case TOKEN_TRUE: emitByte(OP_TRUE); break;
+        case TOKEN_FALSE: emitConstant(FALSE_VAL); break;
+        case TOKEN_NULL: emitConstant(NULL_VAL); break;
+        case TOKEN_TRUE: emitConstant(TRUE_VAL); break;
         default: return;
     }
 }
@@ -438,9 +738,14 @@ static void grouping(bool canAssign) {
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
 }
 
+// Whole literals that fit become ints, the rest doubles
 static void number(bool canAssign) {
     double value = strtod(parser.previous.start, NULL);
-    emitConstant(NUMBER_VAL(value));
+    if (value <= INT32_MAX && value == (int32_t)value) {
+        emitConstant(INT_VAL((int32_t)value));
+    } else {
+        emitConstant(NUMBER_VAL(value));
+    }
 }
 
 static void or_(bool canAssign) {
@@ -454,16 +759,118 @@ static void or_(bool canAssign) {
     patchJump(endJump);
 }
 
+static int escapedChar(char c) {
+    switch (c) {
+        case 'n': return '\n';
+        case 't': return '\t';
+        case 'r': return '\r';
+        case '0': return '\0';
+        case '\\': return '\\';
+        case '"': return '"';
+        case '\'': return '"';
+        default: return -1;
+    }
+}
+
+// Escapes are decoded once here, so the string holds the real bytes
 static void string(bool canAssign) {
-    emitConstant(OBJ_VAL(copyString(parser.previous.start + 1, parser.previous.length - 2)));
+    const char* chars = parser.previous.start + 1;
+    int rawLength = parser.previous.length - 2;
+
+    int length = 0;
+    for (int i = 0; i < rawLength; i++) {
+        if (chars[i] == '\\') {
+            i++;
+            if (escapedChar(chars[i]) == -1) {
+                error("Unrecognized escape sequence.");
+                return;
+            }
+        }
+        length++;
+    }
+
+    if (length == rawLength) {
+        emitConstant(OBJ_VAL(copyString(chars, length)));
+        return;
+    }
+
+    ObjString* decoded = makeString(length);
+    for (int i = 0, j = 0; i < rawLength; i++, j++) {
+        decoded->chars[j] = chars[i] == '\\' ? escapedChar(chars[++i]) : chars[i];
+    }
+
+    emitConstant(OBJ_VAL(internString(decoded)));
+}
+
+// The local name resolves to, searched out through the enclosing functions as resolving
+// it would, or NULL for a global
+static Local* findLocal(Token* name) {
+    for (Compiler* compiler = current; compiler != NULL; compiler = compiler->enclosing) {
+        for (int i = compiler->localCount - 1; i >= 0; i--) {
+            if (identifiersEqual(name, &compiler->locals[i].name)) return &compiler->locals[i];
+        }
+    }
+    return NULL;
+}
+
+// Whether name resolves to a const, and what it holds if the compiler knows
+static bool isConstant(Token* name, bool* isFolded, Value* value) {
+    Local* local = findLocal(name);
+    if (local != NULL) {
+        *isFolded = local->isFolded;
+        *value = local->constant;
+        return local->isConst;
+    }
+
+    ObjString* string = copyString(name->start, name->length);
+    if (!string->isConst) return false;
+    *isFolded = tableGet(&vm.constGlobals, string, value);
+    return true;
+}
+
+// Makes sure the value just compiled is of the annotated type: not at all when it's known
+// to be, an error when it's known not to be, and a check at runtime otherwise
+static void checkValue(ValueType type) {
+    ValueType actual = tailType();
+    if (type == VALUE_ANY || actual == type) return;
+
+    if (actual != VALUE_ANY) {
+        char message[32];
+        snprintf(message, sizeof(message), "Expected a %s value.", valueTypeName(type));
+        error(message);
+        return;
+    }
+    emitBytes(OP_CHECK_TYPE, (uint8_t)type);
+    noteType(type);
+}
+
+// A call to a global that still holds one of the math natives it started out with
+static bool isMathCall(int name) {
+    if (!check(TOKEN_LEFT_PAREN)) return false;
+    return AS_STRING(currentChunk()->constants.values[name])->intrinsic != MATH_NONE;
 }
 
 static void namedVariable(Token name, bool canAssign) {
+    bool isFolded;
+    Value constant;
+    if (isConstant(&name, &isFolded, &constant)) {
+        if (canAssign && match(TOKEN_EQUAL)) {
+            error("Can't assign to a constant.");
+            expression();
+            return;
+        }
+        if (isFolded) {
+            emitConstant(constant);
+            return;
+        }
+    }
+
     uint8_t getOp, setOp;
     int arg = resolveLocal(current, &name);
     if (arg != -1) {
         getOp = OP_GET_LOCAL;
         setOp = OP_SET_LOCAL;
+        if (!check(TOKEN_LEFT_PAREN)) current->locals[arg].escapes = true;
     } else if ((arg = resolveUpvalue(current, &name)) != -1) {
         getOp = OP_GET_UPVALUE;
         setOp = OP_SET_UPVALUE;
@@ -472,12 +879,24 @@ static void namedVariable(Token name, bool canAssign) {
         getOp = OP_GET_GLOBAL;
         setOp = OP_SET_GLOBAL;
     }
+    // Globals check their type when they're stored, a later declaration may change it
+    Local* local = getOp == OP_GET_GLOBAL ? NULL : findLocal(&name);
+    ValueType type = local != NULL ? local->type : VALUE_ANY;
     if (canAssign && match(TOKEN_EQUAL)) {
         expression();
+        checkValue(type);
         emitBytes(setOp, (uint8_t)arg);
+    } else if (getOp == OP_GET_GLOBAL && isMathCall(arg)) {
+        // Nothing is loaded into the callee's slot, OP_MATH fills it in if it has to call
+        emitByte(OP_NULL);
+        match(TOKEN_LEFT_PAREN);
+        uint8_t argCount = argumentList();
+        emitBytes(OP_MATH, (uint8_t)arg);
+        emitByte(argCount);
     } else {
         emitBytes(getOp, (uint8_t)arg);
     }
+    noteType(type);
 }
 
 static void variable(bool canAssign) {
@@ -526,9 +945,12 @@ static void this_(bool canAssign) {
 static void unary(bool canAssign) {
     TokenType operatorType = parser.previous.type;
     parsePrecedence(PREC_UNARY);
+    if (foldUnary(operatorType)) return;
+
     switch (operatorType) {
-        case TOKEN_BANG: emitByte(OP_NOT); break;
-        case TOKEN_MINUS: emitByte(OP_NEGATE); break;
+        case TOKEN_BANG: emitByte(OP_NOT); noteType(VALUE_BOOL); break;
+        case TOKEN_MINUS: emitByte(OP_NEGATE); noteType(VALUE_NUMBER); break;
+        case TOKEN_TILDE: emitByte(OP_BIT_NOT); noteType(VALUE_NUMBER); break;
         default: return;
     }
 }
@@ -543,32 +965,51 @@ ParseRule rules[] = {
     [TOKEN_MINUS]         = {unary,    binary, PREC_TERM},
     [TOKEN_PLUS]          = {NULL,     binary, PREC_TERM},
     [TOKEN_SEMICOLON]     = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_COLON]         = {NULL,     NULL,   PREC_NONE},
     [TOKEN_SLASH]         = {NULL,     binary, PREC_FACTOR},
     [TOKEN_STAR]          = {NULL,     binary, PREC_FACTOR},
+    [TOKEN_PERCENT]       = {NULL,     binary, PREC_FACTOR},
+    [TOKEN_AMPERSAND]     = {NULL,     binary, PREC_BIT_AND},
+    [TOKEN_PIPE]          = {NULL,     binary, PREC_BIT_OR},
+    [TOKEN_CARET]         = {NULL,     binary, PREC_BIT_XOR},
     [TOKEN_BANG]          = {unary,    NULL,   PREC_NONE},
     [TOKEN_BANG_EQUAL]    = {NULL,     binary, PREC_EQUALITY},
     [TOKEN_EQUAL]         = {NULL,     NULL,   PREC_NONE},
     [TOKEN_EQUAL_EQUAL]   = {NULL,     binary, PREC_EQUALITY},
     [TOKEN_GREATER]       = {NULL,     binary, PREC_COMPARISON},
     [TOKEN_GREATER_EQUAL] = {NULL,     binary, PREC_COMPARISON},
+    [TOKEN_GREATER_GREATER] = {NULL,   binary, PREC_SHIFT},
     [TOKEN_LESS]          = {NULL,     binary, PREC_COMPARISON},
     [TOKEN_LESS_EQUAL]    = {NULL,     binary, PREC_COMPARISON},
+    [TOKEN_LESS_LESS]     = {NULL,     binary, PREC_SHIFT},
+    [TOKEN_TILDE]         = {unary,    NULL,   PREC_NONE},
+    [TOKEN_TILDE_SLASH]   = {NULL,     binary, PREC_FACTOR},
     [TOKEN_IDENTIFIER]    = {variable, NULL,   PREC_NONE},
     [TOKEN_STRING]        = {string,   NULL,   PREC_NONE},
     [TOKEN_NUMBER]        = {number,   NULL,   PREC_NONE},
     [TOKEN_AND]           = {NULL,     and_,   PREC_AND},
+    [TOKEN_BOOL]          = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_CASE]          = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_CATCH]         = {NULL,     NULL,   PREC_NONE},
     [TOKEN_CLASS]         = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_CONST]         = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_DEFAULT]       = {NULL,     NULL,   PREC_NONE},
     [TOKEN_ELSE]          = {NULL,     NULL,   PREC_NONE},
     [TOKEN_FALSE]         = {literal,  NULL,   PREC_NONE},
     [TOKEN_FOR]           = {NULL,     NULL,   PREC_NONE},
     [TOKEN_FUN]           = {NULL,     NULL,   PREC_NONE},
     [TOKEN_IF]            = {NULL,     NULL,   PREC_NONE},
     [TOKEN_NULL]          = {literal,  NULL,   PREC_NONE},
+    [TOKEN_NUM]           = {NULL,     NULL,   PREC_NONE},
     [TOKEN_OR]            = {NULL,     or_,    PREC_OR},
     [TOKEN_RETURN]        = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_STR]           = {NULL,     NULL,   PREC_NONE},
     [TOKEN_SUPER]         = {super_,   NULL,   PREC_NONE},
+    [TOKEN_SWITCH]        = {NULL,     NULL,   PREC_NONE},
     [TOKEN_THIS]          = {this_,    NULL,   PREC_NONE},
+    [TOKEN_THROW]         = {NULL,     NULL,   PREC_NONE},
     [TOKEN_TRUE]          = {literal,  NULL,   PREC_NONE},
+    [TOKEN_TRY]           = {NULL,     NULL,   PREC_NONE},
     [TOKEN_VAR]           = {NULL,     NULL,   PREC_NONE},
     [TOKEN_WHILE]         = {NULL,     NULL,   PREC_NONE},
     [TOKEN_ERROR]         = {NULL,     NULL,   PREC_NONE},
@@ -613,11 +1054,18 @@ static void block() {
     consume(TOKEN_RIGHT_BRACE, "Expect '}' after block.");
 }
 
-static void function(FunctionType type) {
-    Compiler compiler;
-    initCompiler(&compiler, type);
-    beginScope();
+static bool matchType(ValueType* type) {
+    switch (parser.current.type) {
+        case TOKEN_NUM:  *type = VALUE_NUMBER; break;
+        case TOKEN_STR:  *type = VALUE_STRING; break;
+        case TOKEN_BOOL: *type = VALUE_BOOL; break;
+        default:         return false;
+    }
+    advance();
+    return true;
+}
 
+static void parameters() {
     consume(TOKEN_LEFT_PAREN, "Expect '(' after function name.");
     if (!check(TOKEN_RIGHT_PAREN)) {
         do {
@@ -625,15 +1073,75 @@ static void function(FunctionType type) {
             if (current->function->arity > 255) {
                 errorAtCurrent("Can't have more than 255 parameters.");
             }
+            ValueType type = VALUE_ANY;
+            matchType(&type);
             uint8_t constant = parseVariable("Expect parameter name.");
+            current->locals[current->localCount - 1].type = type;
             defineVariable(constant);
         } while (match(TOKEN_COMMA));
     }
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
     consume(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
-    block();
+}
 
-    ObjFunction* function = endCompiler();
+// Annotated parameters are checked once on the way in, the body can count on them after that
+static void checkParameters() {
+    for (int i = 1; i <= current->function->arity; i++) {
+        ValueType type = current->locals[i].type;
+        if (type == VALUE_ANY) continue;
+        emitBytes(OP_GET_LOCAL, (uint8_t)i);
+        emitBytes(OP_CHECK_TYPE, (uint8_t)type);
+        emitByte(OP_POP);
+    }
+}
+
+// Only bodies that can't capture anything are left for later: functions declared at the
+// top of the script and methods of top level classes that have no superclass
+static bool canDefer(FunctionType type) {
+    if (unitSource == NULL) return false;
+    if (current->enclosing->type != TYPE_SCRIPT || current->enclosing->scopeDepth > 0) return false;
+    return type == TYPE_FUNCTION || !currentClass->hasSuperclass;
+}
+
+// Pre-parses a body: the parameters are read so the arity is known, the rest is only
+// matched brace for brace and compiled by compileBody on the first call
+static void deferBody(FunctionType type) {
+    ObjFunction* function = current->function;
+    function->source = unitSource;
+    function->sourceOffset = (int)(parser.current.start - unitSource->chars);
+    function->sourceLine = parser.current.line;
+    function->sourceType = type;
+
+    parameters();
+    int depth = 1;
+    while (depth > 0) {
+        if (check(TOKEN_EOF)) {
+            errorAtCurrent("Expect '}' after block.");
+            break;
+        }
+        if (check(TOKEN_LEFT_BRACE)) depth++;
+        if (check(TOKEN_RIGHT_BRACE)) depth--;
+        advance();
+    }
+}
+
+static void function(FunctionType type, ValueType returnType) {
+    Compiler compiler;
+    initCompiler(&compiler, type);
+    current->function->returnType = returnType;
+    beginScope();
+
+    ObjFunction* function;
+    if (canDefer(type)) {
+        deferBody(type);
+        function = current->function;
+        current = current->enclosing;
+    } else {
+        parameters();
+        checkParameters();
+        block();
+        function = endCompiler();
+    }
     emitBytes(OP_CLOSURE, makeConstant(OBJ_VAL(function)));
 
     for (int i = 0; i < function->upvalueCount; i++) {
@@ -643,14 +1151,18 @@ static void function(FunctionType type) {
 }
 
 static void method() {
+    ValueType returnType = VALUE_ANY;
+    matchType(&returnType);
     consume(TOKEN_IDENTIFIER, "Expect method name.");
     uint8_t constant = identifierConstant(&parser.previous);
     FunctionType type = TYPE_METHOD;
     if (parser.previous.length == 4 && memcmp(parser.previous.start, "init", 4) == 0) {
         type = TYPE_INITIALIZER;
+        if (returnType != VALUE_ANY) error("Can't give an initializer a return type.");
+        returnType = VALUE_ANY;
     }
     
-    function(type);
+    function(type, returnType);
     emitBytes(OP_METHOD, constant);
 }
 
@@ -658,6 +1170,9 @@ static void classDeclaration() {
     consume(TOKEN_IDENTIFIER, "Expect class name.");
     Token className = parser.previous;
     uint8_t nameConstant = identifierConstant(&parser.previous);
+    if (current->scopeDepth == 0 && AS_STRING(currentChunk()->constants.values[nameConstant])->isConst) {
+        error("Already a constant with this name.");
+    }
     declareVariable();
 
     emitBytes(OP_CLASS, nameConstant);
@@ -701,23 +1216,78 @@ static void classDeclaration() {
 }
 
 static void funDeclaration() {
+    ValueType returnType = VALUE_ANY;
+    matchType(&returnType);
     uint8_t global = parseVariable("Expect function name.");
     markInitialized();
-    function(TYPE_FUNCTION);
+    if (current->scopeDepth > 0) {
+        current->locals[current->localCount - 1].producer = currentChunk()->count;
+    }
+    function(TYPE_FUNCTION, returnType);
+    defineVariable(global);
+}
+
+// A const whose initializer folds to a constant is never read at runtime, every use
+// gets the constant itself. Any other const is a variable that can't be assigned.
+static void constDeclaration() {
+    uint8_t global = parseVariable("Expect constant name.");
+
+    // The const would reach back to the stores the global already had
+    if (current->scopeDepth == 0 && AS_STRING(currentChunk()->constants.values[global])->isDeclared) {
+        error("Already a variable with this name.");
+    }
+    consume(TOKEN_EQUAL, "Expect '=' after constant name.");
+
+    int start = currentChunk()->count;
+    expression();
+    bool isFolded = constantTail(1) == start;
+    Value value = isFolded ? current->constants[1].value : NULL_VAL;
+    consume(TOKEN_SEMICOLON, "Expect ';' after constant declaration.");
+
+    if (current->scopeDepth > 0) {
+        Local* local = &current->locals[current->localCount - 1];
+        local->isConst = true;
+        local->isFolded = isFolded;
+        local->constant = value;
+    } else if (!parser.hadError) {
+        // A unit that doesn't compile doesn't leave a const behind for the next one
+        ObjString* name = AS_STRING(currentChunk()->constants.values[global]);
+        name->isConst = true;
+        if (isFolded) tableSet(&vm.constGlobals, name, value);
+    }
     defineVariable(global);
 }
 
-static void varDeclaration() {
+// `int` declares a variable that holds anything. num, str and bool ones start out
+// as 0, "" and false, and whatever is stored in them later is checked.
+static void varDeclaration(ValueType type) {
     uint8_t global = parseVariable("Expect variable name.");
 
+    // `int m = object.method;` may bind a method that never leaves the frame
+    int producer = -1;
     if (match(TOKEN_EQUAL)) {
         expression();
+        int property = currentChunk()->count - 2;
+        if (type == VALUE_ANY && current->lastProperty == property && currentChunk()->code[property] == OP_GET_PROPERTY) {
+            producer = property;
+        }
+        checkValue(type);
+    } else if (type == VALUE_NUMBER) {
+        emitConstant(INT_VAL(0));
+    } else if (type == VALUE_STRING) {
+        emitConstant(OBJ_VAL(copyString("", 0)));
+    } else if (type == VALUE_BOOL) {
+        emitConstant(FALSE_VAL);
     } else {
         emitByte(OP_NULL);
     }
     consume(TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
 
-    defineVariable(global);
+    if (current->scopeDepth > 0) {
+        current->locals[current->localCount - 1].type = type;
+        current->locals[current->localCount - 1].producer = producer;
+    }
+    defineTypedVariable(global, type);
 }
 
 static void expressionStatement() {
@@ -726,44 +1296,156 @@ static void expressionStatement() {
     emitByte(OP_POP);
 }
 
+// The operands of an OP_FOR_STEP, read off the condition and increment of a counted loop
+typedef struct {
+    uint8_t counter;
+    uint8_t step;
+    uint8_t arithmetic;
+    uint8_t comparison;
+    uint8_t load;
+    uint8_t bound;
+} CountedLoop;
+
+// FOR_STEP does its own checks, so it takes the plain form of a typed instruction
+static uint8_t untypedInstruction(uint8_t instruction) {
+    switch (instruction) {
+        case OP_GREATER_NUM:  return OP_GREATER;
+        case OP_LESS_NUM:     return OP_LESS;
+        case OP_ADD_NUM:      return OP_ADD;
+        case OP_SUBTRACT_NUM: return OP_SUBTRACT;
+        default:              return instruction;
+    }
+}
+
+// Whether the condition compiled to [start, end) is `local < local, constant or global` (or <=, >, >=)
+static bool countedCondition(int start, int end, CountedLoop* loop) {
+    uint8_t* code = currentChunk()->code;
+    if (end - start < 5 || code[start] != OP_GET_LOCAL) return false;
+
+    uint8_t load = code[start + 2];
+    if (load != OP_GET_LOCAL && load != OP_CONSTANT && load != OP_GET_GLOBAL) return false;
+
+    // <= and >= still come as GREATER NOT and LESS NOT here, the peephole pass fuses them later
+    uint8_t comparison = untypedInstruction(code[start + 4]);
+    if (end - start == 6 && code[start + 5] == OP_NOT && (comparison == OP_GREATER || comparison == OP_LESS)) {
+        comparison = comparison == OP_GREATER ? OP_NOT_GREATER : OP_NOT_LESS;
+    } else if (end - start != 5 || (comparison != OP_LESS && comparison != OP_GREATER)) {
+        return false;
+    }
+
+    loop->counter = code[start + 1];
+    loop->comparison = comparison;
+    loop->load = load;
+    loop->bound = code[start + 3];
+    return true;
+}
+
+// Whether the increment compiled to [start, end) is `counter = counter + number` (or -)
+static bool countedIncrement(int start, int end, CountedLoop* loop) {
+    uint8_t* code = currentChunk()->code;
+    if (end - start != 8) return false;
+
+    uint8_t arithmetic = untypedInstruction(code[start + 4]);
+    bool matches = code[start] == OP_GET_LOCAL && code[start + 1] == loop->counter &&
+                   code[start + 2] == OP_CONSTANT &&
+                   (arithmetic == OP_ADD || arithmetic == OP_SUBTRACT) &&
+                   code[start + 5] == OP_SET_LOCAL && code[start + 6] == loop->counter &&
+                   code[start + 7] == OP_POP;
+    if (!matches || !IS_NUMBER(currentChunk()->constants.values[code[start + 3]])) return false;
+
+    loop->step = code[start + 3];
+    loop->arithmetic = arithmetic;
+    return true;
+}
+
+static void emitForStep(CountedLoop* loop, int bodyStart, int line) {
+    uint8_t operands[] = {OP_FOR_STEP, loop->counter, loop->step, loop->arithmetic,
+                          loop->comparison, loop->load, loop->bound};
+    for (int i = 0; i < (int)sizeof(operands); i++) {
+        writeChunk(currentChunk(), operands[i], line);
+    }
+
+    int offset = currentChunk()->count - bodyStart + 2;
+    if (offset > UINT16_MAX) error("Loop body too large.");
+
+    writeChunk(currentChunk(), (offset >> 8) & 0xff, line);
+    writeChunk(currentChunk(), offset & 0xff, line);
+}
+
+// * A counted loop, `for (int i = 0; i < n; i = i + 1)`, checks its condition once
+// * on the way in and then ends its body with a single OP_FOR_STEP that steps,
+// * compares and loops back, instead of a jump to the increment and a loop back
+// * to the condition.
 static void forStatement() {
     beginScope();
     consume(TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+    ValueType type = VALUE_ANY;
     if (match(TOKEN_SEMICOLON)) {
         // No initializer.
-    } else if (match(TOKEN_VAR)) {
-        varDeclaration();
+    } else if (match(TOKEN_VAR) || matchType(&type)) {
+        varDeclaration(type);
     } else {
         expressionStatement();
     }
 
     int loopStart = currentChunk()->count;
     int exitJump = -1;
+    CountedLoop counted = {0};
+    bool isCounted = false;
     if (!match(TOKEN_SEMICOLON)) {
         expression();
+        isCounted = countedCondition(loopStart, currentChunk()->count, &counted);
         consume(TOKEN_SEMICOLON, "Expect ';' after loop condition.");
 
         exitJump = emitJump(OP_JUMP_IF_FALSE);
         emitByte(OP_POP);
     }
+
+    int stepLine = parser.previous.line;
     if (!match(TOKEN_RIGHT_PAREN)) {
         int bodyJump = emitJump(OP_JUMP);
         int incrementStart = currentChunk()->count;
         expression();
         emitByte(OP_POP);
+
+        // The increment may end in a `;` like any other statement
+        match(TOKEN_SEMICOLON);
         consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
 
-        emitLoop(loopStart);
-        loopStart = incrementStart;
-        patchJump(bodyJump);
+        isCounted = isCounted && countedIncrement(incrementStart, currentChunk()->count, &counted);
+        if (isCounted) {
+            // The FOR_STEP after the body does all of this
+            stepLine = getLine(&currentChunk()->lines, incrementStart);
+            currentChunk()->count = bodyJump - 1;
+            current->constants[0].offset = -1;
+            current->constants[1].offset = -1;
+            current->typedEnd = -1;
+            current->lastProperty = -1;
+        } else {
+            emitLoop(loopStart);
+            loopStart = incrementStart;
+            patchJump(bodyJump);
+        }
+    } else {
+        isCounted = false;
     }
 
+    int bodyStart = currentChunk()->count;
     statement();
-    emitLoop(loopStart);
 
-    if (exitJump != -1) {
+    if (isCounted) {
+        emitForStep(&counted, bodyStart, stepLine);
+        int endJump = emitJump(OP_JUMP);
         patchJump(exitJump);
         emitByte(OP_POP);
+        patchJump(endJump);
+    } else {
+        emitLoop(loopStart);
+
+        if (exitJump != -1) {
+            patchJump(exitJump);
+            emitByte(OP_POP);
+        }
     }
 
     endScope();
@@ -786,19 +1468,141 @@ static void ifStatement() {
     patchJump(elseJump);
 }
 
+// A case value is any expression that folds to a number or string constant
+static void caseValue(int table, int index) {
+    int start = currentChunk()->count;
+    expression();
+    if (constantTail(1) != start) {
+        error("Case value must be a constant.");
+        return;
+    }
+
+    Value value = current->constants[1].value;
+    currentChunk()->count = start;
+    current->constants[0].offset = -1;
+    current->constants[1].offset = -1;
+    current->typedEnd = -1;
+    current->lastProperty = -1;
+    if (!IS_NUMBER(value) && !IS_STRING(value)) {
+        error("Case value must be a number or a string.");
+    } else if (!addSwitchCase(currentChunk(), table, value, index)) {
+        error("Duplicate case value.");
+    }
+}
+
+// Makes room for `length` bytes at `offset`, moving everything after it along
+static void insertCode(int offset, int length, int line) {
+    Chunk* chunk = currentChunk();
+    int count = chunk->count;
+    for (int i = 0; i < length; i++) {
+        writeChunk(chunk, 0, line);
+    }
+    memmove(chunk->code + offset + length, chunk->code + offset, count - offset);
+    insertLines(&chunk->lines, count, offset, length, line);
+    for (int i = 0; i < chunk->handlerCount; i++) {
+        ExceptionHandler* handler = &chunk->handlers[i];
+        if (handler->start >= offset) handler->start += length;
+        if (handler->end >= offset) handler->end += length;
+        if (handler->handler >= offset) handler->handler += length;
+    }
+    current->constants[0].offset = -1;
+    current->constants[1].offset = -1;
+    current->typedEnd = -1;
+    current->lastCall = -1;
+    current->lastProperty = -1;
+}
+
+// Cases don't fall through. How many jumps follow the OP_SWITCH is only known once
+// every case is compiled, so it goes in front of them afterwards. Jumps inside the
+// cases are relative and the code before them doesn't move, so none need fixing.
+static void switchStatement() {
+    int line = parser.previous.line;
+    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'switch'.");
+    expression();
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after value.");
+    consume(TOKEN_LEFT_BRACE, "Expect '{' before switch cases.");
+
+    int table = addSwitch(currentChunk());
+    if (table > UINT8_MAX) error("Too many switch statements in one function.");
+    int switchStart = currentChunk()->count;
+
+    int bodies[UINT8_COUNT];
+    int exits[UINT8_COUNT + 1];
+    int caseCount = 0;
+    int exitCount = 0;
+    int defaultBody = -1;
+    while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
+        if (match(TOKEN_DEFAULT)) {
+            if (defaultBody != -1) error("A switch can only have one default.");
+            consume(TOKEN_COLON, "Expect ':' after 'default'.");
+            defaultBody = currentChunk()->count;
+        } else {
+            consume(TOKEN_CASE, "Expect 'case' or 'default'.");
+            if (caseCount == UINT8_COUNT) {
+                error("Too many cases in one switch.");
+                return;
+            }
+            do {
+                caseValue(table, caseCount);
+            } while (match(TOKEN_COMMA));
+            consume(TOKEN_COLON, "Expect ':' after case value.");
+            bodies[caseCount++] = currentChunk()->count;
+        }
+
+        beginScope();
+        while (!check(TOKEN_CASE) && !check(TOKEN_DEFAULT) && !check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
+            declaration();
+        }
+        endScope();
+        if (exitCount <= UINT8_COUNT) exits[exitCount++] = emitJump(OP_JUMP);
+    }
+    consume(TOKEN_RIGHT_BRACE, "Expect '}' after switch cases.");
+    if (parser.hadError) return;
+
+    int jumpCount = caseCount + 1;
+    int length = 2 + 3 * jumpCount;
+    finishSwitch(currentChunk(), table, jumpCount);
+    insertCode(switchStart, length, line);
+
+    uint8_t* code = currentChunk()->code;
+    code[switchStart] = OP_SWITCH;
+    code[switchStart + 1] = (uint8_t)table;
+    int end = currentChunk()->count;
+    for (int i = 0; i < jumpCount; i++) {
+        int offset = switchStart + 2 + 3 * i;
+        int target = i < caseCount ? bodies[i] + length : (defaultBody != -1 ? defaultBody + length : end);
+        int jump = target - (offset + 3);
+        if (jump > UINT16_MAX) error("Too much code to jump over.");
+        code[offset] = OP_JUMP;
+        code[offset + 1] = (jump >> 8) & 0xff;
+        code[offset + 2] = jump & 0xff;
+    }
+    for (int i = 0; i < exitCount; i++) {
+        patchJump(exits[i] + length);
+    }
+}
+
 static void returnStatement() {
     if (current->type == TYPE_SCRIPT) {
         error("Can't return from top-level code.");
     }
 
     if (match(TOKEN_SEMICOLON)) {
+        if (current->function->returnType != VALUE_ANY) error("Expect a return value.");
         emitReturn();
     } else {
         if (current->type == TYPE_INITIALIZER) {
             error("Can't return a value from an initializer.");
         }
         expression();
+        checkValue(current->function->returnType);
         consume(TOKEN_SEMICOLON, "Expect ';' after return value.");
+
+        // Returning a call's result as is lets the callee take over this frame. The
+        // RETURN stays for callees that aren't closures and for jumps landing after the call.
+        // Inside a try the frame has to stay, or the try wouldn't see the callee fail.
+        int callOffset = currentChunk()->count - 2;
+        if (current->lastCall == callOffset && current->tryDepth == 0) currentChunk()->code[callOffset] = OP_TAIL_CALL;
         emitByte(OP_RETURN);
     }
 }
@@ -818,6 +1622,45 @@ static void whileStatement() {
     emitByte(OP_POP);
 }
 
+// The try costs nothing while nothing fails: its body runs as is, and only the chunk's
+// handler table knows where it starts and ends. An error inside it lands in the catch
+// block with the stack cut back to what it was at `try` and the error in `name`.
+static void tryStatement() {
+    int depth = current->localCount;
+    int start = currentChunk()->count;
+    current->lastJumpTarget = start;
+    consume(TOKEN_LEFT_BRACE, "Expect '{' after 'try'.");
+    current->tryDepth++;
+    beginScope();
+    block();
+    endScope();
+    current->tryDepth--;
+
+    int end = currentChunk()->count;
+    int exitJump = emitJump(OP_JUMP);
+    int handler = currentChunk()->count;
+    current->lastJumpTarget = handler;
+    addHandler(currentChunk(), start, end, handler, depth);
+
+    consume(TOKEN_CATCH, "Expect 'catch' after try block.");
+    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'catch'.");
+    consume(TOKEN_IDENTIFIER, "Expect error variable name.");
+    beginScope();
+    addLocal(parser.previous);
+    markInitialized();
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after error variable name.");
+    consume(TOKEN_LEFT_BRACE, "Expect '{' after catch.");
+    block();
+    endScope();
+    patchJump(exitJump);
+}
+
+static void throwStatement() {
+    expression();
+    consume(TOKEN_SEMICOLON, "Expect ';' after thrown value.");
+    emitByte(OP_THROW);
+}
+
 static void synchronize() {
     parser.panikMode = false;
 
@@ -827,10 +1670,17 @@ static void synchronize() {
             case TOKEN_CLASS:
             case TOKEN_FUN:
             case TOKEN_VAR:
+            case TOKEN_NUM:
+            case TOKEN_STR:
+            case TOKEN_BOOL:
+            case TOKEN_CONST:
             case TOKEN_FOR:
             case TOKEN_IF:
+            case TOKEN_SWITCH:
             case TOKEN_WHILE:
             case TOKEN_RETURN:
+            case TOKEN_TRY:
+            case TOKEN_THROW:
                 return;
             default:
                 ;
@@ -842,12 +1692,15 @@ static void synchronize() {
 
 // ! N declares independance from DoorSpires computer
 static void declaration() {
+    ValueType type = VALUE_ANY;
     if (match(TOKEN_CLASS)) {
         classDeclaration();
     } else if (match(TOKEN_FUN)) {
         funDeclaration();
-    } else if (match(TOKEN_VAR)) {
-        varDeclaration();
+    } else if (match(TOKEN_VAR) || matchType(&type)) {
+        varDeclaration(type);
+    } else if (match(TOKEN_CONST)) {
+        constDeclaration();
     } else {
         statement();
     }
@@ -862,8 +1715,14 @@ static void statement() {
         ifStatement();
     } else if (match(TOKEN_RETURN)) {
         returnStatement();
+    } else if (match(TOKEN_SWITCH)) {
+        switchStatement();
     } else if (match(TOKEN_WHILE)) {
         whileStatement();
+    } else if (match(TOKEN_TRY)) {
+        tryStatement();
+    } else if (match(TOKEN_THROW)) {
+        throwStatement();
     } else if (match(TOKEN_LEFT_BRACE)) {
         beginScope();
         block();
@@ -873,7 +1732,68 @@ static void statement() {
     }
 }
 
+typedef void (*FunctionPass)(ObjFunction* function);
+
+// Runs pass over function and every function nested in it
+static void forEachFunction(ObjFunction* function, FunctionPass pass) {
+    if (function->source != NULL) return; // not compiled yet, compileBody runs the passes
+    pass(function);
+    ValueArray* constants = &function->chunk.constants;
+    for (int i = 0; i < constants->count; i++) {
+        if (IS_FUNCTION(constants->values[i])) forEachFunction(AS_FUNCTION(constants->values[i]), pass);
+    }
+}
+
+static void optimizeFunction(ObjFunction* function) {
+    optimizeSSA(function);
+#ifdef DEBUG_PRINT_CODE
+    const char* name = function->name != NULL ? function->name->chars : "<script>";
+    disassembleChunk(&function->chunk, "after ssa");
+    printf("== %s: %d instructions ==\n\n", name, countInstructions(&function->chunk));
+#endif
+    hoistInvariants(function);
+#ifdef DEBUG_PRINT_CODE
+    disassembleChunk(&function->chunk, "after hoisting");
+    printf("== %s: %d instructions ==\n\n", name, countInstructions(&function->chunk));
+#endif
+}
+
+#ifdef DEBUG_PRINT_CODE
+static void printInlined(ObjFunction* function) {
+    const char* name = function->name != NULL ? function->name->chars : "<script>";
+    disassembleChunk(&function->chunk, "after inlining");
+    printf("== %s: %d instructions ==\n\n", name, countInstructions(&function->chunk));
+}
+#endif
+
+static void translateFunction(ObjFunction* function) {
+    translateToRegisters(function);
+#ifdef DEBUG_PRINT_CODE
+    const char* name = function->name != NULL ? function->name->chars : "<script>";
+    if (function->registers != NULL) disassembleRegisters(function, name);
+    else printf("== %s stays on the stack VM ==\n", name);
+    printf("\n");
+#endif
+}
+
+// Records how deep a call can go on the stack, so the VM reserves that much when it's made.
+// The register code can't be deeper than the stack code it was made from, but it's checked anyway.
+static void measureFunction(ObjFunction* function) {
+    Chunk* chunk = &function->chunk;
+    int* depths = ALLOCATE(int, chunk->count + 1);
+    int maxDepth;
+    function->stackSize = computeStackDepths(chunk, function->arity + 1, depths, &maxDepth) ? maxDepth : -1;
+    if (function->stackSize != -1 && function->registers != NULL && function->registers->frameSize > maxDepth) {
+        function->stackSize = function->registers->frameSize;
+    }
+    FREE_ARRAY(int, depths, chunk->count + 1);
+}
+
 ObjFunction* compile(const char* source) {
+    if (vm.lazy) {
+        unitSource = copyString(source, (int)strlen(source));
+        source = unitSource->chars;
+    }
     initScanner(source);
     Compiler compiler;
     initCompiler(&compiler, TYPE_SCRIPT);
@@ -886,10 +1806,62 @@ ObjFunction* compile(const char* source) {
         declaration();
     }
     ObjFunction* function = endCompiler();
-    return parser.hadError ? NULL : function;
+    unitSource = NULL;
+    if (parser.hadError) return NULL;
+
+    // The later tiers look across functions, so they wait for the whole unit.
+    // Nothing roots the script while they allocate but the stack.
+    push(OBJ_VAL(function));
+    if (vm.optimize) {
+        forEachFunction(function, optimizeFunction);
+        inlineCalls(function);
+#ifdef DEBUG_PRINT_CODE
+        forEachFunction(function, printInlined);
+#endif
+    }
+    if (vm.useRegisters) forEachFunction(function, translateFunction);
+    forEachFunction(function, measureFunction);
+    pop();
+    return function;
+}
+
+// Compiles a body deferBody skipped. The code goes into the function the closures already
+// share; the -O tiers run on it alone, so calls in it to other functions aren't inlined.
+bool compileBody(ObjFunction* function) {
+    initScannerAt(function->source->chars + function->sourceOffset, function->sourceLine);
+    parser.hadError = false;
+    parser.panikMode = false;
+
+    ClassCompiler classCompiler;
+    classCompiler.enclosing = NULL;
+    classCompiler.hasSuperclass = false;
+    currentClass = function->sourceType == TYPE_FUNCTION ? NULL : &classCompiler;
+
+    Compiler compiler;
+    parser.previous = syntheticToken(function->name->chars);
+    initCompiler(&compiler, (FunctionType)function->sourceType);
+    current->function->returnType = function->returnType;
+    beginScope();
+    advance();
+    parameters();
+    checkParameters();
+    block();
+    ObjFunction* compiled = endCompiler();
+    currentClass = NULL;
+    if (parser.hadError) return false;
+
+    function->chunk = compiled->chunk;
+    initChunk(&compiled->chunk);
+    function->source = NULL;
+
+    if (vm.optimize) forEachFunction(function, optimizeFunction);
+    if (vm.useRegisters) forEachFunction(function, translateFunction);
+    forEachFunction(function, measureFunction);
+    return true;
 }
 
 void markCompilerRoots() {
+    markObject((Obj*)unitSource);
     Compiler* compiler = current;
     while (compiler != NULL) {
         markObject((Obj*)compiler->function);
@@ -0,0 +1,418 @@
+#include <stdio.h>
+
+#include "debug.h"
+#include "object.h"
+#include "registers.h"
+#include "value.h"
+
+void disassembleChunk(Chunk* chunk, const char* name) {
+    printf("== %s ==\n", name);
+
+    for (int offset = 0; offset < chunk->count;) {
+        offset = disassembleInstruction(chunk, offset);
+    }
+
+    for (int i = 0; i < chunk->handlerCount; i++) {
+        ExceptionHandler* handler = &chunk->handlers[i];
+        printf("try %04d-%04d -> %04d depth %d\n", handler->start, handler->end, handler->handler, handler->depth);
+    }
+}
+
+int countInstructions(Chunk* chunk) {
+    int count = 0;
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        count++;
+    }
+    return count;
+}
+
+static int constantInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t constant = chunk->code[offset + 1];
+    printf("%-16s %4d '", name, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 2;
+}
+
+static int invokeInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t constant = chunk->code[offset + 1];
+    uint8_t argCount = chunk->code[offset + 2];
+    printf("%-16s (%d args) %4d '", name, argCount, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 3;
+}
+
+static int simpleInstruction(const char* name, int offset) {
+    printf("%s\n", name);
+    return offset + 1;
+}
+
+static int byteInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t slot = chunk->code[offset + 1];
+    printf("%-16s %4d\n", name, slot);
+    return offset + 2;
+}
+
+static int defineInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t constant = chunk->code[offset + 1];
+    printf("%-16s %4d '", name, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("' %s\n", valueTypeName((ValueType)chunk->code[offset + 2]));
+    return offset + 3;
+}
+
+static int typeInstruction(const char* name, Chunk* chunk, int offset) {
+    printf("%-16s %s\n", name, valueTypeName((ValueType)chunk->code[offset + 1]));
+    return offset + 2;
+}
+
+static int jumpInstruction(const char* name, int sign, Chunk* chunk, int offset) {
+    uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8);
+    jump |= chunk->code[offset + 2];
+    printf("%-16s %4d -> %d\n", name, offset, offset + 3 + sign * jump);
+    return offset + 3;
+}
+
+// Inlined calls name the function they expect and where the copy of it ends
+static int inlinedCallInstruction(const char* name, Chunk* chunk, int offset) {
+    bool isInvoke = chunk->code[offset] == OP_INVOKE_INLINED;
+    uint8_t argCount = chunk->code[offset + (isInvoke ? 2 : 1)];
+    uint8_t expected = chunk->code[offset + (isInvoke ? 3 : 2)];
+    printf("%-16s (%d args) %4d '", name, argCount, expected);
+    printValue(chunk->constants.values[expected]);
+    printf("' -> %d\n", jumpTarget(chunk, offset));
+    return offset + instructionLength(chunk, offset);
+}
+
+static int inlineReturnInstruction(const char* name, Chunk* chunk, int offset) {
+    printf("%-16s %4d -> %d\n", name, chunk->code[offset + 1], jumpTarget(chunk, offset));
+    return offset + 4;
+}
+
+// The jumps that follow print on their own, in the order the table numbers them
+static int switchInstruction(const char* name, Chunk* chunk, int offset) {
+    SwitchTable* table = &chunk->switches[chunk->code[offset + 1]];
+    printf("%-16s %4d (%d jumps, %s)\n", name, chunk->code[offset + 1], table->jumpCount,
+        table->dense != NULL ? "dense" : "searched");
+    return offset + 2;
+}
+
+static int memoInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t slot = chunk->code[offset + 1];
+    if (chunk->code[offset] == OP_MEMO) {
+        printf("%-16s %4d -> %d\n", name, slot, jumpTarget(chunk, offset));
+    } else {
+        printf("%-16s %4d%s\n", name, slot, chunk->code[offset + 2] ? " pure" : "");
+    }
+    return offset + instructionLength(chunk, offset);
+}
+
+static const char* comparisonSymbol(uint8_t comparison) {
+    switch (comparison) {
+        case OP_LESS:        return "<";
+        case OP_NOT_GREATER: return "<=";
+        case OP_GREATER:     return ">";
+        default:             return ">=";
+    }
+}
+
+// Printed as what it does: counter += step, loop while counter < bound
+static int forStepInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t* code = &chunk->code[offset];
+    printf("%-16s %4d %c= '", name, code[1], code[3] == OP_ADD ? '+' : '-');
+    printValue(chunk->constants.values[code[2]]);
+    printf("' %s ", comparisonSymbol(code[4]));
+    if (code[5] == OP_GET_LOCAL) {
+        printf("local %d", code[6]);
+    } else {
+        printf("'");
+        printValue(chunk->constants.values[code[6]]);
+        printf("'");
+    }
+    printf(" -> %d\n", jumpTarget(chunk, offset));
+    return offset + instructionLength(chunk, offset);
+}
+
+int disassembleInstruction(Chunk* chunk, int offset) {
+    printf("%04d ", offset);
+    int line = getLine(&chunk->lines, offset);
+    if (offset > 0 && line == getLine(&chunk->lines, offset - 1)) {
+        printf("   | ");
+    } else {
+        printf("%4d ", line);
+    }
+
+    uint8_t instruction = chunk->code[offset];
+    switch (instruction) {
+        case OP_CONSTANT:
+            return constantInstruction("OP_CONSTANT", chunk, offset);
+        case OP_NULL:
+            return simpleInstruction("OP_NULL", offset);
+        case OP_TRUE:
+            return simpleInstruction("OP_TRUE", offset);
+        case OP_FALSE:
+            return simpleInstruction("OP_FALSE", offset);
+        case OP_POP:
+            return simpleInstruction("OP_POP", offset);
+        case OP_GET_LOCAL:
+            return byteInstruction("OP_GET_LOCAL", chunk, offset);
+        case OP_SET_LOCAL:
+            return byteInstruction("OP_SET_LOCAL", chunk, offset);
+        case OP_SET_LOCAL_POP:
+            return byteInstruction("OP_SET_LOCAL_POP", chunk, offset);
+        case OP_GET_GLOBAL:
+            return constantInstruction("OP_GET_GLOBAL", chunk, offset);
+        case OP_DEFINE_GLOBAL:
+            return defineInstruction("OP_DEFINE_GLOBAL", chunk, offset);
+        case OP_SET_GLOBAL:
+            return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+        case OP_GET_UPVALUE:
+            return byteInstruction("OP_GET_UPVALUE", chunk, offset);
+        case OP_SET_UPVALUE:
+            return byteInstruction("OP_SET_UPVALUE", chunk, offset);
+        case OP_GET_PROPERTY:
+            return constantInstruction("OP_GET_PROPERTY", chunk, offset);
+        case OP_FRAME_PROPERTY:
+            return constantInstruction("OP_FRAME_PROPERTY", chunk, offset);
+        case OP_SET_PROPERTY:
+            return constantInstruction("OP_SET_PROPERTY", chunk, offset);
+        case OP_GET_SUPER:
+            return constantInstruction("OP_GET_SUPER", chunk, offset);
+        case OP_EQUAL:
+            return simpleInstruction("OP_EQUAL", offset);
+        case OP_NOT_EQUAL:
+            return simpleInstruction("OP_NOT_EQUAL", offset);
+        case OP_GREATER:
+            return simpleInstruction("OP_GREATER", offset);
+        case OP_NOT_GREATER:
+            return simpleInstruction("OP_NOT_GREATER", offset);
+        case OP_LESS:
+            return simpleInstruction("OP_LESS", offset);
+        case OP_NOT_LESS:
+            return simpleInstruction("OP_NOT_LESS", offset);
+        case OP_ADD:
+            return simpleInstruction("OP_ADD", offset);
+        case OP_CONCAT_N:
+            return byteInstruction("OP_CONCAT_N", chunk, offset);
+        case OP_SUBTRACT:
+            return simpleInstruction("OP_SUBTRACT", offset);
+        case OP_MULTIPLY:
+            return simpleInstruction("OP_MULTIPLY", offset);
+        case OP_DIVIDE:
+            return simpleInstruction("OP_DIVIDE", offset);
+        case OP_MODULO:
+            return simpleInstruction("OP_MODULO", offset);
+        case OP_INT_DIVIDE:
+            return simpleInstruction("OP_INT_DIVIDE", offset);
+        case OP_BIT_AND:
+            return simpleInstruction("OP_BIT_AND", offset);
+        case OP_BIT_OR:
+            return simpleInstruction("OP_BIT_OR", offset);
+        case OP_BIT_XOR:
+            return simpleInstruction("OP_BIT_XOR", offset);
+        case OP_SHIFT_LEFT:
+            return simpleInstruction("OP_SHIFT_LEFT", offset);
+        case OP_SHIFT_RIGHT:
+            return simpleInstruction("OP_SHIFT_RIGHT", offset);
+        case OP_NOT:
+            return simpleInstruction("OP_NOT", offset);
+        case OP_GREATER_NUM:
+            return simpleInstruction("OP_GREATER_NUM", offset);
+        case OP_NOT_GREATER_NUM:
+            return simpleInstruction("OP_NOT_GREATER_NUM", offset);
+        case OP_LESS_NUM:
+            return simpleInstruction("OP_LESS_NUM", offset);
+        case OP_NOT_LESS_NUM:
+            return simpleInstruction("OP_NOT_LESS_NUM", offset);
+        case OP_ADD_NUM:
+            return simpleInstruction("OP_ADD_NUM", offset);
+        case OP_SUBTRACT_NUM:
+            return simpleInstruction("OP_SUBTRACT_NUM", offset);
+        case OP_MULTIPLY_NUM:
+            return simpleInstruction("OP_MULTIPLY_NUM", offset);
+        case OP_DIVIDE_NUM:
+            return simpleInstruction("OP_DIVIDE_NUM", offset);
+        case OP_NEGATE:
+            return simpleInstruction("OP_NEGATE", offset);
+        case OP_BIT_NOT:
+            return simpleInstruction("OP_BIT_NOT", offset);
+        case OP_CHECK_TYPE:
+            return typeInstruction("OP_CHECK_TYPE", chunk, offset);
+        case OP_JUMP:
+            return jumpInstruction("OP_JUMP", 1, chunk, offset);
+        case OP_JUMP_IF_FALSE:
+            return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+        case OP_LOOP:
+            return jumpInstruction("OP_LOOP", -1, chunk, offset);
+        case OP_FOR_STEP:
+            return forStepInstruction("OP_FOR_STEP", chunk, offset);
+        case OP_SWITCH:
+            return switchInstruction("OP_SWITCH", chunk, offset);
+        case OP_CALL:
+            return byteInstruction("OP_CALL", chunk, offset);
+        case OP_TAIL_CALL:
+            return byteInstruction("OP_TAIL_CALL", chunk, offset);
+        case OP_INVOKE:
+            return invokeInstruction("OP_INVOKE", chunk, offset);
+        case OP_SUPER_INVOKE:
+            return invokeInstruction("OP_SUPER_INVOKE", chunk, offset);
+        case OP_MATH:
+            return invokeInstruction("OP_MATH", chunk, offset);
+        case OP_CALL_INLINED:
+            return inlinedCallInstruction("OP_CALL_INLINED", chunk, offset);
+        case OP_INVOKE_INLINED:
+            return inlinedCallInstruction("OP_INVOKE_INLINED", chunk, offset);
+        case OP_INLINE_RETURN:
+            return inlineReturnInstruction("OP_INLINE_RETURN", chunk, offset);
+        case OP_MEMO:
+            return memoInstruction("OP_MEMO", chunk, offset);
+        case OP_MEMO_STORE:
+            return memoInstruction("OP_MEMO_STORE", chunk, offset);
+        case OP_CLOSURE:
+        case OP_FRAME_CLOSURE: {
+            offset++;
+            uint8_t constant = chunk->code[offset++];
+            printf("%-16s %4d ", instruction == OP_CLOSURE ? "OP_CLOSURE" : "OP_FRAME_CLOSURE", constant);
+            printValue(chunk->constants.values[constant]);
+            printf("\n");
+
+            ObjFunction* function = AS_FUNCTION(chunk->constants.values[constant]);
+            for (int j = 0; j < function->upvalueCount; j++) {
+                int isLocal = chunk->code[offset++];
+                int index = chunk->code[offset++];
+                printf("%04d      |                     %s %d\n", offset - 2, isLocal ? "local" : "upvalue", index);
+            }
+
+            return offset;
+        }
+        case OP_CLOSE_UPVALUE:
+            return simpleInstruction("OP_CLOSE_UPVALUE", offset);
+        case OP_RELEASE:
+            return simpleInstruction("OP_RELEASE", offset);
+        case OP_RETURN:
+            return simpleInstruction("OP_RETURN", offset);
+        case OP_THROW:
+            return simpleInstruction("OP_THROW", offset);
+        case OP_CLASS:
+            return constantInstruction("OP_CLASS", chunk, offset);
+        case OP_INHERIT:
+            return simpleInstruction("OP_INHERIT", offset);
+        case OP_METHOD:
+            return constantInstruction("OP_METHOD", chunk, offset);
+        default:
+            printf("Unknown opcode %d\n", instruction);
+            return offset + 1;
+    }
+}
+
+static const char* registerOpNames[] = {
+    "MOVE", "GET_GLOBAL", "DEFINE_GLOBAL", "SET_GLOBAL", "GET_UPVALUE", "SET_UPVALUE",
+    "GET_PROPERTY", "FRAME_PROPERTY", "SET_PROPERTY", "EQUAL", "NOT_EQUAL", "GREATER", "NOT_GREATER",
+    "LESS", "NOT_LESS", "ADD", "SUBTRACT", "MULTIPLY", "DIVIDE", "MODULO", "INT_DIVIDE", "BIT_AND", "BIT_OR",
+    "BIT_XOR", "SHIFT_LEFT", "SHIFT_RIGHT", "GREATER_NUM", "NOT_GREATER_NUM",
+    "LESS_NUM", "NOT_LESS_NUM", "ADD_NUM", "SUBTRACT_NUM", "MULTIPLY_NUM", "DIVIDE_NUM", "CONCAT", "NOT",
+    "NEGATE", "BIT_NOT", "CHECK_TYPE", "JUMP", "LOOP", "JUMP_IF_FALSE", "SWITCH", "FOR_STEP", "MEMO", "MEMO_STORE", "CALL", "INVOKE", "MATH", "CALL_INLINED", "INVOKE_INLINED", "RELEASE", "TAIL_CALL", "RETURN", "THROW"
+};
+
+// Registers print as r<n>, constant pool reads as k<n>
+void disassembleRegisters(ObjFunction* function, const char* name) {
+    RegisterCode* registers = function->registers;
+    printf("== %s (%d registers) ==\n", name, registers->frameSize);
+
+    for (int i = 0; i < registers->count; i++) {
+        uint32_t instruction = registers->code[i];
+        int op = REG_OP(instruction);
+        printf("%04d ", i);
+        int line = getLine(&registers->lines, i);
+        if (i > 0 && line == getLine(&registers->lines, i - 1)) {
+            printf("   | ");
+        } else {
+            printf("%4d ", line);
+        }
+        printf("%-16s", registerOpNames[op]);
+
+        char b = instruction & REG_CONSTANT_B ? 'k' : 'r';
+        char c = instruction & REG_CONSTANT_C ? 'k' : 'r';
+        switch (op) {
+            case REG_JUMP:
+            case REG_LOOP:
+                printf(" -> %d\n", i + 1 + REG_SBX(instruction));
+                break;
+            case REG_JUMP_IF_FALSE:
+            case REG_MEMO:
+                printf(" r%d -> %d\n", REG_A(instruction), i + 1 + REG_SBX(instruction));
+                break;
+            case REG_SWITCH:
+                printf(" r%d table %d\n", REG_A(instruction), REG_B(instruction));
+                break;
+            case REG_CHECK_TYPE:
+                printf(" %c%d %s\n", b, REG_B(instruction), valueTypeName((ValueType)REG_A(instruction)));
+                break;
+            case REG_MEMO_STORE:
+                printf(" r%d %c%d%s\n", REG_A(instruction), b, REG_B(instruction), REG_C(instruction) ? " pure" : "");
+                break;
+            case REG_MOVE:
+            case REG_NOT:
+            case REG_NEGATE:
+            case REG_BIT_NOT:
+                printf(" r%d %c%d\n", REG_A(instruction), b, REG_B(instruction));
+                break;
+            case REG_GET_GLOBAL:
+                printf(" r%d k%d\n", REG_A(instruction), REG_B(instruction));
+                break;
+            case REG_GET_UPVALUE:
+                printf(" r%d u%d\n", REG_A(instruction), REG_B(instruction));
+                break;
+            case REG_DEFINE_GLOBAL:
+                printf(" k%d %c%d %s\n", REG_C(instruction), b, REG_B(instruction), valueTypeName((ValueType)REG_A(instruction)));
+                break;
+            case REG_SET_GLOBAL:
+                printf(" k%d %c%d\n", REG_C(instruction), b, REG_B(instruction));
+                break;
+            case REG_SET_UPVALUE:
+                printf(" u%d %c%d\n", REG_C(instruction), b, REG_B(instruction));
+                break;
+            case REG_SET_PROPERTY:
+                printf(" r%d.k%d %c%d\n", REG_A(instruction), REG_C(instruction), b, REG_B(instruction));
+                break;
+            case REG_CALL:
+            case REG_TAIL_CALL:
+                printf(" r%d (%d args)\n", REG_A(instruction), REG_B(instruction));
+                break;
+            case REG_MATH:
+                printf(" r%d k%d (%d args)\n", REG_A(instruction), REG_C(instruction), REG_B(instruction));
+                break;
+            case REG_INVOKE:
+                printf(" r%d.k%d (%d args)\n", REG_A(instruction), REG_C(instruction), REG_B(instruction));
+                break;
+            case REG_CALL_INLINED:
+                printf(" r%d (%d args) if k%d\n", REG_A(instruction), REG_B(instruction), REG_C(instruction));
+                break;
+            case REG_INVOKE_INLINED:
+                // The expected function rides in the word that follows
+                printf(" r%d.k%d (%d args) if k%d\n", REG_A(instruction), REG_C(instruction), REG_B(instruction),
+                    REG_A(registers->code[++i]));
+                break;
+            case REG_FOR_STEP: {
+                // The arithmetic, the comparison and the jump ride in the word that follows
+                uint32_t jump = registers->code[++i];
+                printf(" r%d %c= %c%d, %s %c%d -> %d\n", REG_A(instruction), REG_OP(jump) == REG_ADD ? '+' : '-',
+                    c, REG_C(instruction), comparisonSymbol(REG_A(jump)), b, REG_B(instruction), i + 1 + REG_SBX(jump));
+                break;
+            }
+            case REG_CONCAT:
+                printf(" r%d r%d..r%d\n", REG_A(instruction), REG_B(instruction),
+                    REG_B(instruction) + REG_C(instruction) - 1);
+                break;
+            case REG_RELEASE:
+            case REG_RETURN:
+            case REG_THROW:
+                printf(" %c%d\n", b, REG_B(instruction));
+                break;
+            default:
+                printf(" r%d %c%d %c%d\n", REG_A(instruction), b, REG_B(instruction), c, REG_C(instruction));
+                break;
+        }
+    }
+}
@@ -0,0 +1,12 @@
+#ifndef npp_debug_h
+#define npp_debug_h
+
+#include "chunk.h"
+#include "object.h"
+
+void disassembleChunk(Chunk* chunk, const char* name);
+int disassembleInstruction(Chunk* chunk, int offset);
+int countInstructions(Chunk* chunk);
+void disassembleRegisters(ObjFunction* function, const char* name);
+
+#endif
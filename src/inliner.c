@@ -0,0 +1,398 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "inliner.h"
+#include "memory.h"
+
+// * Inlining (-O): small functions and methods are copied into their callers.
+// * The call site still pushes the callee and its arguments, but the call itself
+// * becomes a guard. If the callee really is the function that was copied, the
+// * copy runs right there in the caller's frame with its slots moved up to where
+// * the callee's frame would have started. Otherwise the guard makes the normal
+// * call and jumps over the copy. Which function a name refers to is only a
+// * guess taken from the definitions in the unit, the guard is what makes it safe.
+
+#define INLINE_MAX_SIZE 48     // bytes of callee code
+#define INLINE_MAX_GROWTH 1024 // bytes added to any one caller
+
+typedef struct {
+    ObjString* name;
+    ObjFunction* function; // NULL once the name stands for more than one function
+} Definition;
+
+typedef struct {
+    int count;
+    int capacity;
+    Definition* entries;
+} Definitions;
+
+typedef struct {
+    int offset;
+    int base;
+    int expected;
+    ObjFunction* callee;
+} Site;
+
+typedef struct {
+    ObjFunction** functions;
+    int functionCount;
+    int functionCapacity;
+    Definitions globals;
+    Definitions methods;
+} Inliner;
+
+static void collectFunctions(Inliner* inliner, ObjFunction* function) {
+    if (inliner->functionCapacity < inliner->functionCount + 1) {
+        int oldCapacity = inliner->functionCapacity;
+        inliner->functionCapacity = GROW_CAPACITY(oldCapacity);
+        inliner->functions = GROW_ARRAY(ObjFunction*, inliner->functions, oldCapacity, inliner->functionCapacity);
+    }
+    inliner->functions[inliner->functionCount++] = function;
+
+    ValueArray* constants = &function->chunk.constants;
+    for (int i = 0; i < constants->count; i++) {
+        if (IS_FUNCTION(constants->values[i])) collectFunctions(inliner, AS_FUNCTION(constants->values[i]));
+    }
+}
+
+static void define(Definitions* definitions, ObjString* name, ObjFunction* function) {
+    for (int i = 0; i < definitions->count; i++) {
+        Definition* definition = &definitions->entries[i];
+        if (definition->name != name) continue;
+        if (definition->function != function) definition->function = NULL;
+        return;
+    }
+
+    if (definitions->capacity < definitions->count + 1) {
+        int oldCapacity = definitions->capacity;
+        definitions->capacity = GROW_CAPACITY(oldCapacity);
+        definitions->entries = GROW_ARRAY(Definition, definitions->entries, oldCapacity, definitions->capacity);
+    }
+    definitions->entries[definitions->count].name = name;
+    definitions->entries[definitions->count].function = function;
+    definitions->count++;
+}
+
+static ObjFunction* lookup(Definitions* definitions, ObjString* name) {
+    for (int i = 0; i < definitions->count; i++) {
+        if (definitions->entries[i].name == name) return definitions->entries[i].function;
+    }
+    return NULL;
+}
+
+// `def f` at the top level compiles to CLOSURE then DEFINE_GLOBAL, a method to CLOSURE then METHOD
+static void collectDefinitions(Inliner* inliner, Chunk* chunk) {
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        if (chunk->code[offset] != OP_CLOSURE) continue;
+
+        int next = offset + instructionLength(chunk, offset);
+        if (next >= chunk->count) continue;
+
+        uint8_t instruction = chunk->code[next];
+        if (instruction != OP_DEFINE_GLOBAL && instruction != OP_METHOD) continue;
+
+        ObjFunction* function = AS_FUNCTION(chunk->constants.values[chunk->code[offset + 1]]);
+        ObjString* name = AS_STRING(chunk->constants.values[chunk->code[next + 1]]);
+        define(instruction == OP_METHOD ? &inliner->methods : &inliner->globals, name, function);
+    }
+}
+
+// The instructions an inlined copy may contain, anything touching upvalues or classes needs a frame of its own
+static bool isInlinable(uint8_t instruction) {
+    switch (instruction) {
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_GET_SUPER:
+        case OP_SUPER_INVOKE:
+        case OP_CALL_INLINED:
+        case OP_INVOKE_INLINED:
+        case OP_INLINE_RETURN:
+        case OP_SWITCH:
+        case OP_CLOSURE:
+        case OP_FRAME_CLOSURE:
+        case OP_CLOSE_UPVALUE:
+        case OP_CLASS:
+        case OP_INHERIT:
+        case OP_METHOD:
+            return false;
+        default:
+            return true;
+    }
+}
+
+// How many new constants inlining callee adds to caller's pool: the ones the copy
+// reads that the caller doesn't have yet, and the callee itself for the guard
+static int missingConstants(ObjFunction* caller, ObjFunction* callee) {
+    Chunk* body = &callee->chunk;
+    bool isCounted[UINT8_COUNT];
+    memset(isCounted, 0, sizeof(isCounted));
+    int missing = findConstant(&caller->chunk, OBJ_VAL(callee)) == -1 ? 1 : 0;
+
+    for (int offset = 0; offset < body->count; offset += instructionLength(body, offset)) {
+        for (int i = 1; i < instructionLength(body, offset); i++) {
+            if (!isConstantOperand(body->code, offset, i)) continue;
+
+            uint8_t constant = body->code[offset + i];
+            if (!isCounted[constant] && findConstant(&caller->chunk, body->constants.values[constant]) == -1) {
+                missing++;
+            }
+            isCounted[constant] = true;
+        }
+    }
+    return missing;
+}
+
+// Whether callee can be copied into caller with its frame starting at slot base.
+// Only looks, the caller's pool is left as it was.
+static bool canInline(ObjFunction* caller, ObjFunction* callee, int argCount, int base) {
+    if (callee == NULL || callee == caller) return false;
+    if (callee->source != NULL) return false; // only pre-parsed under -l, there is no body yet
+    if (callee->upvalueCount > 0 || callee->arity != argCount) return false;
+
+    Chunk* body = &callee->chunk;
+    if (body->count > INLINE_MAX_SIZE || body->handlerCount > 0) return false;
+
+    for (int offset = 0; offset < body->count; offset += instructionLength(body, offset)) {
+        if (!isInlinable(body->code[offset])) return false;
+    }
+
+    // Every constant the copy reads has to fit the caller's pool too
+    if (caller->chunk.constants.count + missingConstants(caller, callee) > UINT8_COUNT) return false;
+
+    int* depths = ALLOCATE(int, body->count + 1);
+    int maxDepth;
+    bool fits = computeStackDepths(body, callee->arity + 1, depths, &maxDepth) && base + maxDepth <= UINT8_COUNT;
+    FREE_ARRAY(int, depths, body->count + 1);
+    return fits;
+}
+
+static int findSites(Inliner* inliner, ObjFunction* caller, int* depths, Site* sites) {
+    Chunk* chunk = &caller->chunk;
+    ObjFunction* closures[UINT8_COUNT];
+    bool isShared[UINT8_COUNT];
+    int producers[UINT8_COUNT];
+    memset(closures, 0, sizeof(closures));
+    memset(isShared, 0, sizeof(isShared));
+    for (int slot = 0; slot < UINT8_COUNT; slot++) {
+        producers[slot] = -1;
+    }
+
+    // Local `def`s: which closure each slot holds, unless different ones take turns
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        bool isClosure = chunk->code[offset] == OP_CLOSURE || chunk->code[offset] == OP_FRAME_CLOSURE;
+        if (!isClosure || depths[offset] == -1 || depths[offset] >= UINT8_COUNT) continue;
+
+        int next = offset + instructionLength(chunk, offset);
+        if (next < chunk->count && (chunk->code[next] == OP_DEFINE_GLOBAL || chunk->code[next] == OP_METHOD)) continue;
+
+        int slot = depths[offset];
+        ObjFunction* function = AS_FUNCTION(chunk->constants.values[chunk->code[offset + 1]]);
+        if (closures[slot] != NULL && closures[slot] != function) isShared[slot] = true;
+        closures[slot] = function;
+    }
+
+    int siteCount = 0;
+    int growth = 0;
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        int depth = depths[offset];
+        if (depth == -1) continue;
+
+        uint8_t instruction = chunk->code[offset];
+        ObjFunction* callee = NULL;
+        int argCount = 0;
+
+        if (instruction == OP_CALL || instruction == OP_TAIL_CALL) {
+            argCount = chunk->code[offset + 1];
+            int producer = depth - argCount - 1 < UINT8_COUNT ? producers[depth - argCount - 1] : -1;
+            if (producer == -1) {
+                // An argument or a slot filled on another path, nothing to go on
+            } else if (chunk->code[producer] == OP_GET_GLOBAL) {
+                callee = lookup(&inliner->globals, AS_STRING(chunk->constants.values[chunk->code[producer + 1]]));
+            } else if (chunk->code[producer] == OP_GET_LOCAL && !isShared[chunk->code[producer + 1]]) {
+                callee = closures[chunk->code[producer + 1]];
+            }
+        } else if (instruction == OP_INVOKE) {
+            argCount = chunk->code[offset + 2];
+            callee = lookup(&inliner->methods, AS_STRING(chunk->constants.values[chunk->code[offset + 1]]));
+        }
+
+        int base = depth - argCount - 1;
+        if (callee != NULL && growth + callee->chunk.count <= INLINE_MAX_GROWTH &&
+            canInline(caller, callee, argCount, base)) {
+            // The copy's constants go in now, so the next site sees how full the pool is
+            Chunk* body = &callee->chunk;
+            for (int at = 0; at < body->count; at += instructionLength(body, at)) {
+                for (int i = 1; i < instructionLength(body, at); i++) {
+                    if (isConstantOperand(body->code, at, i)) addConstant(chunk, body->constants.values[body->code[at + i]]);
+                }
+            }
+
+            Site* site = &sites[siteCount++];
+            site->offset = offset;
+            site->base = base;
+            site->expected = addConstant(chunk, OBJ_VAL(callee));
+            site->callee = callee;
+            growth += callee->chunk.count;
+        }
+
+        // Remember which instruction left the value in each slot, a call looks its callee up there
+        int pops, pushes;
+        stackEffect(chunk, offset, &pops, &pushes);
+        int top = depth - pops + pushes - 1;
+        if (pushes > 0 && top < UINT8_COUNT) producers[top] = offset;
+    }
+    return siteCount;
+}
+
+// Appends a copy of callee to out, its slots moved up to base and its returns turned into jumps past the end.
+// The copy's own tail calls only stay tail calls when the call it replaces was one.
+static void copyBody(Chunk* out, Chunk* caller, Chunk* body, int base, bool isTail) {
+    int* newOffsets = ALLOCATE(int, body->count + 1);
+    int* jumpOrigins = ALLOCATE(int, body->count);
+    int jumpCount = 0;
+
+    for (int offset = 0; offset < body->count; offset += instructionLength(body, offset)) {
+        uint8_t instruction = body->code[offset];
+        int length = instructionLength(body, offset);
+        newOffsets[offset] = out->count;
+        if (isJumpInstruction(instruction) || instruction == OP_RETURN) jumpOrigins[jumpCount++] = offset;
+
+        int line = getLine(&body->lines, offset);
+        if (instruction == OP_RETURN) {
+            writeChunk(out, OP_INLINE_RETURN, line);
+            writeChunk(out, (uint8_t)base, line);
+            writeChunk(out, 0, line);
+            writeChunk(out, 0, line);
+            continue;
+        }
+
+        writeChunk(out, instruction == OP_TAIL_CALL && !isTail ? OP_CALL : instruction, line);
+        for (int i = 1; i < length; i++) {
+            uint8_t operand = body->code[offset + i];
+            if (isLocalOperand(body->code, offset, i)) operand += base;
+            if (isConstantOperand(body->code, offset, i)) {
+                operand = (uint8_t)addConstant(caller, body->constants.values[operand]);
+            }
+            writeChunk(out, operand, line);
+        }
+    }
+    newOffsets[body->count] = out->count;
+
+    for (int i = 0; i < jumpCount; i++) {
+        int origin = jumpOrigins[i];
+        int target = body->code[origin] == OP_RETURN ? body->count : jumpTarget(body, origin);
+        setJumpTarget(out->code, newOffsets[origin], newOffsets[target]);
+    }
+
+    FREE_ARRAY(int, newOffsets, body->count + 1);
+    FREE_ARRAY(int, jumpOrigins, body->count);
+}
+
+static void inlineInto(Inliner* inliner, ObjFunction* caller) {
+    Chunk* chunk = &caller->chunk;
+    int count = chunk->count;
+    int* depths = ALLOCATE(int, count + 1);
+    Site* sites = ALLOCATE(Site, count);
+    int maxDepth;
+    int siteCount = 0;
+    if (computeStackDepths(chunk, caller->arity + 1, depths, &maxDepth)) {
+        siteCount = findSites(inliner, caller, depths, sites);
+    }
+
+    if (siteCount > 0) {
+        Chunk out;
+        initChunk(&out);
+        int* newOffsets = ALLOCATE(int, count + 1);
+        int* jumpOrigins = ALLOCATE(int, count);
+        int jumpCount = 0;
+        int site = 0;
+
+        for (int offset = 0; offset < count; offset += instructionLength(chunk, offset)) {
+            uint8_t instruction = chunk->code[offset];
+            int line = getLine(&chunk->lines, offset);
+            newOffsets[offset] = out.count;
+
+            if (site < siteCount && sites[site].offset == offset) {
+                Site* current = &sites[site++];
+                int guard = out.count;
+                if (instruction != OP_INVOKE) {
+                    writeChunk(&out, OP_CALL_INLINED, line);
+                    writeChunk(&out, chunk->code[offset + 1], line);
+                } else {
+                    writeChunk(&out, OP_INVOKE_INLINED, line);
+                    writeChunk(&out, chunk->code[offset + 1], line);
+                    writeChunk(&out, chunk->code[offset + 2], line);
+                }
+                writeChunk(&out, (uint8_t)current->expected, line);
+                writeChunk(&out, 0, line);
+                writeChunk(&out, 0, line);
+
+                int start = out.count;
+                copyBody(&out, chunk, &current->callee->chunk, current->base, instruction == OP_TAIL_CALL);
+                addInlinedCall(&out, start, out.count, line, current->callee->name);
+                setJumpTarget(out.code, guard, out.count);
+                continue;
+            }
+
+            if (isJumpInstruction(instruction)) jumpOrigins[jumpCount++] = offset;
+            for (int i = 0; i < instructionLength(chunk, offset); i++) {
+                writeChunk(&out, chunk->code[offset + i], line);
+            }
+        }
+        newOffsets[count] = out.count;
+
+        for (int i = 0; i < jumpCount; i++) {
+            int origin = jumpOrigins[i];
+            setJumpTarget(out.code, newOffsets[origin], newOffsets[jumpTarget(chunk, origin)]);
+        }
+
+        // Too long for 16 bit jumps, keep the original
+        if (out.count > UINT16_MAX) {
+            freeChunk(&out);
+        } else {
+            FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+            freeLineTable(&chunk->lines);
+            FREE_ARRAY(InlinedCall, chunk->inlinedCalls, chunk->inlinedCapacity);
+            chunk->code = out.code;
+            chunk->lines = out.lines;
+            chunk->count = out.count;
+            chunk->capacity = out.capacity;
+            chunk->inlinedCalls = out.inlinedCalls;
+            chunk->inlinedCount = out.inlinedCount;
+            chunk->inlinedCapacity = out.inlinedCapacity;
+            freeValueArray(&out.constants);
+
+            // A try around a call now covers its inlined copy too
+            for (int i = 0; i < chunk->handlerCount; i++) {
+                ExceptionHandler* handler = &chunk->handlers[i];
+                handler->start = newOffsets[handler->start];
+                handler->end = newOffsets[handler->end];
+                handler->handler = newOffsets[handler->handler];
+            }
+        }
+
+        FREE_ARRAY(int, newOffsets, count + 1);
+        FREE_ARRAY(int, jumpOrigins, count);
+    }
+
+    FREE_ARRAY(int, depths, count + 1);
+    FREE_ARRAY(Site, sites, count);
+}
+
+void inlineCalls(ObjFunction* script) {
+    Inliner inliner;
+    memset(&inliner, 0, sizeof(Inliner));
+
+    collectFunctions(&inliner, script);
+    for (int i = 0; i < inliner.functionCount; i++) {
+        collectDefinitions(&inliner, &inliner.functions[i]->chunk);
+    }
+
+    for (int i = 0; i < inliner.functionCount; i++) {
+        inlineInto(&inliner, inliner.functions[i]);
+    }
+
+    FREE_ARRAY(ObjFunction*, inliner.functions, inliner.functionCapacity);
+    FREE_ARRAY(Definition, inliner.globals.entries, inliner.globals.capacity);
+    FREE_ARRAY(Definition, inliner.methods.entries, inliner.methods.capacity);
+}
@@ -0,0 +1,8 @@
+#ifndef npp_inliner_h
+#define npp_inliner_h
+
+#include "object.h"
+
+void inlineCalls(ObjFunction* script);
+
+#endif
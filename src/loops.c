@@ -0,0 +1,434 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "loops.h"
+#include "memory.h"
+
+// * Loop invariant code motion (-O).
+// * An expression inside a loop that only reads constants, locals the loop never
+// * assigns, globals and fields is worked out once and remembered for the rest
+// * of the loop. Such an expression becomes
+// *
+// *     MEMO k -> L; <expression>; MEMO_STORE k; L: GET_LOCAL k
+// *
+// * where slot k keeps the value and slot k + 1 a stamp saying it is still good.
+// * The first iteration computes it where it always did (so errors happen where
+// * they used to), the rest jump straight to the GET_LOCAL. Every loop clears
+// * the stamps of its memos on the way in, and a memo that read a global or a
+// * field is stamped with the VM's epoch, which a store to any global or field
+// * of a name some memo reads moves on. That is the guard that keeps a memo from
+// * outliving what it read, whatever function did the store. Names the loop
+// * itself stores to are left alone, those memos would never survive an iteration.
+// * The memo slots are reserved at the bottom of the frame, right after the
+// * parameters, and every other local moves up to make room.
+
+#define MAX_SIMULATED_STACK 512
+#define MIN_MEMO_COST 2
+
+typedef struct {
+    int header; // first instruction of the loop, where every LOOP back to it lands
+    int end;
+    int firstMemo;
+    int memoCount;
+} Loop;
+
+typedef struct {
+    int start;
+    int end;
+    bool isPure;  // only constants and locals, nothing a store elsewhere could change
+} Memo;
+
+typedef struct {
+    int start;
+    int end;
+    int cost;
+    bool isPure;
+} Pending;
+
+typedef struct {
+    Chunk* chunk;
+    int* depths;
+    bool* isTarget;
+    bool* isClaimed;
+    Loop* loops;
+    int loopCount;
+    Memo* memos;
+    int memoCount;
+    int memoCapacity;
+} Hoister;
+
+static bool isBinary(uint8_t instruction) {
+    switch (instruction) {
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+        case OP_GREATER:
+        case OP_NOT_GREATER:
+        case OP_LESS:
+        case OP_NOT_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_GREATER_NUM:
+        case OP_NOT_GREATER_NUM:
+        case OP_LESS_NUM:
+        case OP_NOT_LESS_NUM:
+        case OP_ADD_NUM:
+        case OP_SUBTRACT_NUM:
+        case OP_MULTIPLY_NUM:
+        case OP_DIVIDE_NUM:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Every backward jump closes a loop from its target up to itself. A for loop's two LOOPs
+// overlap without nesting (condition -> increment, body -> increment), those are one loop.
+static void findLoops(Hoister* h) {
+    Chunk* chunk = h->chunk;
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        if (!isBackwardJump(chunk->code[offset]) || h->depths[offset] == -1) continue;
+
+        Loop* loop = &h->loops[h->loopCount++];
+        loop->header = jumpTarget(chunk, offset);
+        loop->end = offset + instructionLength(chunk, offset);
+        loop->firstMemo = 0;
+        loop->memoCount = 0;
+    }
+
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (int i = 0; i < h->loopCount && !merged; i++) {
+            for (int j = 0; j < h->loopCount && !merged; j++) {
+                Loop* a = &h->loops[i];
+                Loop* b = &h->loops[j];
+                if (i == j || a->header > b->header) continue;
+
+                bool overlaps = b->header < a->end && a->end < b->end;
+                if (a->header == b->header || overlaps) {
+                    if (b->end > a->end) a->end = b->end;
+                    *b = h->loops[--h->loopCount];
+                    merged = true;
+                }
+            }
+        }
+    }
+
+    // Outer loops first, they get the first pick of the invariant code inside them
+    for (int i = 1; i < h->loopCount; i++) {
+        Loop loop = h->loops[i];
+        int j = i;
+        for (; j > 0 && h->loops[j - 1].end - h->loops[j - 1].header < loop.end - loop.header; j--) {
+            h->loops[j] = h->loops[j - 1];
+        }
+        h->loops[j] = loop;
+    }
+}
+
+// A loop can only get a preheader when nothing jumps into its middle from outside
+static bool hasSingleEntry(Hoister* h, Loop* loop) {
+    Chunk* chunk = h->chunk;
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        if (!isJumpInstruction(chunk->code[offset])) continue;
+
+        int target = jumpTarget(chunk, offset);
+        bool isInside = offset >= loop->header && offset < loop->end;
+        if (!isInside && target > loop->header && target < loop->end) return false;
+    }
+    return true;
+}
+
+static void addMemo(Hoister* h, int start, int end, bool isPure) {
+    for (int offset = start; offset < end; offset++) {
+        if (h->isClaimed[offset]) return;
+    }
+    for (int offset = start; offset < end; offset++) {
+        h->isClaimed[offset] = true;
+    }
+
+    if (h->memoCapacity < h->memoCount + 1) {
+        int oldCapacity = h->memoCapacity;
+        h->memoCapacity = GROW_CAPACITY(oldCapacity);
+        h->memos = GROW_ARRAY(Memo, h->memos, oldCapacity, h->memoCapacity);
+    }
+    Memo* memo = &h->memos[h->memoCount++];
+    memo->start = start;
+    memo->end = end;
+    memo->isPure = isPure;
+}
+
+// An invariant value is consumed by something that isn't, so it is as big as it gets
+static void consume(Hoister* h, Pending* pending) {
+    if (pending->start != -1 && pending->cost >= MIN_MEMO_COST) {
+        addMemo(h, pending->start, pending->end, pending->isPure);
+    }
+    pending->start = -1;
+}
+
+// A global or field the loop stores to itself would throw the memo away every time around
+static bool isStoredIn(Hoister* h, Loop* loop, uint8_t store, int nameConstant) {
+    Chunk* chunk = h->chunk;
+    Value name = chunk->constants.values[nameConstant];
+    for (int offset = loop->header; offset < loop->end; offset += instructionLength(chunk, offset)) {
+        if (chunk->code[offset] == store && chunk->constants.values[chunk->code[offset + 1]] == name) return true;
+    }
+    return false;
+}
+
+// Walks the loop tracking which stack values are invariant and where their code starts
+static void findInvariants(Hoister* h, Loop* loop) {
+    Chunk* chunk = h->chunk;
+    uint8_t* code = chunk->code;
+    bool isAssigned[UINT8_COUNT];
+    Pending stack[MAX_SIMULATED_STACK];
+    memset(isAssigned, 0, sizeof(isAssigned));
+
+    for (int offset = loop->header; offset < loop->end; offset += instructionLength(chunk, offset)) {
+        uint8_t instruction = code[offset];
+        bool isStore = instruction == OP_SET_LOCAL || instruction == OP_SET_LOCAL_POP || instruction == OP_FOR_STEP;
+        if (isStore) isAssigned[code[offset + 1]] = true;
+    }
+    int outside = h->depths[loop->header];
+    loop->firstMemo = h->memoCount;
+
+    for (int depth = 0; depth < MAX_SIMULATED_STACK; depth++) {
+        stack[depth].start = -1;
+    }
+
+    for (int offset = loop->header; offset < loop->end; offset += instructionLength(chunk, offset)) {
+        int depth = h->depths[offset];
+        if (depth == -1) continue;
+        if (depth + 1 >= MAX_SIMULATED_STACK) break;
+
+        // Values reaching a join may come from either side, nothing carries over
+        if (h->isTarget[offset]) {
+            for (int i = 0; i < depth; i++) {
+                stack[i].start = -1;
+            }
+        }
+
+        uint8_t instruction = code[offset];
+        int next = offset + instructionLength(chunk, offset);
+        Pending* top = depth > 0 ? &stack[depth - 1] : NULL;
+        Pending* pushed = &stack[depth];
+        pushed->end = next;
+        switch (instruction) {
+            case OP_CONSTANT:
+            case OP_NULL:
+            case OP_TRUE:
+            case OP_FALSE:
+                pushed->start = offset;
+                pushed->cost = 0;
+                pushed->isPure = true;
+                break;
+            case OP_GET_LOCAL: {
+                int slot = code[offset + 1];
+                bool isInvariant = slot < outside && !isAssigned[slot];
+                pushed->start = isInvariant ? offset : -1;
+                pushed->cost = 0;
+                pushed->isPure = true;
+                break;
+            }
+            case OP_GET_GLOBAL:
+                pushed->start = isStoredIn(h, loop, OP_SET_GLOBAL, code[offset + 1]) ? -1 : offset;
+                pushed->cost = 2;
+                pushed->isPure = false;
+                break;
+            case OP_GET_PROPERTY:
+                if (isStoredIn(h, loop, OP_SET_PROPERTY, code[offset + 1])) top->start = -1;
+                top->end = next;
+                top->cost += 2;
+                top->isPure = false;
+                break;
+            case OP_NOT:
+            case OP_NEGATE:
+            case OP_CHECK_TYPE:
+                top->end = next;
+                top->cost++;
+                break;
+            default: {
+                if (isBinary(instruction)) {
+                    Pending* left = &stack[depth - 2];
+                    if (left->start != -1 && top->start != -1) {
+                        left->end = next;
+                        left->cost += top->cost + 1;
+                        left->isPure = left->isPure && top->isPure;
+                        break;
+                    }
+                }
+
+                // JUMP_IF_FALSE only peeks at the condition, but it is the end of that expression all the same
+                int pops, pushes;
+                stackEffect(chunk, offset, &pops, &pushes);
+                if (instruction == OP_JUMP_IF_FALSE) pops = 1;
+                for (int i = depth - pops; i < depth; i++) {
+                    consume(h, &stack[i]);
+                }
+                for (int i = depth - pops; i < depth - pops + pushes; i++) {
+                    stack[i].start = -1;
+                }
+                break;
+            }
+        }
+    }
+
+    loop->memoCount = h->memoCount - loop->firstMemo;
+}
+
+static void writeMemoSlot(Chunk* out, uint8_t instruction, int slot, int line) {
+    writeChunk(out, instruction, line);
+    writeChunk(out, (uint8_t)slot, line);
+}
+
+// Rebuilds the chunk with the memo slots pushed on entry, a preheader in front of
+// every loop with memos and each memoized expression wrapped up
+static bool rewrite(Hoister* h, ObjFunction* function) {
+    Chunk* chunk = h->chunk;
+    int count = chunk->count;
+    int firstMemoSlot = function->arity + 1;
+    int shift = h->memoCount * 2;
+
+    Chunk out;
+    initChunk(&out);
+    int* newOffsets = ALLOCATE(int, count + 1);
+    int* headerOffsets = ALLOCATE(int, count + 1);
+    int* jumpOrigins = ALLOCATE(int, count);
+    int* jumpsAt = ALLOCATE(int, count);
+    int jumpCount = 0;
+
+    for (int i = 0; i < shift; i++) {
+        writeChunk(&out, OP_NULL, getLine(&chunk->lines, 0));
+    }
+
+    // Memos come out in order of the code, which is not the order they were found in
+    int* memoAt = ALLOCATE(int, count + 1);
+    for (int offset = 0; offset <= count; offset++) {
+        memoAt[offset] = -1;
+    }
+    for (int i = 0; i < h->memoCount; i++) {
+        memoAt[h->memos[i].start] = i;
+    }
+
+    for (int offset = 0; offset < count;) {
+        int line = getLine(&chunk->lines, offset);
+        newOffsets[offset] = out.count;
+
+        for (int i = 0; i < h->loopCount; i++) {
+            Loop* loop = &h->loops[i];
+            if (loop->header != offset) continue;
+
+            for (int m = loop->firstMemo; m < loop->firstMemo + loop->memoCount; m++) {
+                writeChunk(&out, OP_NULL, line);
+                writeMemoSlot(&out, OP_SET_LOCAL_POP, firstMemoSlot + m * 2 + 1, line);
+            }
+        }
+        headerOffsets[offset] = out.count;
+
+        Memo* memo = memoAt[offset] != -1 ? &h->memos[memoAt[offset]] : NULL;
+        int memoStart = out.count;
+        int slot = memo != NULL ? firstMemoSlot + memoAt[offset] * 2 : 0;
+        if (memo != NULL) {
+            writeMemoSlot(&out, OP_MEMO, slot, line);
+            writeChunk(&out, 0, line);
+            writeChunk(&out, 0, line);
+        }
+
+        int end = memo != NULL ? memo->end : offset + instructionLength(chunk, offset);
+        while (offset < end) {
+            uint8_t instruction = chunk->code[offset];
+            int length = instructionLength(chunk, offset);
+            if (isJumpInstruction(instruction)) {
+                jumpOrigins[jumpCount] = offset;
+                jumpsAt[jumpCount++] = out.count;
+            }
+
+            if (memo != NULL && (instruction == OP_GET_GLOBAL || instruction == OP_GET_PROPERTY)) {
+                AS_STRING(chunk->constants.values[chunk->code[offset + 1]])->isWatched = true;
+            }
+
+            int instructionLine = getLine(&chunk->lines, offset);
+            writeChunk(&out, instruction, instructionLine);
+            for (int i = 1; i < length; i++) {
+                uint8_t operand = chunk->code[offset + i];
+                if (isLocalOperand(chunk->code, offset, i) && operand >= firstMemoSlot) operand += shift;
+                writeChunk(&out, operand, instructionLine);
+            }
+            offset += length;
+        }
+
+        if (memo != NULL) {
+            int last = getLine(&chunk->lines, end - 1);
+            writeMemoSlot(&out, OP_MEMO_STORE, slot, last);
+            writeChunk(&out, memo->isPure, last);
+            setJumpTarget(out.code, memoStart, out.count);
+            writeMemoSlot(&out, OP_GET_LOCAL, slot, last);
+        }
+    }
+    newOffsets[count] = out.count;
+
+    // A jump back to a header skips the preheader, anything else entering the loop runs it
+    for (int i = 0; i < jumpCount; i++) {
+        int origin = jumpOrigins[i];
+        int target = jumpTarget(chunk, origin);
+        setJumpTarget(out.code, jumpsAt[i], isBackwardJump(chunk->code[origin]) ? headerOffsets[target] : newOffsets[target]);
+    }
+
+    FREE_ARRAY(int, newOffsets, count + 1);
+    FREE_ARRAY(int, headerOffsets, count + 1);
+    FREE_ARRAY(int, jumpOrigins, count);
+    FREE_ARRAY(int, jumpsAt, count);
+    FREE_ARRAY(int, memoAt, count + 1);
+
+    if (out.count > UINT16_MAX) {
+        freeChunk(&out);
+        return false;
+    }
+
+    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+    freeLineTable(&chunk->lines);
+    chunk->code = out.code;
+    chunk->lines = out.lines;
+    chunk->count = out.count;
+    chunk->capacity = out.capacity;
+    freeValueArray(&out.constants);
+    return true;
+}
+
+void hoistInvariants(ObjFunction* function) {
+    Chunk* chunk = &function->chunk;
+    int count = chunk->count;
+    if (count == 0 || capturesLocals(chunk) || chunk->handlerCount > 0) return;
+
+    Hoister h;
+    memset(&h, 0, sizeof(Hoister));
+    h.chunk = chunk;
+    h.depths = ALLOCATE(int, count + 1);
+    h.isTarget = ALLOCATE(bool, count + 1);
+    h.isClaimed = ALLOCATE(bool, count + 1);
+    h.loops = ALLOCATE(Loop, count);
+    memset(h.isTarget, 0, sizeof(bool) * (count + 1));
+    memset(h.isClaimed, 0, sizeof(bool) * (count + 1));
+
+    int maxDepth;
+    if (computeStackDepths(chunk, function->arity + 1, h.depths, &maxDepth)) {
+        for (int offset = 0; offset < count; offset += instructionLength(chunk, offset)) {
+            if (isJumpInstruction(chunk->code[offset])) h.isTarget[jumpTarget(chunk, offset)] = true;
+        }
+
+        findLoops(&h);
+        for (int i = 0; i < h.loopCount; i++) {
+            if (hasSingleEntry(&h, &h.loops[i])) findInvariants(&h, &h.loops[i]);
+        }
+
+        // Every memo takes two slots under everything else in the frame
+        if (h.memoCount > 0 && maxDepth + h.memoCount * 2 <= UINT8_COUNT) rewrite(&h, function);
+    }
+
+    FREE_ARRAY(int, h.depths, count + 1);
+    FREE_ARRAY(bool, h.isTarget, count + 1);
+    FREE_ARRAY(bool, h.isClaimed, count + 1);
+    FREE_ARRAY(Loop, h.loops, count);
+    FREE_ARRAY(Memo, h.memos, h.memoCapacity);
+}
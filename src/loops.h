@@ -0,0 +1,8 @@
+#ifndef npp_loops_h
+#define npp_loops_h
+
+#include "object.h"
+
+void hoistInvariants(ObjFunction* function);
+
+#endif
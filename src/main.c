@@ -32,14 +32,62 @@ static void runMain(const char* path) {
 
     if (result == INTERPRET_COMPILE_ERROR) exit(65);
     if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+    if (result == INTERPRET_ABORTED) exit(75);
 }
 
 int main(int argc, const char* argv[]) {
     initVM();
     const char* suffix = ".npp";
 
+    // Options go before the file: -r runs everything it can as register code, -O optimizes,
+    // -l leaves function bodies uncompiled until their first call, -d <frames> sets how deep calls can go,
+    // -f <fuel> and -t <seconds> stop a script after that many loop iterations and calls or that much time
+    int options = 0;
+    while (options + 1 < argc && argv[options + 1][0] == '-') {
+        if (strcmp(argv[options + 1], "-r") == 0) {
+            vm.useRegisters = true;
+        } else if (strcmp(argv[options + 1], "-O") == 0) {
+            vm.optimize = true;
+        } else if (strcmp(argv[options + 1], "-l") == 0) {
+            vm.lazy = true;
+        } else if (strcmp(argv[options + 1], "-d") == 0 && options + 2 < argc) {
+            char* end;
+            long depth = strtol(argv[options + 2], &end, 10);
+            if (*end != '\0' || depth < 1 || depth > INT32_MAX) {
+                fprintf(stderr, "Error: Invalid depth \"%s\".\n", argv[options + 2]);
+                exit(64);
+            }
+            vm.maxFrames = (int)depth;
+            options++;
+        } else if (strcmp(argv[options + 1], "-f") == 0 && options + 2 < argc) {
+            char* end;
+            long long fuel = strtoll(argv[options + 2], &end, 10);
+            if (*end != '\0' || fuel < 1) {
+                fprintf(stderr, "Error: Invalid fuel \"%s\".\n", argv[options + 2]);
+                exit(64);
+            }
+            vm.fuelLimit = fuel;
+            options++;
+        } else if (strcmp(argv[options + 1], "-t") == 0 && options + 2 < argc) {
+            char* end;
+            double seconds = strtod(argv[options + 2], &end);
+            if (*end != '\0' || !(seconds > 0)) {
+                fprintf(stderr, "Error: Invalid time limit \"%s\".\n", argv[options + 2]);
+                exit(64);
+            }
+            vm.timeLimit = seconds;
+            options++;
+        } else {
+            fprintf(stderr, "Error: Unknown option \"%s\".\n", argv[options + 1]);
+            exit(64);
+        }
+        options++;
+    }
+    argc -= options;
+    argv += options;
+
     if (argc == 2 && strcmp(argv[1], "help") == 0) {
-        printf("Usage: nppc2 [main_file] // [args...]\n");
+        printf("Usage: nppc2 [-r] [-O] [-l] [-d frames] [-f fuel] [-t seconds] [main_file] // [args...]\n");
         exit(64);
     } else if (argc == 1) {
         repl();
@@ -2,6 +2,7 @@
 #include <string.h>
 #include "compiler.h"
 #include "memory.h"
+#include "registers.h"
 #include "vm.h"
 
 #define GC_HEAP_GROW_FACTOR 2
@@ -70,9 +71,17 @@ static void pushGrayStack(Obj* object) {
     vm.grayStack[vm.grayCount++] = object;
 }
 
+static void blackenObject(register Obj* object);
+
 // * Sorry, this object has been marked for removal
 void markObject(Obj* object) {
     if (object == NULL || object->isMarked) return;
+    // Scratch objects aren't on the sweep list, so nothing would ever unmark them.
+    // They're traced through right away instead, without being marked.
+    if (isScratch(object)) {
+        blackenObject(object);
+        return;
+    }
     object->isMarked = true;
     pushGrayStack(object);
 }
@@ -107,7 +116,11 @@ static void blackenObject(register Obj* object) {
         case OBJ_FUNCTION: {
             ObjFunction* function = (ObjFunction*)object;
             markObject((Obj*)function->name);
+            markObject((Obj*)function->source);
             markArray(&function->chunk.constants);
+            for (int i = 0; i < function->chunk.switchCount; i++) {
+                markTable(&function->chunk.switches[i].strings);
+            }
             break;
         }
         case OBJ_UPVALUE:
@@ -115,6 +128,7 @@ static void blackenObject(register Obj* object) {
             break;
         case OBJ_NATIVE:
         case OBJ_STRING:
+        case OBJ_STRING_BUILDER:
             break;
     }
 }
@@ -127,15 +141,13 @@ static void freeObject(register Obj* object) {
         case OBJ_BOUND_METHOD:
             FREE(ObjBoundMethod, object);
             break;
-        case OBJ_CLOSURE: {
-            ObjClosure* closure = (ObjClosure*)object;
-            FREE_ARRAY(ObjUpvalue*, closure->upvalues, closure->upvalueCount);
-            FREE(ObjClosure, object);
+        case OBJ_CLOSURE:
+            reallocate(object, CLOSURE_SIZE(((ObjClosure*)object)->upvalueCount), 0);
             break;
-        }
         case OBJ_FUNCTION: {
             ObjFunction* function = (ObjFunction*)object;
             freeChunk(&function->chunk);
+            if (function->registers != NULL) freeRegisterCode(function->registers);
             FREE(ObjFunction, object);
             break;
         }
@@ -150,8 +162,13 @@ static void freeObject(register Obj* object) {
             break;
         case OBJ_STRING: {
             ObjString* string = (ObjString*)object;
-            FREE_ARRAY(char, string->chars, string->length + 1);
-            FREE(ObjString, object);
+            reallocate(object, STRING_SIZE(string->length), 0);
+            break;
+        }
+        case OBJ_STRING_BUILDER: {
+            ObjStringBuilder* builder = (ObjStringBuilder*)object;
+            FREE_ARRAY(char, builder->chars, builder->capacity);
+            FREE(ObjStringBuilder, object);
             break;
         }
         case OBJ_UPVALUE:
@@ -173,7 +190,9 @@ static void markRoots() {
         markObject((Obj*)upvalue);
     }
 
+    markValue(vm.exception);
     markTable(&vm.globals);
+    markTable(&vm.constGlobals);
     markCompilerRoots();
     markObject((Obj*)vm.initString);
 }
@@ -1,3 +1,4 @@
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,6 +25,7 @@ void init(const char** args, int argsCountt) {
 static Value clockNative(int argCount, Value* args) {
     if (argCount != 0) {
         runtimeError("Expected 0 arguments but got %d.", argCount);
+        return NULL_VAL;
     }
 
     return NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
@@ -32,28 +34,33 @@ static Value clockNative(int argCount, Value* args) {
 static Value argcNative(int argCount, Value* args) {
     if (argCount != 0) {
         runtimeError("Expected 0 arguments but got %d.", argCount);
+        return NULL_VAL;
     }
 
-    return NUMBER_VAL(globalArgsCount);
+    return INT_VAL(globalArgsCount);
 }
 
 static Value argvNative(int argCount, Value* args) {
     if (argCount != 1) {
         runtimeError("Expected 1 argument but got %d.", argCount);
+        return NULL_VAL;
     }
 
     if (!IS_NUMBER(args[0])) {
         runtimeError("Argument must be a number.");
+        return NULL_VAL;
     }
 
     int index = (int)AS_NUMBER(args[0]);
     if (index < 0 || index >= globalArgsCount) {
         runtimeError("Index out of bounds. There are %d arguments.", globalArgsCount);
+        return NULL_VAL;
     }
 
     const char* arg = globalArgs[index];
     if (arg == NULL) {
         runtimeError("Argument at index %d is NULL.", index);
+        return NULL_VAL;
     }
 
     return OBJ_VAL(copyString(arg, (int)strlen(arg)));
@@ -62,6 +69,7 @@ static Value argvNative(int argCount, Value* args) {
 static Value stringizeNative(int argCount, Value* args) {
     if (argCount != 1) {
         runtimeError("Expected 1 argument but got %d.", argCount);
+        return NULL_VAL;
     }
 
     if (IS_STRING(args[0])) {
@@ -72,12 +80,14 @@ static Value stringizeNative(int argCount, Value* args) {
         return OBJ_VAL(copyString(buffer, (int)strlen(buffer)));
     } else {
         runtimeError("Unsupported type for stringize.");
+        return NULL_VAL;
     }
 }
 
 static Value integizeNative(int argCount, Value* args) {
     if (argCount != 1) {
         runtimeError("Expected 1 argument but got %d.", argCount);
+        return NULL_VAL;
     }
 
     if (IS_STRING(args[0])) {
@@ -89,17 +99,20 @@ static Value integizeNative(int argCount, Value* args) {
             return NUMBER_VAL(number);
         } else {
             runtimeError("String could not be converted to a number.");
+            return NULL_VAL;
         }
     } else if (IS_NUMBER(args[0])) {
         return args[0];
     } else {
         runtimeError("Unsupported type for integize.");
+        return NULL_VAL;
     }
 }
 
 static Value isNumNative(int argCount, Value* args) {
     if (argCount != 1) {
         runtimeError("Expected 1 argument but got %d.", argCount);
+        return NULL_VAL;
     }
 
     return BOOL_VAL(IS_NUMBER(args[0]));
@@ -108,6 +121,7 @@ static Value isNumNative(int argCount, Value* args) {
 static Value isBoolNative(int argCount, Value* args) {
     if (argCount != 1) {
         runtimeError("Expected 1 argument but got %d.", argCount);
+        return NULL_VAL;
     }
 
     return BOOL_VAL(IS_BOOL(args[0]));
@@ -116,6 +130,7 @@ static Value isBoolNative(int argCount, Value* args) {
 static Value isObjNative(int argCount, Value* args) {
     if (argCount != 1) {
         runtimeError("Expected 1 argument but got %d.", argCount);
+        return NULL_VAL;
     }
 
     return BOOL_VAL(IS_OBJ(args[0]));
@@ -124,6 +139,7 @@ static Value isObjNative(int argCount, Value* args) {
 static Value isStrNative(int argCount, Value* args) {
     if (argCount != 1) {
         runtimeError("Expected 1 argument but got %d.", argCount);
+        return NULL_VAL;
     }
 
     return BOOL_VAL(IS_STRING(args[0]));
@@ -132,6 +148,7 @@ static Value isStrNative(int argCount, Value* args) {
 static Value isInstanceNative(int argCount, Value* args) {
     if (argCount != 1) {
         runtimeError("Expected 1 argument but got %d.", argCount);
+        return NULL_VAL;
     }
 
     return BOOL_VAL(IS_INSTANCE(args[0]));
@@ -140,6 +157,7 @@ static Value isInstanceNative(int argCount, Value* args) {
 static Value isNullNative(int argCount, Value* args) {
     if (argCount != 1) {
         runtimeError("Expected 1 argument but got %d.", argCount);
+        return NULL_VAL;
     }
 
     return BOOL_VAL(IS_NULL(args[0]));
@@ -148,6 +166,7 @@ static Value isNullNative(int argCount, Value* args) {
 static Value isNativeNative(int argCount, Value* args) {
     if (argCount != 1) {
         runtimeError("Expected 1 argument but got %d.", argCount);
+        return NULL_VAL;
     }
 
     return BOOL_VAL(IS_NATIVE(args[0]));
@@ -156,6 +175,7 @@ static Value isNativeNative(int argCount, Value* args) {
 static Value isBoundMethodNative(int argCount, Value* args) {
     if (argCount != 1) {
         runtimeError("Expected 1 argument but got %d.", argCount);
+        return NULL_VAL;
     }
 
     return BOOL_VAL(IS_BOUND_METHOD(args[0]));
@@ -165,6 +185,7 @@ static Value isBoundMethodNative(int argCount, Value* args) {
 static Value isClassNative(int argCount, Value* args) {
     if (argCount != 1) {
         runtimeError("Expected 1 argument but got %d.", argCount);
+        return NULL_VAL;
     }
 
     return BOOL_VAL(IS_CLASS(args[0]));
@@ -173,6 +194,7 @@ static Value isClassNative(int argCount, Value* args) {
 static Value broadcastNative(int argCount, Value* args) {
     if (argCount != 1) {
         runtimeError("Expected 1 argument but got %d.", argCount);
+        return NULL_VAL;
     }
 
     printValue(args[0]);
@@ -182,6 +204,7 @@ static Value broadcastNative(int argCount, Value* args) {
 static Value receiveNative(int argCount, Value* args) {
     if (argCount != 1) {
         runtimeError("Expected 1 argument but got %d.", argCount);
+        return NULL_VAL;
     }
 
     printValue(args[0]);
@@ -203,10 +226,12 @@ static Value receiveNative(int argCount, Value* args) {
 static Value systemNative(int argCount, Value* args) {
     if (argCount != 1) {
         runtimeError("Expected 1 argument but got %d.", argCount);
+        return NULL_VAL;
     }
 
     if (!IS_STRING(args[0])) {
         runtimeError("Argument must be a number.");
+        return NULL_VAL;
     }
 
     char* cmd = AS_CSTRING(args[0]);
@@ -216,10 +241,12 @@ static Value systemNative(int argCount, Value* args) {
 static Value sinNative(int argCount, Value* args) {
     if (argCount != 1) {
         runtimeError("Expected 1 argument but got %d.", argCount);
+        return NULL_VAL;
     }
 
     if (!IS_NUMBER(args[0])) {
         runtimeError("Argument must be a number.");
+        return NULL_VAL;
     }
 
     return NUMBER_VAL(sin(AS_NUMBER(args[0])));
@@ -228,10 +255,12 @@ static Value sinNative(int argCount, Value* args) {
 static Value cosNative(int argCount, Value* args) {
     if (argCount != 1) {
         runtimeError("Expected 1 argument but got %d.", argCount);
+        return NULL_VAL;
     }
 
     if (!IS_NUMBER(args[0])) {
         runtimeError("Argument must be a number.");
+        return NULL_VAL;
     }
 
     return NUMBER_VAL(cos(AS_NUMBER(args[0])));
@@ -240,10 +269,12 @@ static Value cosNative(int argCount, Value* args) {
 static Value tanNative(int argCount, Value* args) {
     if (argCount != 1) {
         runtimeError("Expected 1 argument but got %d.", argCount);
+        return NULL_VAL;
     }
 
     if (!IS_NUMBER(args[0])) {
         runtimeError("Argument must be a number.");
+        return NULL_VAL;
     }
 
     return NUMBER_VAL(tan(AS_NUMBER(args[0])));
@@ -252,10 +283,12 @@ static Value tanNative(int argCount, Value* args) {
 static Value asinNative(int argCount, Value* args) {
     if (argCount != 1) {
         runtimeError("Expected 1 argument but got %d.", argCount);
+        return NULL_VAL;
     }
 
     if (!IS_NUMBER(args[0])) {
         runtimeError("Argument must be a number.");
+        return NULL_VAL;
     }
 
     return NUMBER_VAL(asin(AS_NUMBER(args[0])));
@@ -264,10 +297,12 @@ static Value asinNative(int argCount, Value* args) {
 static Value acosNative(int argCount, Value* args) {
     if (argCount != 1) {
         runtimeError("Expected 1 argument but got %d.", argCount);
+        return NULL_VAL;
     }
 
     if (!IS_NUMBER(args[0])) {
         runtimeError("Argument must be a number.");
+        return NULL_VAL;
     }
 
     return NUMBER_VAL(acos(AS_NUMBER(args[0])));
@@ -276,10 +311,12 @@ static Value acosNative(int argCount, Value* args) {
 static Value atanNative(int argCount, Value* args) {
     if (argCount != 1) {
         runtimeError("Expected 1 argument but got %d.", argCount);
+        return NULL_VAL;
     }
 
     if (!IS_NUMBER(args[0])) {
         runtimeError("Argument must be a number.");
+        return NULL_VAL;
     }
 
     return NUMBER_VAL(atan(AS_NUMBER(args[0])));
@@ -288,10 +325,12 @@ static Value atanNative(int argCount, Value* args) {
 static Value absNative(int argCount, Value* args) {
     if (argCount != 1) {
         runtimeError("Expected 1 argument but got %d.", argCount);
+        return NULL_VAL;
     }
 
     if (!IS_NUMBER(args[0])) {
         runtimeError("Argument must be a number.");
+        return NULL_VAL;
     }
 
     return NUMBER_VAL(fabs(AS_NUMBER(args[0])));
@@ -300,10 +339,12 @@ static Value absNative(int argCount, Value* args) {
 static Value hypotNative(int argCount, Value* args) {
     if (argCount != 2) {
         runtimeError("Expected 2 arguments but got %d.", argCount);
+        return NULL_VAL;
     }
 
     if (!IS_NUMBER(args[0]) && !IS_NUMBER(args[1])) {
         runtimeError("Arguments must be a number.");
+        return NULL_VAL;
     }
 
     return NUMBER_VAL(hypot(AS_NUMBER(args[0]), AS_NUMBER(args[1])));
@@ -312,10 +353,12 @@ static Value hypotNative(int argCount, Value* args) {
 static Value sqrtNative(int argCount, Value* args) {
     if (argCount != 1) {
         runtimeError("Expected 2 arguments but got %d.", argCount);
+        return NULL_VAL;
     }
 
     if (!IS_NUMBER(args[0])) {
         runtimeError("Argument must be a number.");
+        return NULL_VAL;
     }
 
     return NUMBER_VAL(sqrt(AS_NUMBER(args[0])));
@@ -324,10 +367,12 @@ static Value sqrtNative(int argCount, Value* args) {
 static Value powrNative(int argCount, Value* args) {
     if (argCount != 2) {
         runtimeError("Expected 2 arguments but got %d.", argCount);
+        return NULL_VAL;
     }
 
     if (!IS_NUMBER(args[0]) && !IS_NUMBER(args[1])) {
         runtimeError("Arguments must be a number.");
+        return NULL_VAL;
     }
 
     return NUMBER_VAL(pow(AS_NUMBER(args[0]), AS_NUMBER(args[1])));
@@ -336,10 +381,16 @@ static Value powrNative(int argCount, Value* args) {
 static Value mdlsNative(int argCount, Value* args) {
     if (argCount != 2) {
         runtimeError("Expected 2 arguments but got %d.", argCount);
+        return NULL_VAL;
     }
 
     if (!IS_NUMBER(args[0]) && !IS_NUMBER(args[1])) {
         runtimeError("Arguments must be a number.");
+        return NULL_VAL;
+    }
+
+    if (BOTH_INTS(args[0], args[1])) {
+        return BOOL_VAL((int64_t)AS_INT(args[0]) % AS_INT(args[1]) == 0);
     }
 
     int a = AS_NUMBER(args[0]);
@@ -350,6 +401,7 @@ static Value mdlsNative(int argCount, Value* args) {
 static Value collectGarbageNative(int argCount, Value* args) {
     if (argCount != 0) {
         runtimeError("Expected 0 arguments but got %d.", argCount);
+        return NULL_VAL;
     }
 
     collectGarbage();
@@ -358,28 +410,326 @@ static Value collectGarbageNative(int argCount, Value* args) {
 static Value runtimeErrorNative(int argCount, Value* args) {
     if (argCount != 1) {
         runtimeError("Expected 1 arguments but got %d.", argCount);
+        return NULL_VAL;
     }
 
     if (!IS_STRING(args[0])) {
         runtimeError("Argument 1 must be a string.");
+        return NULL_VAL;
     }
 
-    runtimeError(AS_CSTRING(args[0]));
-    exit(404);
+    throwValue(args[0]);
+    return NULL_VAL;
 }
 
 static Value interpretNative(int argCount, Value* args) {
     if (argCount != 1) {
         runtimeError("Expected 1 arguments but got %d.", argCount);
+        return NULL_VAL;
     }
 
     if (!IS_STRING(args[0])) {
         runtimeError("Argument 1 must be a string.");
+        return NULL_VAL;
     }
 
     interpret(AS_CSTRING(args[0]));
 }
 
+// Appends a value the same way broadcast() would print it
+static bool appendValue(ObjStringBuilder* builder, Value value) {
+    if (IS_STRING(value)) {
+        builderAppend(builder, AS_CSTRING(value), AS_STRING(value)->length);
+    } else if (IS_NUMBER(value)) {
+        char buffer[32];
+        int length = snprintf(buffer, sizeof(buffer), "%g", AS_NUMBER(value));
+        builderAppend(builder, buffer, length);
+    } else if (IS_BOOL(value)) {
+        const char* text = AS_BOOL(value) ? "[TRUE]" : "[FALSE]";
+        builderAppend(builder, text, (int)strlen(text));
+    } else if (IS_NULL(value)) {
+        builderAppend(builder, "[NULL]", 6);
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+// snprintf straight into the builder, measuring first so it only has to grow once
+static void appendFormatted(ObjStringBuilder* builder, const char* spec, ...) {
+    va_list args;
+    va_start(args, spec);
+    int length = vsnprintf(NULL, 0, spec, args);
+    va_end(args);
+
+    if (length <= 0) return;
+
+    char* dest = builderReserve(builder, length + 1);
+    va_start(args, spec);
+    vsnprintf(dest, length + 1, spec, args);
+    va_end(args);
+    builder->length--;
+}
+
+static Value stringBuilderNative(int argCount, Value* args) {
+    if (argCount != 0) {
+        runtimeError("Expected 0 arguments but got %d.", argCount);
+        return NULL_VAL;
+    }
+
+    return OBJ_VAL(newStringBuilder());
+}
+
+static Value appendNative(int argCount, Value* args) {
+    if (argCount != 2) {
+        runtimeError("Expected 2 arguments but got %d.", argCount);
+        return NULL_VAL;
+    }
+
+    if (!IS_STRING_BUILDER(args[0]) || !IS_STRING(args[1])) {
+        runtimeError("Arguments must be a string builder and a string.");
+        return NULL_VAL;
+    }
+
+    builderAppend(AS_STRING_BUILDER(args[0]), AS_CSTRING(args[1]), AS_STRING(args[1])->length);
+    return args[0];
+}
+
+static Value appendNumberNative(int argCount, Value* args) {
+    if (argCount != 2) {
+        runtimeError("Expected 2 arguments but got %d.", argCount);
+        return NULL_VAL;
+    }
+
+    if (!IS_STRING_BUILDER(args[0]) || !IS_NUMBER(args[1])) {
+        runtimeError("Arguments must be a string builder and a number.");
+        return NULL_VAL;
+    }
+
+    appendValue(AS_STRING_BUILDER(args[0]), args[1]);
+    return args[0];
+}
+
+static Value appendCharNative(int argCount, Value* args) {
+    if (argCount != 2) {
+        runtimeError("Expected 2 arguments but got %d.", argCount);
+        return NULL_VAL;
+    }
+
+    if (!IS_STRING_BUILDER(args[0])) {
+        runtimeError("Argument 1 must be a string builder.");
+        return NULL_VAL;
+    }
+
+    char c;
+    if (IS_NUMBER(args[1]) && AS_NUMBER(args[1]) >= 0 && AS_NUMBER(args[1]) <= 255) {
+        c = (char)(int)AS_NUMBER(args[1]);
+    } else if (IS_STRING(args[1]) && AS_STRING(args[1])->length == 1) {
+        c = AS_CSTRING(args[1])[0];
+    } else {
+        runtimeError("Argument 2 must be a character code or a one character string.");
+        return NULL_VAL;
+    }
+
+    builderAppend(AS_STRING_BUILDER(args[0]), &c, 1);
+    return args[0];
+}
+
+static Value buildNative(int argCount, Value* args) {
+    if (argCount != 1) {
+        runtimeError("Expected 1 argument but got %d.", argCount);
+        return NULL_VAL;
+    }
+
+    if (!IS_STRING_BUILDER(args[0])) {
+        runtimeError("Argument must be a string builder.");
+        return NULL_VAL;
+    }
+
+    return OBJ_VAL(builderToString(AS_STRING_BUILDER(args[0])));
+}
+
+// join(separator, parts...)
+static Value joinNative(int argCount, Value* args) {
+    if (argCount < 1) {
+        runtimeError("Expected at least 1 argument but got %d.", argCount);
+        return NULL_VAL;
+    }
+
+    if (!IS_STRING(args[0])) {
+        runtimeError("Argument 1 must be a string.");
+        return NULL_VAL;
+    }
+
+    ObjString* separator = AS_STRING(args[0]);
+    ObjStringBuilder* builder = newStringBuilder();
+    push(OBJ_VAL(builder));
+
+    for (int i = 1; i < argCount; i++) {
+        if (i > 1) builderAppend(builder, separator->chars, separator->length);
+        if (!appendValue(builder, args[i])) {
+            pop();
+            runtimeError("Can only join strings, numbers, bools and null.");
+            return NULL_VAL;
+        }
+    }
+
+    ObjString* result = builderToString(builder);
+    pop();
+    return OBJ_VAL(result);
+}
+
+// format(format, args...) with printf style %s, %d, %i, %x, %X, %c, %f, %e, %g and %%
+static Value formatNative(int argCount, Value* args) {
+    if (argCount < 1) {
+        runtimeError("Expected at least 1 argument but got %d.", argCount);
+        return NULL_VAL;
+    }
+
+    if (!IS_STRING(args[0])) {
+        runtimeError("Argument 1 must be a string.");
+        return NULL_VAL;
+    }
+
+    ObjString* format = AS_STRING(args[0]);
+    ObjStringBuilder* builder = newStringBuilder();
+    push(OBJ_VAL(builder));
+
+    int next = 1;
+    int i = 0;
+    while (i < format->length) {
+        if (format->chars[i] != '%') {
+            int start = i;
+            while (i < format->length && format->chars[i] != '%') i++;
+            builderAppend(builder, format->chars + start, i - start);
+            continue;
+        }
+
+        // Copy the flags, width and precision into a spec snprintf understands
+        char spec[24];
+        int specLength = 0;
+        spec[specLength++] = format->chars[i++];
+        while (i < format->length && specLength < 16 && strchr("-+ #0123456789.", format->chars[i]) != NULL) {
+            spec[specLength++] = format->chars[i++];
+        }
+
+        if (i >= format->length) {
+            pop();
+            runtimeError("Incomplete format specifier.");
+            return NULL_VAL;
+        }
+
+        char conversion = format->chars[i++];
+        if (conversion == '%') {
+            builderAppend(builder, "%", 1);
+            continue;
+        }
+
+        if (next >= argCount) {
+            pop();
+            runtimeError("Not enough arguments for format string.");
+            return NULL_VAL;
+        }
+
+        Value arg = args[next++];
+        switch (conversion) {
+            case 's':
+                if (specLength == 1) {
+                    if (appendValue(builder, arg)) break;
+                } else if (IS_STRING(arg)) {
+                    spec[specLength++] = 's';
+                    spec[specLength] = '\0';
+                    appendFormatted(builder, spec, AS_CSTRING(arg));
+                    break;
+                } else {
+                    // Format the value plainly first, then pad it
+                    ObjStringBuilder* text = newStringBuilder();
+                    push(OBJ_VAL(text));
+                    bool ok = appendValue(text, arg);
+                    builderAppend(text, "", 1);
+                    spec[specLength++] = 's';
+                    spec[specLength] = '\0';
+                    if (ok) appendFormatted(builder, spec, text->chars);
+                    pop();
+                    if (ok) break;
+                }
+
+                pop();
+                runtimeError("Can only format strings, numbers, bools and null.");
+                return NULL_VAL;
+            case 'd':
+            case 'i':
+            case 'x':
+            case 'X':
+            case 'c':
+                if (!IS_NUMBER(arg)) {
+                    pop();
+                    runtimeError("Format '%%%c' expects a number.", conversion);
+                    return NULL_VAL;
+                }
+
+                // Converting NaN, an infinity or a number out of range is undefined, so it's refused
+                double number = AS_NUMBER(arg);
+                double limit = conversion == 'c' ? (double)INT_MAX + 1 : 0x1p63;
+                if (!(number >= -limit && number < limit)) {
+                    pop();
+                    runtimeError("Format '%%%c' expects a number in range.", conversion);
+                    return NULL_VAL;
+                }
+
+                if (conversion == 'c') {
+                    spec[specLength++] = 'c';
+                    spec[specLength] = '\0';
+                    appendFormatted(builder, spec, (int)number);
+                } else {
+                    spec[specLength++] = 'l';
+                    spec[specLength++] = 'l';
+                    spec[specLength++] = conversion;
+                    spec[specLength] = '\0';
+                    appendFormatted(builder, spec, (long long)number);
+                }
+                break;
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+                if (!IS_NUMBER(arg)) {
+                    pop();
+                    runtimeError("Format '%%%c' expects a number.", conversion);
+                    return NULL_VAL;
+                }
+
+                spec[specLength++] = conversion;
+                spec[specLength] = '\0';
+                appendFormatted(builder, spec, AS_NUMBER(arg));
+                break;
+            default:
+                pop();
+                runtimeError("Unknown format specifier '%%%c'.", conversion);
+                return NULL_VAL;
+        }
+    }
+
+    if (next != argCount) {
+        pop();
+        runtimeError("Too many arguments for format string.");
+        return NULL_VAL;
+    }
+
+    ObjString* result = builderToString(builder);
+    pop();
+    return OBJ_VAL(result);
+}
+
+// The name's string is interned, so it's the one every global access by that name uses
+static void defineMath(const char* name, NativeFn function, MathIntrinsic intrinsic) {
+    defineNative(name, function);
+    copyString(name, (int)strlen(name))->intrinsic = intrinsic;
+}
+
 // * Defines all the native functions
 void defineNatives() {
     // Time section
@@ -407,19 +757,28 @@ void defineNatives() {
     defineNative("receive", receiveNative);
     defineNative("system", systemNative);
 
+    // String building section
+    defineNative("stringBuilder", stringBuilderNative);
+    defineNative("append", appendNative);
+    defineNative("appendNumber", appendNumberNative);
+    defineNative("appendChar", appendCharNative);
+    defineNative("build", buildNative);
+    defineNative("join", joinNative);
+    defineNative("format", formatNative);
+
     // Triginometry section
-    defineNative("sin", sinNative);
-    defineNative("cos", cosNative);
-    defineNative("tan", tanNative);
-    defineNative("abs", absNative);
-    defineNative("asin", asinNative);
-    defineNative("acos", acosNative);
-    defineNative("atan", atanNative);
-    defineNative("hypot", hypotNative);
+    defineMath("sin", sinNative, MATH_SIN);
+    defineMath("cos", cosNative, MATH_COS);
+    defineMath("tan", tanNative, MATH_TAN);
+    defineMath("abs", absNative, MATH_ABS);
+    defineMath("asin", asinNative, MATH_ASIN);
+    defineMath("acos", acosNative, MATH_ACOS);
+    defineMath("atan", atanNative, MATH_ATAN);
+    defineMath("hypot", hypotNative, MATH_HYPOT);
 
     // Math section
-    defineNative("sqrt", sqrtNative);
-    defineNative("powr", powrNative);
+    defineMath("sqrt", sqrtNative, MATH_SQRT);
+    defineMath("powr", powrNative, MATH_POWR);
     defineNative("mdls", mdlsNative);
 
     // Language development kit section
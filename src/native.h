@@ -3,6 +3,21 @@
 
 #include "value.h"
 
+// The math natives OP_MATH runs in place of a call, for as long as their globals hold them
+typedef enum {
+    MATH_NONE,
+    MATH_SIN,
+    MATH_COS,
+    MATH_TAN,
+    MATH_ASIN,
+    MATH_ACOS,
+    MATH_ATAN,
+    MATH_ABS,
+    MATH_SQRT,
+    MATH_HYPOT, // the two argument ones come last
+    MATH_POWR
+} MathIntrinsic;
+
 void init(const char** args, int argsCount);
 void defineNatives();
 
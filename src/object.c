@@ -20,13 +20,36 @@ static Obj* allocateObject(size_t size, ObjType type) {
     return object;
 }
 
-ObjBoundMethod* newBoundMethod(Value receiver, ObjClosure* method) {
-    ObjBoundMethod* bound = ALLOCATE_OBJ(ObjBoundMethod, OBJ_BOUND_METHOD);
+// Objects the compiler proved never outlive their frame come off the frame's scratch space,
+// they're given back when the frame returns or their local goes out of scope. Once
+// the scratch space runs out they're just allocated like everything else.
+static Obj* allocateScratch(size_t size, ObjType type) {
+    size_t rounded = (size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+    if (vm.scratchTop + rounded > SCRATCH_MAX) return allocateObject(size, type);
+
+    Obj* object = (Obj*)((uint8_t*)vm.scratch + vm.scratchTop);
+    vm.scratchTop += rounded;
+    object->type = type;
+    object->isMarked = false;
+    object->next = NULL;
+    return object;
+}
+
+static ObjBoundMethod* initBoundMethod(ObjBoundMethod* bound, Value receiver, ObjClosure* method) {
     bound->receiver = receiver;
     bound->method = method;
     return bound;
 }
 
+ObjBoundMethod* newBoundMethod(Value receiver, ObjClosure* method) {
+    return initBoundMethod(ALLOCATE_OBJ(ObjBoundMethod, OBJ_BOUND_METHOD), receiver, method);
+}
+
+ObjBoundMethod* newFrameBoundMethod(Value receiver, ObjClosure* method) {
+    Obj* object = allocateScratch(sizeof(ObjBoundMethod), OBJ_BOUND_METHOD);
+    return initBoundMethod((ObjBoundMethod*)object, receiver, method);
+}
+
 ObjClass* newClass(ObjString* name) {
     ObjClass* klass = ALLOCATE_OBJ(ObjClass, OBJ_CLASS);
     klass->name = name; 
@@ -34,25 +57,35 @@ ObjClass* newClass(ObjString* name) {
     return klass;
 }
 
-ObjClosure* newClosure(ObjFunction* function) {
-    ObjUpvalue** upvalues = ALLOCATE(ObjUpvalue*, function->upvalueCount);
-    for (int i = 0; i < function->upvalueCount; i++) {
-        upvalues[i] = NULL;
-    }
-
-    ObjClosure* closure = ALLOCATE_OBJ(ObjClosure, OBJ_CLOSURE);
+static ObjClosure* initClosure(ObjClosure* closure, ObjFunction* function) {
     closure->function = function;
-    closure->upvalues = upvalues;
     closure->upvalueCount = function->upvalueCount;
+    for (int i = 0; i < function->upvalueCount; i++) {
+        closure->upvalues[i] = NULL;
+    }
 
     return closure;
 }
 
+ObjClosure* newClosure(ObjFunction* function) {
+    Obj* object = allocateObject(CLOSURE_SIZE(function->upvalueCount), OBJ_CLOSURE);
+    return initClosure((ObjClosure*)object, function);
+}
+
+ObjClosure* newFrameClosure(ObjFunction* function) {
+    Obj* object = allocateScratch(CLOSURE_SIZE(function->upvalueCount), OBJ_CLOSURE);
+    return initClosure((ObjClosure*)object, function);
+}
+
 ObjFunction* newFunction() {
     ObjFunction* function = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
     function->arity = 0;
     function->upvalueCount = 0;
+    function->stackSize = -1;
     function->name = NULL;
+    function->registers = NULL;
+    function->source = NULL;
+    function->returnType = VALUE_ANY;
     initChunk(&function->chunk);
     return function;
 }
@@ -70,11 +103,107 @@ ObjNative* newNative(NativeFn function) {
     return native;
 }
 
-static ObjString* allocateString(char* chars, int length, uint32_t hash) {
-    ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
+// String hashing is a wyhash-style construction: the input is read a word at a
+// time and every pair of words is folded together with a 64x64->128 multiply.
+#define HASH_SECRET0 0xa0761d6478bd642full
+#define HASH_SECRET1 0xe7037ed1a0b428dbull
+#define HASH_SECRET2 0x8ebc6af09c88c6e3ull
+#define HASH_SECRET3 0x589965cc75374cc3ull
+
+static inline uint64_t hashMultiply(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t product = (__uint128_t)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+#else
+    uint64_t aHi = a >> 32, aLo = (uint32_t)a;
+    uint64_t bHi = b >> 32, bLo = (uint32_t)b;
+    uint64_t hh = aHi * bHi, hl = aHi * bLo, lh = aLo * bHi, ll = aLo * bLo;
+    uint64_t mid = (ll >> 32) + (uint32_t)hl + (uint32_t)lh;
+    uint64_t lo = (mid << 32) | (uint32_t)ll;
+    uint64_t hi = hh + (hl >> 32) + (lh >> 32) + (mid >> 32);
+    return lo ^ hi;
+#endif
+}
+
+static inline uint64_t read64(const uint8_t* p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint64_t read32(const uint8_t* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t hashString(const char* key, int length) {
+    const uint8_t* p = (const uint8_t*)key;
+    size_t remaining = (size_t)length;
+    uint64_t seed = hashMultiply(HASH_SECRET0, HASH_SECRET1);
+    uint64_t a, b;
+
+    if (remaining <= 16) {
+        if (remaining >= 4) {
+            size_t shift = (remaining >> 3) << 2;
+            a = (read32(p) << 32) | read32(p + shift);
+            b = (read32(p + remaining - 4) << 32) | read32(p + remaining - 4 - shift);
+        } else if (remaining > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[remaining >> 1] << 8) | p[remaining - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        // Long strings run three independent lanes so the multiplies overlap.
+        if (remaining > 48) {
+            uint64_t lane1 = seed, lane2 = seed;
+            do {
+                seed = hashMultiply(read64(p) ^ HASH_SECRET1, read64(p + 8) ^ seed);
+                lane1 = hashMultiply(read64(p + 16) ^ HASH_SECRET2, read64(p + 24) ^ lane1);
+                lane2 = hashMultiply(read64(p + 32) ^ HASH_SECRET3, read64(p + 40) ^ lane2);
+                p += 48;
+                remaining -= 48;
+            } while (remaining > 48);
+            seed ^= lane1 ^ lane2;
+        }
+
+        while (remaining > 16) {
+            seed = hashMultiply(read64(p) ^ HASH_SECRET1, read64(p + 8) ^ seed);
+            p += 16;
+            remaining -= 16;
+        }
+
+        a = read64(p + remaining - 16);
+        b = read64(p + remaining - 8);
+    }
+
+    uint64_t hash = hashMultiply(HASH_SECRET1 ^ (uint64_t)length, hashMultiply(a ^ HASH_SECRET1, b ^ seed));
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+// Strings keep their bytes right after the header, so a string is one allocation.
+// The result isn't interned or tracked by the GC until it goes through internString().
+ObjString* makeString(int length) {
+    ObjString* string = (ObjString*)reallocate(NULL, 0, STRING_SIZE(length));
+    string->obj.type = OBJ_STRING;
+    string->obj.isMarked = false;
+    string->obj.next = NULL;
     string->length = length;
-    string->chars = chars;
+    string->hash = 0;
+    string->isWatched = false;
+    string->isConst = false;
+    string->isDeclared = false;
+    string->type = VALUE_ANY;
+    string->intrinsic = 0;
+    string->chars[length] = '\0';
+    return string;
+}
+
+static ObjString* registerString(ObjString* string, uint32_t hash) {
     string->hash = hash;
+    string->obj.next = vm.objects;
+    vm.objects = (Obj*)string;
 
     push(OBJ_VAL(string));
     tableSet(&vm.strings, string, NULL_VAL);
@@ -83,25 +212,16 @@ static ObjString* allocateString(char* chars, int length, uint32_t hash) {
     return string;
 }
 
-static uint32_t hashString(const char* key, int length) {
-    uint32_t hash = 2166136261u;
-    for (int i = 0; i < length; i++) {
-        hash ^= (uint8_t)key[i];
-        hash *= 16777619;
-    }
-    return hash;
-}
-
-ObjString* takeString(char* chars, int length) {
-    uint32_t hash = hashString(chars, length);
+ObjString* internString(ObjString* string) {
+    uint32_t hash = hashString(string->chars, string->length);
 
-    ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
+    ObjString* interned = tableFindString(&vm.strings, string->chars, string->length, hash);
     if (interned != NULL) {
-        FREE_ARRAY(char, chars, length + 1);
+        reallocate(string, STRING_SIZE(string->length), 0);
         return interned;
     }
 
-    return allocateString(chars, length, hash);
+    return registerString(string, hash);
 }
 
 ObjString* copyString(const char* chars, int length) {
@@ -109,11 +229,43 @@ ObjString* copyString(const char* chars, int length) {
     ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
     if (interned != NULL) return interned;
 
-    char* heapChars = ALLOCATE(char, length + 1);
-    memcpy(heapChars, chars, length);
-    heapChars[length] = '\0';
+    ObjString* string = makeString(length);
+    memcpy(string->chars, chars, length);
+
+    return registerString(string, hash);
+}
+
+ObjStringBuilder* newStringBuilder() {
+    ObjStringBuilder* builder = ALLOCATE_OBJ(ObjStringBuilder, OBJ_STRING_BUILDER);
+    builder->length = 0;
+    builder->capacity = 0;
+    builder->chars = NULL;
+    return builder;
+}
+
+// Makes room for `length` more bytes at the end of the builder and returns where they go.
+// The builder has to be reachable (on the stack) while appending, growing can collect.
+char* builderReserve(ObjStringBuilder* builder, int length) {
+    if (builder->capacity < builder->length + length) {
+        int oldCapacity = builder->capacity;
+        int capacity = GROW_CAPACITY(oldCapacity);
+        while (capacity < builder->length + length) capacity *= 2;
+
+        builder->chars = GROW_ARRAY(char, builder->chars, oldCapacity, capacity);
+        builder->capacity = capacity;
+    }
+
+    char* end = builder->chars + builder->length;
+    builder->length += length;
+    return end;
+}
+
+void builderAppend(ObjStringBuilder* builder, const char* chars, int length) {
+    memcpy(builderReserve(builder, length), chars, length);
+}
 
-    return allocateString(heapChars, length, hash);
+ObjString* builderToString(ObjStringBuilder* builder) {
+    return copyString(builder->chars == NULL ? "" : builder->chars, builder->length);
 }
 
 ObjUpvalue* newUpvalue(Value* slot) {
@@ -126,72 +278,43 @@ ObjUpvalue* newUpvalue(Value* slot) {
     return upvalue;
 }
 
-static void printFunction(ObjFunction* function) {
+static void printFunction(FILE* file, ObjFunction* function) {
     if (function->name == NULL) {
-        printf("<script>");
+        fprintf(file, "<script>");
         return;
     }
 
-    printf("<fn %s>", function->name->chars);
-}
-
-// * Ohh! Fancy!
-void printInterpretedString(const char* str) {
-    while (*str) {
-        if (*str == '\\') {
-            str++;
-            switch (*str) {
-                case 'n':
-                    putchar('\n');
-                    break;
-                case 't':
-                    putchar('\t');
-                    break;
-                case '\\':
-                    putchar('\\');
-                    break;
-                case '0':
-                    putchar('\0');
-                    break;
-                case '\'':
-                    putchar('\"');
-                    break;
-                default:
-                    runtimeError("Unrecognized escape key '%s'", *str);
-                    break;
-            }
-        } else {
-            putchar(*str);
-        }
-        if (*str != '\0') str++;
-    }
+    fprintf(file, "<fn %s>", function->name->chars);
 }
 
-void printObject(register Value value) {
+void fprintObject(FILE* file, Value value) {
     switch (OBJ_TYPE(value)) {
         case OBJ_BOUND_METHOD:
-            printFunction(AS_BOUND_METHOD(value)->method->function);
+            printFunction(file, AS_BOUND_METHOD(value)->method->function);
             break;
         case OBJ_CLASS:
-            printf("%s", AS_CLASS(value)->name->chars);
+            fprintf(file, "%s", AS_CLASS(value)->name->chars);
             break;
         case OBJ_CLOSURE:
-            printFunction(AS_CLOSURE(value)->function);
+            printFunction(file, AS_CLOSURE(value)->function);
             break;
         case OBJ_FUNCTION:
-            printFunction(AS_FUNCTION(value));
+            printFunction(file, AS_FUNCTION(value));
             break;
         case OBJ_INSTANCE:
-            printf("%s instance", AS_INSTANCE(value)->klass->name->chars);
+            fprintf(file, "%s instance", AS_INSTANCE(value)->klass->name->chars);
             break;
         case OBJ_NATIVE:
-            printf("<native fn>");
+            fprintf(file, "<native fn>");
             break;
         case OBJ_STRING:
-            printInterpretedString(AS_CSTRING(value));
+            fwrite(AS_CSTRING(value), sizeof(char), AS_STRING(value)->length, file);
+            break;
+        case OBJ_STRING_BUILDER:
+            fprintf(file, "<string builder>");
             break;
         case OBJ_UPVALUE:
-            printf("upvalue");
+            fprintf(file, "upvalue");
             break;
     }
 }
@@ -14,6 +14,7 @@
 #define IS_INSTANCE(value)     isObjType(value, OBJ_INSTANCE)
 #define IS_NATIVE(value)       isObjType(value, OBJ_NATIVE)
 #define IS_STRING(value)       isObjType(value, OBJ_STRING)
+#define IS_STRING_BUILDER(value) isObjType(value, OBJ_STRING_BUILDER)
 
 #define AS_BOUND_METHOD(value) ((ObjBoundMethod*)AS_OBJ(value))
 #define AS_CLASS(value)        ((ObjClass*)AS_OBJ(value))
@@ -23,6 +24,7 @@
 #define AS_NATIVE(value)       (((ObjNative*)AS_OBJ(value))->function)
 #define AS_STRING(value)       ((ObjString*)AS_OBJ(value))
 #define AS_CSTRING(value)      (((ObjString*)AS_OBJ(value))->chars)
+#define AS_STRING_BUILDER(value) ((ObjStringBuilder*)AS_OBJ(value))
 
 typedef enum {
     OBJ_BOUND_METHOD,
@@ -32,6 +34,7 @@ typedef enum {
     OBJ_INSTANCE,
     OBJ_NATIVE,
     OBJ_STRING,
+    OBJ_STRING_BUILDER,
     OBJ_UPVALUE
 } ObjType;
 
@@ -46,7 +49,15 @@ typedef struct {
     int arity;
     int upvalueCount;
     Chunk chunk;
+    int stackSize; // the most a call has on the stack above its slots, -1 if the compiler couldn't tell
+    struct RegisterCode* registers;
     ObjString* name;
+    // Under -l a body may only be pre-parsed; these say where to find it, see compileBody
+    ObjString* source;
+    int sourceOffset;
+    int sourceLine;
+    int sourceType;
+    ValueType returnType;
 } ObjFunction;
 
 typedef Value (*NativeFn)(int argCount, Value* args);
@@ -59,10 +70,25 @@ typedef struct {
 struct ObjString {
     Obj obj;
     int length;
-    char* chars;
     uint32_t hash;
+    bool isWatched; // some memo reads a global or field by this name, see loops.c
+    bool isConst;   // names a global declared with const, which nothing may assign
+    bool isDeclared; // some code compiled so far declares a global by this name
+    uint8_t type;   // the ValueType of the last declaration of a global by this name that ran
+    uint8_t intrinsic; // the MathIntrinsic a global by this name still holds, see OP_MATH
+    char chars[];
 };
 
+#define STRING_SIZE(length) (sizeof(ObjString) + (length) + 1)
+
+// A mutable buffer that only becomes an (interned) ObjString when it's built.
+typedef struct {
+    Obj obj;
+    int length;
+    int capacity;
+    char* chars;
+} ObjStringBuilder;
+
 typedef struct ObjUpvalue {
     Obj obj;
     Value* location;
@@ -73,10 +99,12 @@ typedef struct ObjUpvalue {
 typedef struct {
     Obj obj;
     ObjFunction* function;
-    ObjUpvalue** upvalues;
     int upvalueCount;
+    ObjUpvalue* upvalues[]; // allocated along with the closure, see CLOSURE_SIZE
 } ObjClosure;
 
+#define CLOSURE_SIZE(upvalueCount) (sizeof(ObjClosure) + (upvalueCount) * sizeof(ObjUpvalue*))
+
 typedef struct {
     Obj obj;
     ObjString* name;
@@ -99,16 +127,32 @@ void printValue(Value value);
 ObjBoundMethod* newBoundMethod(Value receiver, ObjClosure* method);
 ObjClass* newClass(ObjString* name);
 ObjClosure* newClosure(ObjFunction* function);
+ObjBoundMethod* newFrameBoundMethod(Value receiver, ObjClosure* method);
+ObjClosure* newFrameClosure(ObjFunction* function);
 ObjFunction* newFunction();
 ObjInstance* newInstance(ObjClass* klass);
 ObjNative* newNative(NativeFn function);
-ObjString* takeString(char* chars, int length);
+ObjString* makeString(int length);
+ObjString* internString(ObjString* string);
 ObjString* copyString(const char* chars, int length);
+ObjStringBuilder* newStringBuilder();
+char* builderReserve(ObjStringBuilder* builder, int length);
+void builderAppend(ObjStringBuilder* builder, const char* chars, int length);
+ObjString* builderToString(ObjStringBuilder* builder);
 ObjUpvalue* newUpvalue(Value* slot);
-void printObject(Value value);
+void fprintObject(FILE* file, Value value);
 
 static inline bool isObjType(Value value, ObjType type) {
     return IS_OBJ(value) && AS_OBJ(value)->type == type;
 }
 
+static inline bool isOfType(Value value, ValueType type) {
+    switch (type) {
+        case VALUE_NUMBER: return IS_NUMBER(value);
+        case VALUE_STRING: return IS_STRING(value);
+        case VALUE_BOOL:   return IS_BOOL(value);
+        default:           return true;
+    }
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,185 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+#include "optimizer.h"
+
+// * Peephole pass: runs over a finished chunk and cleans up what the
+// * single pass compiler can't see coming.
+
+#define MAX_JUMP_CHAIN 16
+
+// The instruction that a NOT after `instruction` can be folded into, or -1
+static int negatedComparison(uint8_t instruction) {
+    switch (instruction) {
+        case OP_EQUAL:       return OP_NOT_EQUAL;
+        case OP_GREATER:     return OP_NOT_GREATER;
+        case OP_LESS:        return OP_NOT_LESS;
+        case OP_GREATER_NUM: return OP_NOT_GREATER_NUM;
+        case OP_LESS_NUM:    return OP_NOT_LESS_NUM;
+        default:             return -1;
+    }
+}
+
+static bool isPlainPush(uint8_t instruction) {
+    switch (instruction) {
+        case OP_CONSTANT:
+        case OP_NULL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_GET_LOCAL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Dividing by a power of two gives exactly what multiplying by its reciprocal does,
+// and multiplying is the cheaper of the two. Returns the reciprocal's constant or -1.
+static int reciprocalConstant(Chunk* chunk, int constant) {
+    Value value = chunk->constants.values[constant];
+    if (!IS_NUMBER(value)) return -1;
+
+    int exponent;
+    double divisor = AS_NUMBER(value);
+    double reciprocal = 1.0 / divisor;
+    if (frexp(fabs(divisor), &exponent) != 0.5 || !isnormal(reciprocal)) return -1;
+
+    int index = addConstant(chunk, NUMBER_VAL(reciprocal));
+    return index > UINT8_MAX ? -1 : index;
+}
+
+// Returns whether the chunk got any shorter
+bool optimizeChunk(Chunk* chunk) {
+    int count = chunk->count;
+    int* targets = ALLOCATE(int, count);
+    bool* isTarget = ALLOCATE(bool, count + 1);
+    int* newOffsets = ALLOCATE(int, count + 1);
+    int* jumpOrigins = ALLOCATE(int, count);
+    memset(isTarget, 0, sizeof(bool) * (count + 1));
+
+    // Find every jump's destination, following jumps that land on another jump
+    for (int offset = 0; offset < count; offset += instructionLength(chunk, offset)) {
+        uint8_t instruction = chunk->code[offset];
+        if (!isJumpInstruction(instruction)) continue;
+
+        int target = jumpTarget(chunk, offset);
+        if (!isBackwardJump(instruction)) {
+            // Only as far as the jump's 16 bit distance still reaches
+            int next = offset + instructionLength(chunk, offset);
+            for (int hops = 0; hops < MAX_JUMP_CHAIN && target < count && chunk->code[target] == OP_JUMP; hops++) {
+                int further = jumpTarget(chunk, target);
+                if (further - next > UINT16_MAX) break;
+                target = further;
+            }
+        }
+
+        targets[offset] = target;
+        isTarget[target] = true;
+    }
+
+    // Nothing is merged across the edges of a try either
+    for (int i = 0; i < chunk->handlerCount; i++) {
+        isTarget[chunk->handlers[i].start] = true;
+        isTarget[chunk->handlers[i].end] = true;
+        isTarget[chunk->handlers[i].handler] = true;
+    }
+
+    uint8_t* code = ALLOCATE(uint8_t, chunk->capacity);
+    LineTable lines;
+    initLineTable(&lines);
+    int length = 0;
+    int jumpCount = 0;
+    int tableEnd = 0;
+
+    for (int offset = 0; offset < count;) {
+        uint8_t instruction = chunk->code[offset];
+        int size = instructionLength(chunk, offset);
+        int next = offset + size;
+        bool nextIsFree = next < count && !isTarget[next];
+        newOffsets[offset] = length;
+
+        // The jumps after a switch stay put however short, the switch counts them
+        if (instruction == OP_SWITCH) tableEnd = next + 3 * switchJumpCount(chunk, offset);
+
+        // A jump to the very next instruction does nothing
+        if (instruction == OP_JUMP && targets[offset] == next && offset >= tableEnd) {
+            offset = next;
+            continue;
+        }
+
+        // A value pushed only to be popped again
+        if (nextIsFree && chunk->code[next] == OP_POP && isPlainPush(instruction)) {
+            newOffsets[next] = length;
+            offset = next + 1;
+            continue;
+        }
+
+        // EQUAL/GREATER/LESS then NOT becomes a single negated comparison
+        if (nextIsFree && chunk->code[next] == OP_NOT && negatedComparison(instruction) != -1) {
+            newOffsets[next] = length;
+            addLine(&lines, length, getLine(&chunk->lines, offset));
+            code[length++] = (uint8_t)negatedComparison(instruction);
+            offset = next + 1;
+            continue;
+        }
+
+        // x / 4 becomes x * 0.25
+        bool isDivide = nextIsFree && (chunk->code[next] == OP_DIVIDE || chunk->code[next] == OP_DIVIDE_NUM);
+        if (instruction == OP_CONSTANT && isDivide) {
+            int reciprocal = reciprocalConstant(chunk, chunk->code[offset + 1]);
+            if (reciprocal != -1) {
+                newOffsets[next] = length + 2;
+                addLine(&lines, length, getLine(&chunk->lines, offset));
+                code[length++] = OP_CONSTANT;
+                code[length++] = (uint8_t)reciprocal;
+                addLine(&lines, length, getLine(&chunk->lines, next));
+                code[length++] = chunk->code[next] == OP_DIVIDE ? OP_MULTIPLY : OP_MULTIPLY_NUM;
+                offset = next + 1;
+                continue;
+            }
+        }
+
+        // An assignment statement's SET_LOCAL then POP stores and pops in one go
+        if (nextIsFree && instruction == OP_SET_LOCAL && chunk->code[next] == OP_POP) {
+            newOffsets[next] = length;
+            addLine(&lines, length, getLine(&chunk->lines, offset));
+            code[length++] = OP_SET_LOCAL_POP;
+            code[length++] = chunk->code[offset + 1];
+            offset = next + 1;
+            continue;
+        }
+
+        if (isJumpInstruction(instruction)) jumpOrigins[jumpCount++] = offset;
+        memcpy(code + length, chunk->code + offset, size);
+        addLine(&lines, length, getLine(&chunk->lines, offset));
+        length += size;
+        offset = next;
+    }
+    newOffsets[count] = length;
+
+    // Everything moved, so point the jumps at where their targets ended up
+    for (int i = 0; i < jumpCount; i++) {
+        int origin = jumpOrigins[i];
+        setJumpTarget(code, newOffsets[origin], newOffsets[targets[origin]]);
+    }
+    for (int i = 0; i < chunk->handlerCount; i++) {
+        ExceptionHandler* handler = &chunk->handlers[i];
+        handler->start = newOffsets[handler->start];
+        handler->end = newOffsets[handler->end];
+        handler->handler = newOffsets[handler->handler];
+    }
+
+    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+    freeLineTable(&chunk->lines);
+    chunk->code = code;
+    chunk->lines = lines;
+    chunk->count = length;
+
+    FREE_ARRAY(int, targets, count);
+    FREE_ARRAY(bool, isTarget, count + 1);
+    FREE_ARRAY(int, newOffsets, count + 1);
+    FREE_ARRAY(int, jumpOrigins, count);
+    return length < count;
+}
@@ -0,0 +1,8 @@
+#ifndef npp_optimizer_h
+#define npp_optimizer_h
+
+#include "chunk.h"
+
+bool optimizeChunk(Chunk* chunk);
+
+#endif
@@ -0,0 +1,589 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+#include "registers.h"
+
+// * Translates a finished stack chunk into register code.
+// * Stack slot n is register n, so locals keep their slots and temporaries are
+// * allocated by stack depth. Operands are tracked symbolically: GET_LOCAL and
+// * CONSTANT emit nothing, whoever reads them addresses the local or the constant
+// * directly. A function using anything not listed here just keeps its stack code.
+
+typedef struct {
+    bool isConstant;
+    uint8_t index;
+} Operand;
+
+typedef struct {
+    int origin;
+    int target;
+} JumpPatch;
+
+typedef struct {
+    Chunk* chunk;
+    RegisterCode* out;
+    Operand slots[UINT8_COUNT];
+    int depth;
+    int maxDepth;
+    int* depths;
+    bool* isTarget;
+    int* labels;
+    JumpPatch* patches;
+    int patchCount;
+    bool skipNext;
+    bool failed;
+} Translator;
+
+static bool isSupported(uint8_t instruction) {
+    switch (instruction) {
+        case OP_GET_SUPER:
+        case OP_SUPER_INVOKE:
+        case OP_CLOSURE:
+        case OP_FRAME_CLOSURE:
+        case OP_CLOSE_UPVALUE:
+        case OP_CLASS:
+        case OP_INHERIT:
+        case OP_METHOD:
+            return false;
+        default:
+            return true;
+    }
+}
+
+static Operand inRegister(int index) {
+    Operand operand = {false, (uint8_t)index};
+    return operand;
+}
+
+static Operand inConstant(int index) {
+    Operand operand = {true, (uint8_t)index};
+    return operand;
+}
+
+static bool isRegister(Operand operand, int index) {
+    return !operand.isConstant && operand.index == index;
+}
+
+static void emit(Translator* t, int op, int a, Operand b, Operand c, int line) {
+    RegisterCode* out = t->out;
+    if (out->capacity < out->count + 1) {
+        int oldCapacity = out->capacity;
+        out->capacity = GROW_CAPACITY(oldCapacity);
+        out->code = GROW_ARRAY(uint32_t, out->code, oldCapacity, out->capacity);
+    }
+
+    uint32_t instruction = REG_ENCODE(op, a, b.index, c.index);
+    if (b.isConstant) instruction |= REG_CONSTANT_B;
+    if (c.isConstant) instruction |= REG_CONSTANT_C;
+    out->code[out->count] = instruction;
+    addLine(&out->lines, out->count, line);
+    out->count++;
+}
+
+static void push(Translator* t, Operand operand) {
+    if (t->depth == UINT8_COUNT) {
+        t->failed = true;
+        return;
+    }
+
+    t->slots[t->depth++] = operand;
+    if (t->depth > t->maxDepth) t->maxDepth = t->depth;
+}
+
+static Operand pop(Translator* t) {
+    if (t->depth == 0) {
+        t->failed = true;
+        return inRegister(0);
+    }
+    return t->slots[--t->depth];
+}
+
+// Makes slot hold its own value for real
+static void materialize(Translator* t, int slot, int line) {
+    if (isRegister(t->slots[slot], slot)) return;
+    emit(t, REG_MOVE, slot, t->slots[slot], inRegister(0), line);
+    t->slots[slot] = inRegister(slot);
+}
+
+static void flushFrom(Translator* t, int from, int line) {
+    for (int slot = from; slot < t->depth; slot++) {
+        materialize(t, slot, line);
+    }
+}
+
+// Before `local` is overwritten, anything still reading it lazily gets a copy
+static void flushAliases(Translator* t, int local, int below, int line) {
+    for (int slot = 0; slot < below; slot++) {
+        if (slot != local && isRegister(t->slots[slot], local)) {
+            materialize(t, slot, line);
+        }
+    }
+}
+
+static void store(Translator* t, int local, Operand value, int line) {
+    if (!isRegister(value, local)) {
+        emit(t, REG_MOVE, local, value, inRegister(0), line);
+    }
+    t->slots[local] = inRegister(local);
+}
+
+static Operand literal(Translator* t, Value value) {
+    int constant = addConstant(t->chunk, value);
+    if (constant > UINT8_MAX) t->failed = true;
+    return inConstant(constant);
+}
+
+// Instructions that need a real register (receivers, conditions) can't take a constant
+static int registerFor(Translator* t, Operand operand, int slot, int line) {
+    if (!operand.isConstant) return operand.index;
+    emit(t, REG_MOVE, slot, operand, inRegister(0), line);
+    return slot;
+}
+
+// Where a fresh result goes. One that is stored straight into a local by the next
+// instruction is written there directly, which turns `i = i + 1` into one ADD.
+static int resultRegister(Translator* t, int next, int line) {
+    Chunk* chunk = t->chunk;
+    if (next < chunk->count && !t->isTarget[next] && chunk->code[next] == OP_SET_LOCAL_POP) {
+        int local = chunk->code[next + 1];
+        flushAliases(t, local, t->depth, line);
+        t->skipNext = true;
+        return local;
+    }
+    return t->depth;
+}
+
+static void pushResult(Translator* t, int result) {
+    if (t->skipNext) {
+        t->slots[result] = inRegister(result);
+    } else {
+        push(t, inRegister(result));
+    }
+}
+
+static void jumpTo(Translator* t, int op, int a, int target, int line) {
+    if (t->depths[target] == -1) {
+        t->depths[target] = t->depth;
+    } else if (t->depths[target] != t->depth) {
+        t->failed = true;
+    }
+
+    JumpPatch* patch = &t->patches[t->patchCount++];
+    patch->origin = t->out->count;
+    patch->target = target;
+    emit(t, op, a, inRegister(0), inRegister(0), line);
+}
+
+static void binary(Translator* t, int op, int next, int line) {
+    Operand right = pop(t);
+    Operand left = pop(t);
+    int result = resultRegister(t, next, line);
+    emit(t, op, result, left, right, line);
+    pushResult(t, result);
+}
+
+static void unary(Translator* t, int op, int next, int line) {
+    Operand operand = pop(t);
+    int result = resultRegister(t, next, line);
+    emit(t, op, result, operand, inRegister(0), line);
+    pushResult(t, result);
+}
+
+static int comparisonFor(uint8_t instruction) {
+    switch (instruction) {
+        case OP_LESS:        return REG_LESS;
+        case OP_NOT_GREATER: return REG_NOT_GREATER;
+        case OP_GREATER:     return REG_GREATER;
+        default:             return REG_NOT_LESS;
+    }
+}
+
+static void translateInstruction(Translator* t, int offset, int next, bool* reachable) {
+    Chunk* chunk = t->chunk;
+    uint8_t* code = chunk->code;
+    int line = getLine(&chunk->lines, offset);
+
+    switch (code[offset]) {
+        case OP_CONSTANT: push(t, inConstant(code[offset + 1])); break;
+        case OP_NULL: push(t, literal(t, NULL_VAL)); break;
+        case OP_TRUE: push(t, literal(t, BOOL_VAL(true))); break;
+        case OP_FALSE: push(t, literal(t, BOOL_VAL(false))); break;
+        case OP_POP: pop(t); break;
+        case OP_RELEASE: emit(t, REG_RELEASE, 0, pop(t), inRegister(0), line); break;
+        case OP_GET_LOCAL: push(t, t->slots[code[offset + 1]]); break;
+        case OP_SET_LOCAL: {
+            int local = code[offset + 1];
+            Operand value = t->slots[t->depth - 1];
+            flushAliases(t, local, t->depth - 1, line);
+            store(t, local, value, line);
+            break;
+        }
+        case OP_SET_LOCAL_POP: {
+            int local = code[offset + 1];
+            Operand value = pop(t);
+            flushAliases(t, local, t->depth, line);
+            store(t, local, value, line);
+            break;
+        }
+        case OP_GET_GLOBAL: {
+            int result = resultRegister(t, next, line);
+            emit(t, REG_GET_GLOBAL, result, inRegister(code[offset + 1]), inRegister(0), line);
+            pushResult(t, result);
+            break;
+        }
+        case OP_DEFINE_GLOBAL:
+            emit(t, REG_DEFINE_GLOBAL, code[offset + 2], pop(t), inRegister(code[offset + 1]), line);
+            break;
+        case OP_SET_GLOBAL:
+            emit(t, REG_SET_GLOBAL, 0, t->slots[t->depth - 1], inRegister(code[offset + 1]), line);
+            break;
+        case OP_GET_UPVALUE: {
+            int result = resultRegister(t, next, line);
+            emit(t, REG_GET_UPVALUE, result, inRegister(code[offset + 1]), inRegister(0), line);
+            pushResult(t, result);
+            break;
+        }
+        case OP_SET_UPVALUE:
+            emit(t, REG_SET_UPVALUE, 0, t->slots[t->depth - 1], inRegister(code[offset + 1]), line);
+            break;
+        case OP_GET_PROPERTY:
+        case OP_FRAME_PROPERTY: {
+            RegisterOp op = code[offset] == OP_GET_PROPERTY ? REG_GET_PROPERTY : REG_FRAME_PROPERTY;
+            Operand object = pop(t);
+            int instance = registerFor(t, object, t->depth, line);
+            int result = resultRegister(t, next, line);
+            emit(t, op, result, inRegister(instance), inRegister(code[offset + 1]), line);
+            pushResult(t, result);
+            break;
+        }
+        case OP_SET_PROPERTY: {
+            Operand value = pop(t);
+            Operand object = pop(t);
+            int instance = registerFor(t, object, t->depth, line);
+            emit(t, REG_SET_PROPERTY, instance, value, inRegister(code[offset + 1]), line);
+            push(t, value);
+            if (!value.isConstant && value.index >= t->depth) materialize(t, t->depth - 1, line);
+            break;
+        }
+        case OP_EQUAL:       binary(t, REG_EQUAL, next, line); break;
+        case OP_NOT_EQUAL:   binary(t, REG_NOT_EQUAL, next, line); break;
+        case OP_GREATER:     binary(t, REG_GREATER, next, line); break;
+        case OP_NOT_GREATER: binary(t, REG_NOT_GREATER, next, line); break;
+        case OP_LESS:        binary(t, REG_LESS, next, line); break;
+        case OP_NOT_LESS:    binary(t, REG_NOT_LESS, next, line); break;
+        case OP_ADD:         binary(t, REG_ADD, next, line); break;
+        case OP_SUBTRACT:    binary(t, REG_SUBTRACT, next, line); break;
+        case OP_MULTIPLY:    binary(t, REG_MULTIPLY, next, line); break;
+        case OP_DIVIDE:      binary(t, REG_DIVIDE, next, line); break;
+        case OP_MODULO:      binary(t, REG_MODULO, next, line); break;
+        case OP_INT_DIVIDE:  binary(t, REG_INT_DIVIDE, next, line); break;
+        case OP_BIT_AND:     binary(t, REG_BIT_AND, next, line); break;
+        case OP_BIT_OR:      binary(t, REG_BIT_OR, next, line); break;
+        case OP_BIT_XOR:     binary(t, REG_BIT_XOR, next, line); break;
+        case OP_SHIFT_LEFT:  binary(t, REG_SHIFT_LEFT, next, line); break;
+        case OP_SHIFT_RIGHT: binary(t, REG_SHIFT_RIGHT, next, line); break;
+        case OP_GREATER_NUM:     binary(t, REG_GREATER_NUM, next, line); break;
+        case OP_NOT_GREATER_NUM: binary(t, REG_NOT_GREATER_NUM, next, line); break;
+        case OP_LESS_NUM:        binary(t, REG_LESS_NUM, next, line); break;
+        case OP_NOT_LESS_NUM:    binary(t, REG_NOT_LESS_NUM, next, line); break;
+        case OP_ADD_NUM:         binary(t, REG_ADD_NUM, next, line); break;
+        case OP_SUBTRACT_NUM:    binary(t, REG_SUBTRACT_NUM, next, line); break;
+        case OP_MULTIPLY_NUM:    binary(t, REG_MULTIPLY_NUM, next, line); break;
+        case OP_DIVIDE_NUM:      binary(t, REG_DIVIDE_NUM, next, line); break;
+        case OP_NOT:         unary(t, REG_NOT, next, line); break;
+        case OP_NEGATE:      unary(t, REG_NEGATE, next, line); break;
+        case OP_BIT_NOT:     unary(t, REG_BIT_NOT, next, line); break;
+        case OP_CHECK_TYPE:
+            emit(t, REG_CHECK_TYPE, code[offset + 1], t->slots[t->depth - 1], inRegister(0), line);
+            break;
+        case OP_CONCAT_N: {
+            int count = code[offset + 1];
+            int base = t->depth - count;
+            flushFrom(t, base, line);
+            t->depth = base;
+            int result = resultRegister(t, next, line);
+            emit(t, REG_CONCAT, result, inRegister(base), inRegister(count), line);
+            pushResult(t, result);
+            break;
+        }
+        case OP_SWITCH: {
+            // Nothing may be left to flush, every jump that follows has to be a single REG_JUMP
+            int value = registerFor(t, pop(t), t->depth, line);
+            flushFrom(t, 0, line);
+            emit(t, REG_SWITCH, value, inRegister(code[offset + 1]), inRegister(0), line);
+            break;
+        }
+        case OP_JUMP:
+        case OP_LOOP:
+            flushFrom(t, 0, line);
+            jumpTo(t, code[offset] == OP_LOOP ? REG_LOOP : REG_JUMP, 0, jumpTarget(chunk, offset), line);
+            *reachable = false;
+            break;
+        case OP_JUMP_IF_FALSE: {
+            int target = jumpTarget(chunk, offset);
+
+            // Both ways out usually pop the condition, so it never has to land in its slot
+            bool isDead = code[next] == OP_POP && code[target] == OP_POP;
+            if (isDead) {
+                t->depth--;
+                flushFrom(t, 0, line);
+                t->depth++;
+            } else {
+                flushFrom(t, 0, line);
+            }
+
+            Operand condition = t->slots[t->depth - 1];
+            if (condition.isConstant) {
+                if (isFalsey(chunk->constants.values[condition.index])) {
+                    jumpTo(t, REG_JUMP, 0, target, line);
+                    *reachable = false;
+                } else if (t->depths[target] == -1) {
+                    t->depths[target] = t->depth;
+                }
+                break;
+            }
+
+            jumpTo(t, REG_JUMP_IF_FALSE, condition.index, target, line);
+            break;
+        }
+        case OP_CALL:
+        case OP_TAIL_CALL: {
+            int argCount = code[offset + 1];
+            int base = t->depth - argCount - 1;
+            flushFrom(t, base, line);
+            emit(t, code[offset] == OP_CALL ? REG_CALL : REG_TAIL_CALL, base, inRegister(argCount), inRegister(0), line);
+            t->depth = base;
+            push(t, inRegister(base));
+            break;
+        }
+        case OP_INVOKE: {
+            int argCount = code[offset + 2];
+            int base = t->depth - argCount - 1;
+            flushFrom(t, base, line);
+            emit(t, REG_INVOKE, base, inRegister(argCount), inRegister(code[offset + 1]), line);
+            t->depth = base;
+            push(t, inRegister(base));
+            break;
+        }
+        case OP_MATH: {
+            // The callee's slot is only written, its placeholder never needs a register
+            int argCount = code[offset + 2];
+            int base = t->depth - argCount - 1;
+            flushFrom(t, base + 1, line);
+            emit(t, REG_MATH, base, inRegister(argCount), inRegister(code[offset + 1]), line);
+            t->depth = base;
+            push(t, inRegister(base));
+            break;
+        }
+        case OP_FOR_STEP: {
+            int counter = code[offset + 1];
+            Operand step = inConstant(code[offset + 2]);
+            int arithmetic = code[offset + 3] == OP_ADD ? REG_ADD : REG_SUBTRACT;
+            int target = jumpTarget(chunk, offset);
+            flushFrom(t, 0, line);
+
+            if (code[offset + 5] != OP_GET_GLOBAL) {
+                Operand bound = code[offset + 5] == OP_GET_LOCAL ? inRegister(code[offset + 6]) : inConstant(code[offset + 6]);
+                emit(t, REG_FOR_STEP, counter, bound, step, line);
+                jumpTo(t, arithmetic, code[offset + 4], target, line);
+                break;
+            }
+
+            // A global bound has to be looked up after the step, so it is spelled out
+            int scratch = t->depth;
+            push(t, inRegister(scratch));
+            pop(t);
+            emit(t, arithmetic, counter, inRegister(counter), step, line);
+            emit(t, REG_GET_GLOBAL, scratch, inRegister(code[offset + 6]), inRegister(0), line);
+            emit(t, comparisonFor(code[offset + 4]), scratch, inRegister(counter), inRegister(scratch), line);
+            jumpTo(t, REG_JUMP_IF_FALSE, scratch, next, line);
+            jumpTo(t, REG_LOOP, 0, target, line);
+            break;
+        }
+        case OP_MEMO:
+            flushFrom(t, 0, line);
+            jumpTo(t, REG_MEMO, code[offset + 1], jumpTarget(chunk, offset), line);
+            break;
+        case OP_MEMO_STORE: {
+            int slot = code[offset + 1];
+            Operand value = pop(t);
+            flushAliases(t, slot, t->depth, line);
+            emit(t, REG_MEMO_STORE, slot, value, inRegister(code[offset + 2]), line);
+            t->slots[slot] = inRegister(slot);
+            break;
+        }
+        case OP_CALL_INLINED:
+        case OP_INVOKE_INLINED: {
+            bool isCall = code[offset] == OP_CALL_INLINED;
+            int argCount = code[offset + (isCall ? 1 : 2)];
+            int expected = code[offset + (isCall ? 2 : 3)];
+            int base = t->depth - argCount - 1;
+            flushFrom(t, 0, line);
+            if (isCall) {
+                emit(t, REG_CALL_INLINED, base, inRegister(argCount), inRegister(expected), line);
+            } else {
+                emit(t, REG_INVOKE_INLINED, base, inRegister(argCount), inRegister(code[offset + 1]), line);
+                emit(t, REG_MOVE, expected, inRegister(0), inRegister(0), line);
+            }
+
+            // The real call leaves its result in base, right where the inlined copy leaves its own
+            int depth = t->depth;
+            t->depth = base + 1;
+            jumpTo(t, REG_JUMP, 0, jumpTarget(chunk, offset), line);
+            t->depth = depth;
+            break;
+        }
+        case OP_INLINE_RETURN: {
+            int base = code[offset + 1];
+            Operand value = pop(t);
+            t->depth = base;
+            store(t, base, value, line);
+            t->depth = base + 1;
+            flushFrom(t, 0, line);
+            jumpTo(t, REG_JUMP, 0, jumpTarget(chunk, offset), line);
+            *reachable = false;
+            break;
+        }
+        case OP_RETURN:
+            emit(t, REG_RETURN, 0, pop(t), inRegister(0), line);
+            *reachable = false;
+            break;
+        case OP_THROW:
+            emit(t, REG_THROW, 0, pop(t), inRegister(0), line);
+            *reachable = false;
+            break;
+        default:
+            t->failed = true;
+            break;
+    }
+}
+
+static void translate(Translator* t, int arity) {
+    Chunk* chunk = t->chunk;
+    bool reachable = true;
+
+    for (int slot = 0; slot <= arity; slot++) {
+        push(t, inRegister(slot));
+    }
+
+    for (int offset = 0; offset < chunk->count && !t->failed;) {
+        int next = offset + instructionLength(chunk, offset);
+
+        if (t->isTarget[offset]) {
+            if (reachable) {
+                flushFrom(t, 0, getLine(&chunk->lines, offset));
+                if (t->depths[offset] == -1) t->depths[offset] = t->depth;
+                if (t->depths[offset] != t->depth) t->failed = true;
+            } else if (t->depths[offset] != -1) {
+                t->depth = t->depths[offset];
+            }
+
+            for (int slot = 0; slot < t->depth; slot++) {
+                t->slots[slot] = inRegister(slot);
+            }
+            reachable = true;
+        }
+
+        t->labels[offset] = t->out->count;
+        if (t->skipNext) {
+            t->skipNext = false;
+        } else {
+            translateInstruction(t, offset, next, &reachable);
+        }
+        offset = next;
+    }
+    t->labels[chunk->count] = t->out->count;
+
+    for (int i = 0; i < t->patchCount && !t->failed; i++) {
+        JumpPatch* patch = &t->patches[i];
+        int jump = t->labels[patch->target] - (patch->origin + 1);
+        if (jump < INT16_MIN || jump > INT16_MAX) {
+            t->failed = true;
+            break;
+        }
+        t->out->code[patch->origin] |= (uint32_t)(uint16_t)jump << 16;
+    }
+}
+
+void translateToRegisters(ObjFunction* function) {
+    Chunk* chunk = &function->chunk;
+    int count = chunk->count;
+    int jumpCount = 0;
+
+    // Inlined functions are reached again through their guard constants, once is enough
+    if (function->registers != NULL) return;
+
+    // Unwinding only knows the stack layout of a try, so functions with one stay on the stack VM
+    if (chunk->handlerCount > 0) return;
+
+    for (int offset = 0; offset < count; offset += instructionLength(chunk, offset)) {
+        if (!isSupported(chunk->code[offset])) return;
+
+        // A FOR_STEP with a global bound turns into two jumps
+        if (isJumpInstruction(chunk->code[offset])) jumpCount += chunk->code[offset] == OP_FOR_STEP ? 2 : 1;
+    }
+
+    RegisterCode* out = ALLOCATE(RegisterCode, 1);
+    out->count = 0;
+    out->capacity = 0;
+    out->code = NULL;
+    initLineTable(&out->lines);
+    out->frameSize = 0;
+    out->inlinedCalls = NULL;
+    out->inlinedCount = 0;
+
+    Translator t;
+    t.chunk = chunk;
+    t.out = out;
+    t.depth = 0;
+    t.maxDepth = 0;
+    t.depths = ALLOCATE(int, count + 1);
+    t.isTarget = ALLOCATE(bool, count + 1);
+    t.labels = ALLOCATE(int, count + 1);
+    t.patches = ALLOCATE(JumpPatch, jumpCount + 1);
+    t.patchCount = 0;
+    t.skipNext = false;
+    t.failed = false;
+
+    memset(t.isTarget, 0, sizeof(bool) * (count + 1));
+    for (int offset = 0; offset <= count; offset++) {
+        t.depths[offset] = -1;
+    }
+    for (int offset = 0; offset < count; offset += instructionLength(chunk, offset)) {
+        if (isJumpInstruction(chunk->code[offset])) {
+            t.isTarget[jumpTarget(chunk, offset)] = true;
+        }
+    }
+
+    translate(&t, function->arity);
+    out->frameSize = t.maxDepth;
+
+    if (!t.failed && chunk->inlinedCount > 0) {
+        out->inlinedCalls = ALLOCATE(InlinedCall, chunk->inlinedCount);
+        out->inlinedCount = chunk->inlinedCount;
+        for (int i = 0; i < chunk->inlinedCount; i++) {
+            out->inlinedCalls[i] = chunk->inlinedCalls[i];
+            out->inlinedCalls[i].start = t.labels[chunk->inlinedCalls[i].start];
+            out->inlinedCalls[i].end = t.labels[chunk->inlinedCalls[i].end];
+        }
+    }
+
+    FREE_ARRAY(int, t.depths, count + 1);
+    FREE_ARRAY(bool, t.isTarget, count + 1);
+    FREE_ARRAY(int, t.labels, count + 1);
+    FREE_ARRAY(JumpPatch, t.patches, jumpCount + 1);
+
+    if (t.failed) {
+        freeRegisterCode(out);
+        return;
+    }
+    function->registers = out;
+}
+
+void freeRegisterCode(RegisterCode* registers) {
+    FREE_ARRAY(uint32_t, registers->code, registers->capacity);
+    freeLineTable(&registers->lines);
+    FREE_ARRAY(InlinedCall, registers->inlinedCalls, registers->inlinedCount);
+    FREE(RegisterCode, registers);
+}
@@ -0,0 +1,95 @@
+#ifndef npp_registers_h
+#define npp_registers_h
+
+#include "common.h"
+#include "object.h"
+
+// * Register code: the second instruction format, run with `-r`.
+// * Every instruction is 32 bits: | C:8 | B:8 | A:8 | kC:1 kB:1 op:6 |
+// * A frame's registers are its stack slots, so locals are just registers.
+// * An operand with its k bit set reads the constant pool instead of a register.
+
+typedef enum {
+    REG_MOVE,          // R[A] = RK(B)
+    REG_GET_GLOBAL,    // R[A] = globals[K[B]]
+    REG_DEFINE_GLOBAL, // globals[K[C]] = RK(B), declared as ValueType A
+    REG_SET_GLOBAL,    // globals[K[C]] = RK(B), must already exist
+    REG_GET_UPVALUE,   // R[A] = upvalues[B]
+    REG_SET_UPVALUE,   // upvalues[C] = RK(B)
+    REG_GET_PROPERTY,  // R[A] = R[B].K[C]
+    REG_FRAME_PROPERTY, // REG_GET_PROPERTY, binding a method in the frame's scratch space
+    REG_SET_PROPERTY,  // R[A].K[C] = RK(B)
+    REG_EQUAL,         // R[A] = RK(B) == RK(C), and so on
+    REG_NOT_EQUAL,
+    REG_GREATER,
+    REG_NOT_GREATER,
+    REG_LESS,
+    REG_NOT_LESS,
+    REG_ADD,
+    REG_SUBTRACT,
+    REG_MULTIPLY,
+    REG_DIVIDE,
+    REG_MODULO,
+    REG_INT_DIVIDE,
+    REG_BIT_AND,
+    REG_BIT_OR,
+    REG_BIT_XOR,
+    REG_SHIFT_LEFT,
+    REG_SHIFT_RIGHT,
+    REG_GREATER_NUM,   // the comparisons and arithmetic again, for operands known to be numbers
+    REG_NOT_GREATER_NUM,
+    REG_LESS_NUM,
+    REG_NOT_LESS_NUM,
+    REG_ADD_NUM,
+    REG_SUBTRACT_NUM,
+    REG_MULTIPLY_NUM,
+    REG_DIVIDE_NUM,
+    REG_CONCAT,        // R[A] = R[B] + ... + R[B + C - 1]
+    REG_NOT,           // R[A] = !RK(B)
+    REG_NEGATE,        // R[A] = -RK(B)
+    REG_BIT_NOT,       // R[A] = ~RK(B)
+    REG_CHECK_TYPE,    // fails unless RK(B) is of ValueType A
+    REG_JUMP,          // ip += sBx
+    REG_LOOP,          // ip += sBx backwards, after a fuel check
+    REG_JUMP_IF_FALSE, // if R[A] is falsey, ip += sBx
+    REG_SWITCH,        // takes the REG_JUMP that switches[B] picks for R[A] out of those that follow
+    REG_FOR_STEP,      // R[A] = R[A] op RK(C), then ip += the next word's sBx while R[A] cmp RK(B),
+                       // op (REG_ADD/REG_SUBTRACT) is the next word's and cmp (an OP_ comparison) its A
+    REG_MEMO,          // if R[A + 1] says R[A] is still good, ip += sBx
+    REG_MEMO_STORE,    // R[A] = RK(B), stamped in R[A + 1] (C: reads only constants and locals)
+    REG_CALL,          // R[A] = R[A](R[A + 1], ..., R[A + B])
+    REG_INVOKE,        // R[A] = R[A].K[C](R[A + 1], ..., R[A + B])
+    REG_MATH,          // R[A] = globals[K[C]](R[A + 1], ..., R[A + B]), run in place while it's the math native
+    REG_CALL_INLINED,  // R[A] is the closure of K[C]? skip the JUMP that follows : REG_CALL
+    REG_INVOKE_INLINED, // same for REG_INVOKE, the next word's A holds the function
+    REG_RELEASE,       // gives back RK(B)'s scratch space if it has any
+    REG_TAIL_CALL,     // REG_CALL reusing the current frame, a REG_RETURN of R[A] follows
+    REG_RETURN,        // return RK(B)
+    REG_THROW          // raise RK(B)
+} RegisterOp;
+
+#define REG_CONSTANT_B 0x40
+#define REG_CONSTANT_C 0x80
+
+#define REG_ENCODE(op, a, b, c) \
+    ((uint32_t)(op) | ((uint32_t)(a) << 8) | ((uint32_t)(b) << 16) | ((uint32_t)(c) << 24))
+#define REG_OP(i)   ((i) & 0x3f)
+#define REG_A(i)    (((i) >> 8) & 0xff)
+#define REG_B(i)    (((i) >> 16) & 0xff)
+#define REG_C(i)    ((i) >> 24)
+#define REG_SBX(i)  ((int16_t)((i) >> 16))
+
+typedef struct RegisterCode {
+    int count;
+    int capacity;
+    uint32_t* code;
+    LineTable lines;
+    int frameSize;
+    InlinedCall* inlinedCalls; // the chunk's, moved over to register offsets
+    int inlinedCount;
+} RegisterCode;
+
+void translateToRegisters(ObjFunction* function);
+void freeRegisterCode(RegisterCode* registers);
+
+#endif
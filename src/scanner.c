@@ -13,9 +13,14 @@ typedef struct {
 Scanner scanner;
 
 void initScanner(const char* source) {
+    initScannerAt(source, 1);
+}
+
+// Resumes scanning partway into a source, for bodies compiled after the rest
+void initScannerAt(const char* source, int line) {
     scanner.start = source;
     scanner.current = source;
-    scanner.line = 1;
+    scanner.line = line;
 }
 
 static inline bool isAlpha(char c) {
@@ -107,7 +112,18 @@ static inline TokenType checkKeyword(int start, int length, const char* rest, To
 static inline TokenType identifierType() {
     switch (scanner.start[0]) {
         case 'a': return checkKeyword(1, 2, "nd", TOKEN_AND);
-        case 'c': return checkKeyword(1, 4, "lass", TOKEN_CLASS);
+        case 'b': return checkKeyword(1, 3, "ool", TOKEN_BOOL);
+        case 'c':
+            if (scanner.current - scanner.start > 1) {
+                switch (scanner.start[1]) {
+                    case 'a':
+                        if (scanner.current - scanner.start > 4) return checkKeyword(2, 3, "tch", TOKEN_CATCH);
+                        return checkKeyword(2, 2, "se", TOKEN_CASE);
+                    case 'l': return checkKeyword(2, 3, "ass", TOKEN_CLASS);
+                    case 'o': return checkKeyword(2, 3, "nst", TOKEN_CONST);
+                }
+            }
+            break;
         case 'e': return checkKeyword(1, 3, "lse", TOKEN_ELSE);
         case 'f':
             if (scanner.current - scanner.start > 1) {
@@ -125,20 +141,47 @@ static inline TokenType identifierType() {
                 }
             }
             break;
-        case 'n': return checkKeyword(1, 3, "ull", TOKEN_NULL);
+        case 'n':
+            if (scanner.current - scanner.start > 2 && scanner.start[1] == 'u') {
+                switch (scanner.start[2]) {
+                    case 'l': return checkKeyword(3, 1, "l", TOKEN_NULL);
+                    case 'm': return checkKeyword(3, 0, "", TOKEN_NUM);
+                }
+            }
+            break;
         case 'o': return checkKeyword(1, 1, "r", TOKEN_OR);
         case 'r': return checkKeyword(1, 5, "eturn", TOKEN_RETURN);
-        case 's': return checkKeyword(1, 4, "uper", TOKEN_SUPER);
+        case 's':
+            if (scanner.current - scanner.start > 1) {
+                switch (scanner.start[1]) {
+                    case 't': return checkKeyword(2, 1, "r", TOKEN_STR);
+                    case 'u': return checkKeyword(2, 3, "per", TOKEN_SUPER);
+                    case 'w': return checkKeyword(2, 4, "itch", TOKEN_SWITCH);
+                }
+            }
+            break;
         case 't':
             if (scanner.current - scanner.start > 1) {
                 switch (scanner.start[1]) {
-                    case 'h': return checkKeyword(2, 2, "is", TOKEN_THIS);
-                    case 'r': return checkKeyword(2, 2, "ue", TOKEN_TRUE);
+                    case 'h':
+                        if (scanner.current - scanner.start > 4) return checkKeyword(2, 3, "row", TOKEN_THROW);
+                        return checkKeyword(2, 2, "is", TOKEN_THIS);
+                    case 'r':
+                        if (scanner.current - scanner.start > 3) return checkKeyword(2, 2, "ue", TOKEN_TRUE);
+                        return checkKeyword(2, 1, "y", TOKEN_TRY);
                 }
             }
             break;
         case 'w': return checkKeyword(1, 4, "hile", TOKEN_WHILE);
-        case 'd': return checkKeyword(1, 2, "ef", TOKEN_FUN);
+        case 'd':
+            if (scanner.current - scanner.start > 1) {
+                switch (scanner.start[1]) {
+                    case 'e':
+                        if (scanner.current - scanner.start > 3) return checkKeyword(2, 5, "fault", TOKEN_DEFAULT);
+                        return checkKeyword(2, 1, "f", TOKEN_FUN);
+                }
+            }
+            break;
     }
 
     return TOKEN_IDENTIFIER;
@@ -160,8 +203,10 @@ static Token number() {
     return makeToken(TOKEN_NUMBER);
 }
 
+// Escapes are decoded by the compiler, the scanner only has to step over them
 static Token string() {
     while (peek() != '"' && !isAtEnd()) {
+        if (peek() == '\\' && peekNext() != '\0') advance();
         if (peek() == '\n') scanner.line++;
         advance();
     }
@@ -190,6 +235,8 @@ Token scanToken() {
         return makeToken(TOKEN_RIGHT_BRACE);
     } else if (c == ';') {
         return makeToken(TOKEN_SEMICOLON);
+    } else if (c == ':') {
+        return makeToken(TOKEN_COLON);
     } else if (c == ',') {
         return makeToken(TOKEN_COMMA);
     } else if (c == '.') {
@@ -202,13 +249,25 @@ Token scanToken() {
         return makeToken(TOKEN_SLASH);
     } else if (c == '*') {
         return makeToken(TOKEN_STAR);
+    } else if (c == '%') {
+        return makeToken(TOKEN_PERCENT);
+    } else if (c == '&') {
+        return makeToken(TOKEN_AMPERSAND);
+    } else if (c == '|') {
+        return makeToken(TOKEN_PIPE);
+    } else if (c == '^') {
+        return makeToken(TOKEN_CARET);
+    } else if (c == '~') {
+        return makeToken(match('/') ? TOKEN_TILDE_SLASH : TOKEN_TILDE);
     } else if (c == '!') {
         return makeToken(match('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
     } else if (c == '=') {
         return makeToken(match('=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
     } else if (c == '<') {
+        if (match('<')) return makeToken(TOKEN_LESS_LESS);
         return makeToken(match('=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
     } else if (c == '>') {
+        if (match('>')) return makeToken(TOKEN_GREATER_GREATER);
         return makeToken(match('=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
     } else if (c == '"') {
         return string();
@@ -6,19 +6,21 @@ typedef enum {
     TOKEN_LEFT_PAREN, TOKEN_RIGHT_PAREN,
     TOKEN_LEFT_BRACE, TOKEN_RIGHT_BRACE,
     TOKEN_COMMA, TOKEN_DOT, TOKEN_MINUS, TOKEN_PLUS,
-    TOKEN_SEMICOLON, TOKEN_SLASH, TOKEN_STAR,
+    TOKEN_SEMICOLON, TOKEN_COLON, TOKEN_SLASH, TOKEN_STAR,
+    TOKEN_PERCENT, TOKEN_AMPERSAND, TOKEN_PIPE, TOKEN_CARET,
     
     TOKEN_BANG, TOKEN_BANG_EQUAL,
     TOKEN_EQUAL, TOKEN_EQUAL_EQUAL,
-    TOKEN_GREATER, TOKEN_GREATER_EQUAL,
-    TOKEN_LESS, TOKEN_LESS_EQUAL,
+    TOKEN_GREATER, TOKEN_GREATER_EQUAL, TOKEN_GREATER_GREATER,
+    TOKEN_LESS, TOKEN_LESS_EQUAL, TOKEN_LESS_LESS,
+    TOKEN_TILDE, TOKEN_TILDE_SLASH,
 
     TOKEN_IDENTIFIER, TOKEN_STRING, TOKEN_NUMBER,
 
-    TOKEN_AND, TOKEN_CLASS, TOKEN_ELSE, TOKEN_FALSE,
-    TOKEN_FOR, TOKEN_FUN, TOKEN_IF, TOKEN_NULL, TOKEN_OR,
-    TOKEN_RETURN, TOKEN_SUPER, TOKEN_THIS, TOKEN_TRUE,
-    TOKEN_VAR, TOKEN_WHILE,
+    TOKEN_AND, TOKEN_BOOL, TOKEN_CASE, TOKEN_CATCH, TOKEN_CLASS, TOKEN_CONST, TOKEN_DEFAULT, TOKEN_ELSE, TOKEN_FALSE,
+    TOKEN_FOR, TOKEN_FUN, TOKEN_IF, TOKEN_NULL, TOKEN_NUM, TOKEN_OR,
+    TOKEN_RETURN, TOKEN_STR, TOKEN_SUPER, TOKEN_SWITCH, TOKEN_THIS, TOKEN_THROW, TOKEN_TRUE,
+    TOKEN_TRY, TOKEN_VAR, TOKEN_WHILE,
 
     TOKEN_ERROR, TOKEN_EOF
 } TokenType;
@@ -31,6 +33,7 @@ typedef struct {
 } Token;
 
 void initScanner(const char* source);
+void initScannerAt(const char* source, int line);
 Token scanToken();
 
 #endif
\ No newline at end of file
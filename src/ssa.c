@@ -0,0 +1,976 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+#include "optimizer.h"
+#include "ssa.h"
+
+// * The optimizing tier (-O).
+// * A function's finished chunk is split into basic blocks and every stack slot
+// * (locals included, they live on the stack) becomes an SSA value. Each block
+// * starts with a phi per slot and the trivial ones fold away, which is also what
+// * propagates copies made through GET_LOCAL/SET_LOCAL. Sparse conditional
+// * constant propagation and value numbering run over that graph, then it is
+// * lowered back into the chunk: code computing a constant, a value some slot
+// * already holds, or nothing anybody uses is replaced or dropped, and blocks
+// * that can never run disappear.
+
+#define MAX_SIMULATED_STACK 512
+
+typedef enum {
+    LATTICE_TOP,      // nothing known yet
+    LATTICE_CONSTANT,
+    LATTICE_BOTTOM    // varies at runtime
+} Lattice;
+
+typedef enum {
+    IR_ENTRY,    // what a slot holds when the function is called
+    IR_PHI,
+    IR_CONSTANT,
+    IR_UNARY,
+    IR_BINARY,
+    IR_OPAQUE    // globals, calls, properties... anything that isn't modelled
+} IrKind;
+
+typedef struct {
+    IrKind kind;
+    uint8_t opcode;
+    int block;
+    int slot;
+    int operands[2];
+    int replacement;
+    Lattice lattice;
+    Value constant;
+    int number;
+} IrValue;
+
+typedef struct {
+    int start;
+    int end;
+    int last;
+    int depth;
+    int firstValue;
+    int lastValue;
+    int exitBase;
+    int firstPredecessor;
+    int predecessorCount;
+    int successors[2];
+    bool edgeExecutable[2];
+    int successorCount;
+    bool executable;
+    int condition;
+} IrBlock;
+
+// A stretch of the original code and what replaces it
+typedef struct {
+    int start;
+    int end;
+    int length;
+    uint8_t bytes[3];
+    bool isJump;
+    int target;
+} Edit;
+
+// A value sitting on the stack, and the code that put it there if that's one contiguous piece
+typedef struct {
+    int value;
+    int start;
+    int end;
+    bool pure;
+    bool safe;
+} Occurrence;
+
+typedef struct {
+    Chunk* chunk;
+    IrValue* values;
+    int valueCount;
+    int valueCapacity;
+    IrBlock* blocks;
+    int blockCount;
+    int* blockAt;
+    int* produced;
+    int* exits;
+    int exitCount;
+    int exitCapacity;
+    int* predecessors;
+    int predecessorCount;
+    int entryCount;
+    Edit* edits;
+    int editCount;
+    int editCapacity;
+    bool failed;
+} Ir;
+
+static int newValue(Ir* ir, IrKind kind, uint8_t opcode, int block) {
+    if (ir->valueCapacity < ir->valueCount + 1) {
+        int oldCapacity = ir->valueCapacity;
+        ir->valueCapacity = GROW_CAPACITY(oldCapacity);
+        ir->values = GROW_ARRAY(IrValue, ir->values, oldCapacity, ir->valueCapacity);
+    }
+
+    int index = ir->valueCount++;
+    IrValue* value = &ir->values[index];
+    value->kind = kind;
+    value->opcode = opcode;
+    value->block = block;
+    value->slot = -1;
+    value->operands[0] = -1;
+    value->operands[1] = -1;
+    value->replacement = index;
+    value->lattice = LATTICE_TOP;
+    value->constant = NULL_VAL;
+    value->number = index;
+    return index;
+}
+
+static int resolve(Ir* ir, int value) {
+    while (ir->values[value].replacement != value) {
+        value = ir->values[value].replacement;
+    }
+    return value;
+}
+
+static bool isBinary(uint8_t instruction) {
+    switch (instruction) {
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+        case OP_GREATER:
+        case OP_NOT_GREATER:
+        case OP_LESS:
+        case OP_NOT_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_GREATER_NUM:
+        case OP_NOT_GREATER_NUM:
+        case OP_LESS_NUM:
+        case OP_NOT_LESS_NUM:
+        case OP_ADD_NUM:
+        case OP_SUBTRACT_NUM:
+        case OP_MULTIPLY_NUM:
+        case OP_DIVIDE_NUM:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void findBlocks(Ir* ir) {
+    Chunk* chunk = ir->chunk;
+    int count = chunk->count;
+    bool* leader = ALLOCATE(bool, count + 1);
+    memset(leader, 0, sizeof(bool) * (count + 1));
+    leader[0] = true;
+
+    for (int offset = 0; offset < count;) {
+        uint8_t instruction = chunk->code[offset];
+        int next = offset + instructionLength(chunk, offset);
+        if (isJumpInstruction(instruction)) {
+            leader[jumpTarget(chunk, offset)] = true;
+            leader[next] = true;
+        } else if (instruction == OP_RETURN || instruction == OP_THROW) {
+            leader[next] = true;
+        }
+        offset = next;
+    }
+
+    int blockCount = 0;
+    for (int offset = 0; offset < count; offset += instructionLength(chunk, offset)) {
+        if (leader[offset]) blockCount++;
+    }
+
+    ir->blocks = ALLOCATE(IrBlock, blockCount);
+    ir->blockCount = blockCount;
+    for (int offset = 0; offset <= count; offset++) {
+        ir->blockAt[offset] = -1;
+    }
+
+    int current = -1;
+    for (int offset = 0; offset < count;) {
+        int next = offset + instructionLength(chunk, offset);
+        if (leader[offset]) {
+            IrBlock* block = &ir->blocks[++current];
+            block->start = offset;
+            block->depth = -1;
+            block->successorCount = 0;
+            block->predecessorCount = 0;
+            block->executable = false;
+            block->condition = -1;
+            block->firstValue = 0;
+            block->lastValue = 0;
+            block->exitBase = -1;
+            ir->blockAt[offset] = current;
+        }
+        ir->blocks[current].end = next;
+        ir->blocks[current].last = offset;
+        offset = next;
+    }
+
+    FREE_ARRAY(bool, leader, count + 1);
+}
+
+static void linkBlocks(Ir* ir) {
+    Chunk* chunk = ir->chunk;
+    int edges = 0;
+
+    // A switch is linked as a chain: into its first jump, and from each jump that
+    // isn't the last into the next one as well as where it goes
+    bool* chained = ALLOCATE(bool, chunk->count + 1);
+    memset(chained, 0, sizeof(bool) * (chunk->count + 1));
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        if (chunk->code[offset] != OP_SWITCH) continue;
+        for (int i = 0; i < switchJumpCount(chunk, offset) - 1; i++) {
+            chained[offset + 2 + 3 * i] = true;
+        }
+    }
+
+    for (int i = 0; i < ir->blockCount; i++) {
+        IrBlock* block = &ir->blocks[i];
+        uint8_t instruction = chunk->code[block->last];
+        bool fallsThrough = chained[block->last] ||
+                            (instruction != OP_JUMP && instruction != OP_LOOP && instruction != OP_RETURN &&
+                             instruction != OP_THROW);
+
+        if (fallsThrough && block->end < chunk->count) {
+            block->successors[block->successorCount++] = ir->blockAt[block->end];
+        }
+        if (isJumpInstruction(instruction)) {
+            block->successors[block->successorCount++] = ir->blockAt[jumpTarget(chunk, block->last)];
+        }
+
+        for (int s = 0; s < block->successorCount; s++) {
+            block->edgeExecutable[s] = false;
+            ir->blocks[block->successors[s]].predecessorCount++;
+            edges++;
+        }
+    }
+
+    FREE_ARRAY(bool, chained, chunk->count + 1);
+
+    // The first block is also entered from the call itself, written as predecessor -1
+    ir->blocks[0].predecessorCount++;
+    ir->predecessors = ALLOCATE(int, edges + 1);
+    ir->predecessorCount = edges + 1;
+
+    int next = 0;
+    for (int i = 0; i < ir->blockCount; i++) {
+        ir->blocks[i].firstPredecessor = next;
+        next += ir->blocks[i].predecessorCount;
+        ir->blocks[i].predecessorCount = 0;
+    }
+
+    IrBlock* entry = &ir->blocks[0];
+    ir->predecessors[entry->firstPredecessor + entry->predecessorCount++] = -1;
+    for (int i = 0; i < ir->blockCount; i++) {
+        for (int s = 0; s < ir->blocks[i].successorCount; s++) {
+            IrBlock* successor = &ir->blocks[ir->blocks[i].successors[s]];
+            ir->predecessors[successor->firstPredecessor + successor->predecessorCount++] = i;
+        }
+    }
+}
+
+// Stack depth at the start of every block, -1 for the ones no path reaches
+static void computeDepths(Ir* ir, int arity) {
+    Chunk* chunk = ir->chunk;
+    int* worklist = ALLOCATE(int, ir->blockCount);
+    int pending = 0;
+
+    ir->blocks[0].depth = arity + 1;
+    worklist[pending++] = 0;
+
+    while (pending > 0 && !ir->failed) {
+        IrBlock* block = &ir->blocks[worklist[--pending]];
+        int depth = block->depth;
+
+        for (int offset = block->start; offset < block->end; offset += instructionLength(chunk, offset)) {
+            int pops, pushes;
+            stackEffect(chunk, offset, &pops, &pushes);
+            depth += pushes - pops;
+            if (depth - pushes < 0 || depth > MAX_SIMULATED_STACK) ir->failed = true;
+        }
+
+        for (int s = 0; s < block->successorCount; s++) {
+            IrBlock* successor = &ir->blocks[block->successors[s]];
+            if (successor->depth == -1) {
+                successor->depth = depth;
+                worklist[pending++] = block->successors[s];
+            } else if (successor->depth != depth) {
+                ir->failed = true;
+            }
+        }
+    }
+
+    FREE_ARRAY(int, worklist, ir->blockCount);
+}
+
+static void pushExit(Ir* ir, int value) {
+    if (ir->exitCapacity < ir->exitCount + 1) {
+        int oldCapacity = ir->exitCapacity;
+        ir->exitCapacity = GROW_CAPACITY(oldCapacity);
+        ir->exits = GROW_ARRAY(int, ir->exits, oldCapacity, ir->exitCapacity);
+    }
+    ir->exits[ir->exitCount++] = value;
+}
+
+// Builds the values of one block from its phis, following the stack the way the VM would
+static void buildBlock(Ir* ir, int index) {
+    Chunk* chunk = ir->chunk;
+    IrBlock* block = &ir->blocks[index];
+    int stack[MAX_SIMULATED_STACK];
+    int depth = block->depth;
+
+    block->firstValue = ir->valueCount;
+    for (int slot = 0; slot < depth; slot++) {
+        stack[slot] = newValue(ir, IR_PHI, 0, index);
+        ir->values[stack[slot]].slot = slot;
+    }
+
+    for (int offset = block->start; offset < block->end; offset += instructionLength(chunk, offset)) {
+        uint8_t instruction = chunk->code[offset];
+        int value = -1;
+
+        switch (instruction) {
+            case OP_CONSTANT:
+            case OP_NULL:
+            case OP_TRUE:
+            case OP_FALSE:
+                value = newValue(ir, IR_CONSTANT, instruction, index);
+                if (instruction == OP_CONSTANT) {
+                    ir->values[value].constant = chunk->constants.values[chunk->code[offset + 1]];
+                } else if (instruction != OP_NULL) {
+                    ir->values[value].constant = BOOL_VAL(instruction == OP_TRUE);
+                }
+                stack[depth++] = value;
+                break;
+            case OP_GET_LOCAL:
+                value = stack[chunk->code[offset + 1]];
+                stack[depth++] = value;
+                break;
+            case OP_SET_LOCAL:
+                stack[chunk->code[offset + 1]] = stack[depth - 1];
+                break;
+            case OP_SET_LOCAL_POP:
+                stack[chunk->code[offset + 1]] = stack[--depth];
+                break;
+            case OP_POP:
+                depth--;
+                break;
+            case OP_NOT:
+            case OP_NEGATE:
+                value = newValue(ir, IR_UNARY, instruction, index);
+                ir->values[value].operands[0] = stack[depth - 1];
+                stack[depth - 1] = value;
+                break;
+            case OP_JUMP_IF_FALSE:
+                block->condition = stack[depth - 1];
+                break;
+            case OP_FOR_STEP:
+                value = newValue(ir, IR_OPAQUE, instruction, index);
+                stack[chunk->code[offset + 1]] = value;
+                break;
+            case OP_JUMP:
+            case OP_LOOP:
+            case OP_SET_GLOBAL:
+            case OP_SET_UPVALUE:
+                break;
+            default: {
+                if (isBinary(instruction)) {
+                    value = newValue(ir, IR_BINARY, instruction, index);
+                    ir->values[value].operands[0] = stack[depth - 2];
+                    ir->values[value].operands[1] = stack[depth - 1];
+                    stack[depth - 2] = value;
+                    depth--;
+                    break;
+                }
+
+                int pops, pushes;
+                stackEffect(chunk, offset, &pops, &pushes);
+                depth -= pops;
+                if (pushes > 0) {
+                    value = newValue(ir, IR_OPAQUE, instruction, index);
+                    stack[depth++] = value;
+                }
+                break;
+            }
+        }
+
+        ir->produced[offset] = value;
+    }
+
+    block->lastValue = ir->valueCount;
+    block->exitBase = ir->exitCount;
+    for (int slot = 0; slot < depth; slot++) {
+        pushExit(ir, stack[slot]);
+    }
+}
+
+// What a phi receives from its `i`th predecessor
+static int phiInput(Ir* ir, IrValue* phi, int i, int* from) {
+    IrBlock* block = &ir->blocks[phi->block];
+    int predecessor = ir->predecessors[block->firstPredecessor + i];
+    *from = predecessor;
+    if (predecessor == -1) return phi->slot;
+    if (ir->blocks[predecessor].exitBase == -1) return -1;
+    return ir->exits[ir->blocks[predecessor].exitBase + phi->slot];
+}
+
+static void foldTrivialPhis(Ir* ir) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int v = ir->entryCount; v < ir->valueCount; v++) {
+            IrValue* phi = &ir->values[v];
+            if (phi->kind != IR_PHI || phi->replacement != v) continue;
+
+            int same = -1;
+            bool isTrivial = true;
+            IrBlock* block = &ir->blocks[phi->block];
+            for (int i = 0; i < block->predecessorCount; i++) {
+                int from;
+                int input = phiInput(ir, phi, i, &from);
+                if (input == -1) continue;
+                input = resolve(ir, input);
+                if (input == v || input == same) continue;
+                if (same != -1) {
+                    isTrivial = false;
+                    break;
+                }
+                same = input;
+            }
+
+            if (isTrivial && same != -1) {
+                phi->replacement = same;
+                changed = true;
+            }
+        }
+    }
+}
+
+static bool edgeIsExecutable(Ir* ir, int from, int to) {
+    if (from == -1) return true;
+    IrBlock* block = &ir->blocks[from];
+    for (int s = 0; s < block->successorCount; s++) {
+        if (block->successors[s] == to && block->edgeExecutable[s]) return true;
+    }
+    return false;
+}
+
+static bool fold(uint8_t instruction, Value a, Value b, Value* result) {
+    switch (instruction) {
+        case OP_NOT:       *result = BOOL_VAL(isFalsey(a)); return true;
+        case OP_EQUAL:     *result = BOOL_VAL(valuesEqual(a, b)); return true;
+        case OP_NOT_EQUAL: *result = BOOL_VAL(!valuesEqual(a, b)); return true;
+        default:
+            break;
+    }
+
+    if (instruction == OP_NEGATE) {
+        if (!IS_NUMBER(a)) return false;
+        *result = negateNumber(a);
+        return true;
+    }
+
+    if (!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
+    double x = AS_NUMBER(a);
+    double y = AS_NUMBER(b);
+    switch (instruction) {
+        case OP_GREATER:
+        case OP_GREATER_NUM:     *result = BOOL_VAL(x > y); return true;
+        case OP_NOT_GREATER:
+        case OP_NOT_GREATER_NUM: *result = BOOL_VAL(!(x > y)); return true;
+        case OP_LESS:
+        case OP_LESS_NUM:        *result = BOOL_VAL(x < y); return true;
+        case OP_NOT_LESS:
+        case OP_NOT_LESS_NUM:    *result = BOOL_VAL(!(x < y)); return true;
+        case OP_ADD:
+        case OP_ADD_NUM:         *result = addNumbers(a, b); return true;
+        case OP_SUBTRACT:
+        case OP_SUBTRACT_NUM:    *result = subtractNumbers(a, b); return true;
+        case OP_MULTIPLY:
+        case OP_MULTIPLY_NUM:    *result = multiplyNumbers(a, b); return true;
+        case OP_DIVIDE:
+        case OP_DIVIDE_NUM:      *result = divideNumbers(a, b); return true;
+        default:             return false;
+    }
+}
+
+// Moves a value down the lattice, returns whether anything changed
+static bool lower(IrValue* value, Lattice lattice, Value constant) {
+    if (value->lattice == LATTICE_BOTTOM || lattice == LATTICE_TOP) return false;
+    if (value->lattice == LATTICE_CONSTANT && lattice == LATTICE_CONSTANT && value->constant == constant) return false;
+
+    if (value->lattice == LATTICE_TOP && lattice == LATTICE_CONSTANT) {
+        value->lattice = LATTICE_CONSTANT;
+        value->constant = constant;
+    } else {
+        value->lattice = LATTICE_BOTTOM;
+    }
+    return true;
+}
+
+static bool evaluate(Ir* ir, int index) {
+    IrValue* value = &ir->values[index];
+
+    switch (value->kind) {
+        case IR_ENTRY:
+        case IR_OPAQUE:
+            return lower(value, LATTICE_BOTTOM, NULL_VAL);
+        case IR_CONSTANT:
+            return lower(value, LATTICE_CONSTANT, value->constant);
+        case IR_PHI: {
+            if (value->replacement != index) return false;
+
+            IrBlock* block = &ir->blocks[value->block];
+            bool changed = false;
+            for (int i = 0; i < block->predecessorCount; i++) {
+                int from;
+                int input = phiInput(ir, value, i, &from);
+                if (input == -1 || !edgeIsExecutable(ir, from, value->block)) continue;
+
+                IrValue* source = &ir->values[resolve(ir, input)];
+                if (lower(value, source->lattice, source->constant)) changed = true;
+            }
+            return changed;
+        }
+        case IR_UNARY:
+        case IR_BINARY: {
+            int operandCount = value->kind == IR_UNARY ? 1 : 2;
+            Value operands[2] = {NULL_VAL, NULL_VAL};
+            for (int i = 0; i < operandCount; i++) {
+                IrValue* operand = &ir->values[resolve(ir, value->operands[i])];
+                if (operand->lattice == LATTICE_TOP) return false;
+                if (operand->lattice == LATTICE_BOTTOM) return lower(value, LATTICE_BOTTOM, NULL_VAL);
+                operands[i] = operand->constant;
+            }
+
+            Value result;
+            if (!fold(value->opcode, operands[0], operands[1], &result)) {
+                return lower(value, LATTICE_BOTTOM, NULL_VAL);
+            }
+            return lower(value, LATTICE_CONSTANT, result);
+        }
+    }
+    return false;
+}
+
+static bool markEdge(Ir* ir, IrBlock* block, int s) {
+    if (block->edgeExecutable[s]) return false;
+    block->edgeExecutable[s] = true;
+    ir->blocks[block->successors[s]].executable = true;
+    return true;
+}
+
+// * Sparse conditional constant propagation: values start unknown and only go down,
+// * and a branch on a constant only makes the side it takes executable.
+static void propagateConstants(Ir* ir) {
+    for (int v = 0; v < ir->entryCount; v++) {
+        ir->values[v].lattice = LATTICE_BOTTOM;
+    }
+    ir->blocks[0].executable = true;
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i = 0; i < ir->blockCount; i++) {
+            IrBlock* block = &ir->blocks[i];
+            if (!block->executable || block->depth == -1) continue;
+
+            for (int v = block->firstValue; v < block->lastValue; v++) {
+                if (evaluate(ir, v)) changed = true;
+            }
+
+            if (ir->chunk->code[block->last] == OP_JUMP_IF_FALSE) {
+                IrValue* condition = &ir->values[resolve(ir, block->condition)];
+                if (condition->lattice == LATTICE_TOP) continue;
+
+                bool isConstant = condition->lattice == LATTICE_CONSTANT;
+                bool jumps = !isConstant || isFalsey(condition->constant);
+                bool fallsThrough = !isConstant || !isFalsey(condition->constant);
+                if (fallsThrough && block->successorCount == 2 && markEdge(ir, block, 0)) changed = true;
+                if (jumps && markEdge(ir, block, block->successorCount - 1)) changed = true;
+            } else {
+                for (int s = 0; s < block->successorCount; s++) {
+                    if (markEdge(ir, block, s)) changed = true;
+                }
+            }
+        }
+    }
+}
+
+typedef struct {
+    uint64_t key[2];
+    int number;
+} NumberEntry;
+
+static int valueNumber(NumberEntry* table, int capacity, uint64_t key0, uint64_t key1, int number) {
+    uint64_t hash = (key0 * 0x9e3779b97f4a7c15ULL) ^ (key1 + (key1 << 6) + (key1 >> 2));
+    uint32_t index = (uint32_t)(hash ^ (hash >> 32)) & (capacity - 1);
+    for (;;) {
+        NumberEntry* entry = &table[index];
+        if (entry->number == -1) {
+            entry->key[0] = key0;
+            entry->key[1] = key1;
+            entry->number = number;
+            return number;
+        }
+        if (entry->key[0] == key0 && entry->key[1] == key1) return entry->number;
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+// * Value numbering: same operation on the same numbered operands, same number.
+// * Constants are numbered by what they are, whatever computed them.
+static void numberValues(Ir* ir) {
+    int capacity = 8;
+    while (capacity < ir->valueCount * 2) capacity *= 2;
+    NumberEntry* table = ALLOCATE(NumberEntry, capacity);
+    for (int i = 0; i < capacity; i++) {
+        table[i].number = -1;
+    }
+
+    for (int i = 0; i < ir->blockCount; i++) {
+        IrBlock* block = &ir->blocks[i];
+        if (!block->executable) continue;
+
+        for (int v = block->firstValue; v < block->lastValue; v++) {
+            IrValue* value = &ir->values[v];
+            if (value->lattice == LATTICE_CONSTANT) {
+                value->number = valueNumber(table, capacity, 1, value->constant, v);
+            } else if (value->kind == IR_UNARY || value->kind == IR_BINARY) {
+                uint64_t left = (uint64_t)ir->values[resolve(ir, value->operands[0])].number;
+                uint64_t right = value->kind == IR_BINARY
+                    ? (uint64_t)ir->values[resolve(ir, value->operands[1])].number : 0;
+                value->number = valueNumber(table, capacity, 2 + value->opcode, (left << 32) | right, v);
+            }
+        }
+    }
+
+    FREE_ARRAY(NumberEntry, table, capacity);
+}
+
+static void addEdit(Ir* ir, int start, int end, const uint8_t* bytes, int length, int target) {
+    // Edits arrive in order of where they end, so anything starting inside this one is nested in it
+    while (ir->editCount > 0 && ir->edits[ir->editCount - 1].start >= start) {
+        ir->editCount--;
+    }
+
+    if (ir->editCapacity < ir->editCount + 1) {
+        int oldCapacity = ir->editCapacity;
+        ir->editCapacity = GROW_CAPACITY(oldCapacity);
+        ir->edits = GROW_ARRAY(Edit, ir->edits, oldCapacity, ir->editCapacity);
+    }
+
+    Edit* edit = &ir->edits[ir->editCount++];
+    edit->start = start;
+    edit->end = end;
+    edit->length = length;
+    if (length > 0) memcpy(edit->bytes, bytes, length);
+    edit->isJump = target != -1;
+    edit->target = target;
+}
+
+static bool replaceWithConstant(Ir* ir, int start, int end, Value constant) {
+    uint8_t bytes[2];
+    int length = 1;
+
+    if (IS_NULL(constant)) {
+        bytes[0] = OP_NULL;
+    } else if (IS_BOOL(constant)) {
+        bytes[0] = AS_BOOL(constant) ? OP_TRUE : OP_FALSE;
+    } else {
+        int index = addConstant(ir->chunk, constant);
+        if (index > UINT8_MAX) return false;
+        bytes[0] = OP_CONSTANT;
+        bytes[1] = (uint8_t)index;
+        length = 2;
+    }
+
+    // Swapping a GET_LOCAL for a constant is free and lets later passes see the constant
+    bool isLocal = end - start == 2 && ir->chunk->code[start] == OP_GET_LOCAL;
+    if (length >= end - start && !isLocal) return false;
+
+    addEdit(ir, start, end, bytes, length, -1);
+    return true;
+}
+
+static bool canFail(Ir* ir, IrValue* value) {
+    switch (value->opcode) {
+        case OP_NOT:
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+            return false;
+        default:
+            break;
+    }
+
+    int operandCount = value->kind == IR_UNARY ? 1 : 2;
+    for (int i = 0; i < operandCount; i++) {
+        IrValue* operand = &ir->values[resolve(ir, value->operands[i])];
+        if (operand->lattice != LATTICE_CONSTANT || !IS_NUMBER(operand->constant)) return true;
+    }
+    return false;
+}
+
+// Re-walks an executable block with the results in hand and records what to change
+static void lowerBlock(Ir* ir, int index) {
+    Chunk* chunk = ir->chunk;
+    IrBlock* block = &ir->blocks[index];
+    Occurrence stack[MAX_SIMULATED_STACK];
+    int depth = block->depth;
+
+    for (int slot = 0; slot < depth; slot++) {
+        Occurrence entry = {resolve(ir, block->firstValue + slot), -1, -1, false, false};
+        stack[slot] = entry;
+    }
+
+    for (int offset = block->start; offset < block->end;) {
+        uint8_t instruction = chunk->code[offset];
+        int next = offset + instructionLength(chunk, offset);
+        int produced = ir->produced[offset] == -1 ? -1 : resolve(ir, ir->produced[offset]);
+
+        switch (instruction) {
+            case OP_CONSTANT:
+            case OP_NULL:
+            case OP_TRUE:
+            case OP_FALSE: {
+                Occurrence occurrence = {produced, offset, next, true, true};
+                stack[depth++] = occurrence;
+                break;
+            }
+            case OP_GET_LOCAL: {
+                Occurrence occurrence = {produced, offset, next, true, true};
+                IrValue* value = &ir->values[produced];
+                if (value->lattice == LATTICE_CONSTANT) {
+                    replaceWithConstant(ir, offset, next, value->constant);
+                }
+                stack[depth++] = occurrence;
+                break;
+            }
+            case OP_SET_LOCAL: {
+                Occurrence* top = &stack[depth - 1];
+                Occurrence local = {top->value, -1, -1, false, false};
+                stack[chunk->code[offset + 1]] = local;
+                if (top->start != -1) top->end = next;
+                top->pure = false;
+                break;
+            }
+            case OP_SET_LOCAL_POP: {
+                Occurrence local = {stack[--depth].value, -1, -1, false, false};
+                stack[chunk->code[offset + 1]] = local;
+                break;
+            }
+            case OP_POP: {
+                // An expression statement nobody reads, that can't fail or do anything, goes away
+                Occurrence top = stack[--depth];
+                if (top.start != -1 && top.end == offset && top.pure && top.safe) {
+                    addEdit(ir, top.start, next, NULL, 0, -1);
+                }
+                break;
+            }
+            case OP_JUMP_IF_FALSE: {
+                IrValue* condition = &ir->values[resolve(ir, block->condition)];
+                if (condition->lattice != LATTICE_CONSTANT) break;
+
+                if (isFalsey(condition->constant)) {
+                    uint8_t jump[3] = {OP_JUMP, 0, 0};
+                    addEdit(ir, offset, next, jump, 3, jumpTarget(chunk, offset));
+                } else {
+                    addEdit(ir, offset, next, NULL, 0, -1);
+                }
+                break;
+            }
+            case OP_FOR_STEP: {
+                Occurrence local = {produced, -1, -1, false, false};
+                stack[chunk->code[offset + 1]] = local;
+                break;
+            }
+            case OP_JUMP:
+            case OP_LOOP:
+                break;
+            case OP_SET_GLOBAL:
+            case OP_SET_UPVALUE:
+                stack[depth - 1].pure = false;
+                stack[depth - 1].start = -1;
+                stack[depth - 1].end = -1;
+                break;
+            case OP_NOT:
+            case OP_NEGATE:
+            default: {
+                bool isUnary = instruction == OP_NOT || instruction == OP_NEGATE;
+                if (!isUnary && !isBinary(instruction)) {
+                    int pops, pushes;
+                    stackEffect(chunk, offset, &pops, &pushes);
+                    depth -= pops;
+                    if (pushes > 0) {
+                        Occurrence occurrence = {produced, -1, -1, false, false};
+                        stack[depth++] = occurrence;
+                    }
+                    break;
+                }
+
+                int operandCount = isUnary ? 1 : 2;
+                Occurrence* first = &stack[depth - operandCount];
+                Occurrence* last = &stack[depth - 1];
+                bool isContiguous = first->start != -1 && last->start != -1 && last->end == offset;
+                if (!isUnary) isContiguous = isContiguous && first->end == last->start;
+
+                IrValue* value = &ir->values[produced];
+                Occurrence occurrence;
+                occurrence.value = produced;
+                occurrence.start = isContiguous ? first->start : -1;
+                occurrence.end = isContiguous ? next : -1;
+                occurrence.pure = first->pure && last->pure;
+                occurrence.safe = first->safe && last->safe && !canFail(ir, value);
+                depth -= operandCount;
+
+                if (occurrence.start != -1 && occurrence.pure) {
+                    if (value->lattice == LATTICE_CONSTANT) {
+                        if (replaceWithConstant(ir, occurrence.start, next, value->constant)) occurrence.safe = true;
+                    } else {
+                        // A slot further down already holds the same value: read it instead of recomputing
+                        for (int slot = 0; slot < depth; slot++) {
+                            IrValue* held = &ir->values[stack[slot].value];
+                            if (held->number == value->number) {
+                                uint8_t local[2] = {OP_GET_LOCAL, (uint8_t)slot};
+                                addEdit(ir, occurrence.start, next, local, 2, -1);
+                                occurrence.safe = true;
+                                break;
+                            }
+                        }
+                    }
+                }
+
+                stack[depth++] = occurrence;
+                break;
+            }
+        }
+
+        offset = next;
+    }
+}
+
+static bool lowerToChunk(Ir* ir) {
+    Chunk* chunk = ir->chunk;
+    int count = chunk->count;
+
+    for (int i = 0; i < ir->blockCount; i++) {
+        IrBlock* block = &ir->blocks[i];
+        if (block->executable && block->depth != -1) {
+            lowerBlock(ir, i);
+        } else {
+            addEdit(ir, block->start, block->end, NULL, 0, -1);
+        }
+    }
+
+    if (ir->editCount == 0) return false;
+
+    uint8_t* code = ALLOCATE(uint8_t, chunk->capacity);
+    LineTable lines;
+    initLineTable(&lines);
+    int* newOffsets = ALLOCATE(int, count + 1);
+    int* jumpOrigins = ALLOCATE(int, count);
+    int* jumpTargets = ALLOCATE(int, count);
+    int jumpCount = 0;
+    int length = 0;
+    int edit = 0;
+
+    for (int offset = 0; offset < count;) {
+        newOffsets[offset] = length;
+
+        if (edit < ir->editCount && ir->edits[edit].start == offset) {
+            Edit* current = &ir->edits[edit++];
+            if (current->isJump) {
+                jumpOrigins[jumpCount] = length;
+                jumpTargets[jumpCount++] = current->target;
+            }
+            addLine(&lines, length, getLine(&chunk->lines, current->end - 1));
+            for (int i = 0; i < current->length; i++) {
+                code[length++] = current->bytes[i];
+            }
+            for (int inside = offset + 1; inside < current->end; inside++) {
+                newOffsets[inside] = length;
+            }
+            offset = current->end;
+            continue;
+        }
+
+        int size = instructionLength(chunk, offset);
+        if (isJumpInstruction(chunk->code[offset])) {
+            jumpOrigins[jumpCount] = length;
+            jumpTargets[jumpCount++] = jumpTarget(chunk, offset);
+        }
+        addLine(&lines, length, getLine(&chunk->lines, offset));
+        for (int i = 0; i < size; i++) {
+            code[length++] = chunk->code[offset + i];
+        }
+        offset += size;
+    }
+    newOffsets[count] = length;
+
+    for (int i = 0; i < jumpCount; i++) {
+        setJumpTarget(code, jumpOrigins[i], newOffsets[jumpTargets[i]]);
+    }
+
+    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+    freeLineTable(&chunk->lines);
+    chunk->code = code;
+    chunk->lines = lines;
+    chunk->count = length;
+
+    FREE_ARRAY(int, newOffsets, count + 1);
+    FREE_ARRAY(int, jumpOrigins, count);
+    FREE_ARRAY(int, jumpTargets, count);
+    return true;
+}
+
+static void freeIr(Ir* ir, int count) {
+    FREE_ARRAY(IrValue, ir->values, ir->valueCapacity);
+    FREE_ARRAY(IrBlock, ir->blocks, ir->blockCount);
+    FREE_ARRAY(int, ir->blockAt, count + 1);
+    FREE_ARRAY(int, ir->produced, count + 1);
+    FREE_ARRAY(int, ir->exits, ir->exitCapacity);
+    FREE_ARRAY(int, ir->predecessors, ir->predecessorCount);
+    FREE_ARRAY(Edit, ir->edits, ir->editCapacity);
+}
+
+void optimizeSSA(ObjFunction* function) {
+    Chunk* chunk = &function->chunk;
+    int count = chunk->count;
+    if (count == 0 || capturesLocals(chunk) || chunk->handlerCount > 0) return;
+
+    Ir ir;
+    memset(&ir, 0, sizeof(Ir));
+    ir.chunk = chunk;
+    ir.blockAt = ALLOCATE(int, count + 1);
+    ir.produced = ALLOCATE(int, count + 1);
+
+    findBlocks(&ir);
+    linkBlocks(&ir);
+    computeDepths(&ir, function->arity);
+
+    bool changed = false;
+    if (!ir.failed) {
+        for (int slot = 0; slot <= function->arity; slot++) {
+            newValue(&ir, IR_ENTRY, 0, -1);
+            ir.values[slot].slot = slot;
+        }
+        ir.entryCount = ir.valueCount;
+
+        for (int i = 0; i < ir.blockCount; i++) {
+            if (ir.blocks[i].depth != -1) buildBlock(&ir, i);
+        }
+
+        foldTrivialPhis(&ir);
+        propagateConstants(&ir);
+        numberValues(&ir);
+        changed = lowerToChunk(&ir);
+    }
+
+    freeIr(&ir, count);
+
+    // Whatever got folded usually leaves jumps to the next instruction and pushes that are popped right away
+    if (changed) {
+        while (optimizeChunk(chunk));
+    }
+}
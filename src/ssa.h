@@ -0,0 +1,8 @@
+#ifndef npp_ssa_h
+#define npp_ssa_h
+
+#include "object.h"
+
+void optimizeSSA(ObjFunction* function);
+
+#endif
@@ -28,22 +28,44 @@ void freeValueArray(ValueArray* array) {
     initValueArray(array);
 }
 
-void printValue(Value value) {
+void fprintValue(FILE* file, Value value) {
     if (IS_BOOL(value)) {
-        printf(AS_BOOL(value) ? "[TRUE]" : "[FALSE]");
+        fprintf(file, AS_BOOL(value) ? "[TRUE]" : "[FALSE]");
     } else if (IS_NULL(value)) {
-        printf("[NULL]");
+        fprintf(file, "[NULL]");
     } else if (IS_NUMBER(value)) {
-        printf("%g", AS_NUMBER(value));
+        fprintf(file, "%g", AS_NUMBER(value));
     } else if (IS_OBJ(value)) {
-        printObject(value);
+        fprintObject(file, value);
     }
 }
 
+void printValue(Value value) {
+    fprintValue(stdout, value);
+}
+
 bool valuesEqual(Value a, Value b) {
+    if (BOTH_INTS(a, b)) return a == b;
     if (IS_NUMBER(a) && IS_NUMBER(b)) {
         return AS_NUMBER(a) == AS_NUMBER(b);
     }
 
     return a == b;
-}
\ No newline at end of file
+}
+
+// Doubles past 32 bits keep only their low bits, like an int cast from a wider one
+bool wrapBits(double num, int32_t* bits) {
+    if (!isfinite(num) || num != trunc(num)) return false;
+    *bits = (int32_t)(uint32_t)(int64_t)fmod(num, 4294967296.0);
+    return true;
+}
+
+// The annotation that promises `type`
+const char* valueTypeName(ValueType type) {
+    switch (type) {
+        case VALUE_NUMBER: return "num";
+        case VALUE_STRING: return "str";
+        case VALUE_BOOL:   return "bool";
+        default:           return "int";
+    }
+}
@@ -1,6 +1,7 @@
 #ifndef npp_value_h
 #define npp_value_h
 
+#include <math.h>
 #include <string.h>
 
 #include "common.h"
@@ -15,18 +16,36 @@ typedef struct ObjString ObjString;
 #define TAG_NULL   1 
 #define TAG_FALSE 2 
 #define TAG_TRUE  3 
+// * Whole numbers that fit 32 bits ride in the low half of a quiet NaN with this bit set,
+// * doubles stay as they are; both answer IS_NUMBER and compare by numeric value.
+// * No pointer reaches bit 48, so null, bools and objects all mask down to plain QNAN
+#define INT_TAG  ((uint64_t)0x0001000000000000)
 
 typedef uint64_t Value;
 
+// What a num, str or bool annotation promises about a value, VALUE_ANY when there is none
+typedef enum {
+    VALUE_ANY,
+    VALUE_NUMBER,
+    VALUE_STRING,
+    VALUE_BOOL
+} ValueType;
+
 #define IS_BOOL(value)      (((value) | 1) == TRUE_VAL)
 #define IS_NULL(value)      ((value) == NULL_VAL)
-#define IS_NUMBER(value)    (((value) & QNAN) != QNAN)
+#define IS_INT(value)       (((value) & (SIGN_BIT | QNAN | INT_TAG)) == (QNAN | INT_TAG))
+#define IS_NUMBER(value)    (((value) & (QNAN | INT_TAG)) != QNAN)
+// One test for the pair, the fast path of every arithmetic op
+#define BOTH_INTS(a, b) \
+    (((((a) ^ (QNAN | INT_TAG)) | ((b) ^ (QNAN | INT_TAG))) & (SIGN_BIT | QNAN | INT_TAG)) == 0)
+#define BOTH_NUMBERS(a, b) (BOTH_INTS(a, b) || (IS_NUMBER(a) && IS_NUMBER(b)))
 
 #define IS_OBJ(value) \
     (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
 
 #define AS_BOOL(value)      ((value) == TRUE_VAL)
 #define AS_NUMBER(value)    valueToNum(value)
+#define AS_INT(value)       ((int32_t)(uint32_t)(value))
 
 #define AS_OBJ(value) \
     ((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
@@ -36,11 +55,13 @@ typedef uint64_t Value;
 #define TRUE_VAL        ((Value)(uint64_t)(QNAN | TAG_TRUE))
 #define NULL_VAL        ((Value)(uint64_t)(QNAN | TAG_NULL))
 #define NUMBER_VAL(num) numToValue(num)
+#define INT_VAL(i)      ((Value)(QNAN | INT_TAG | (uint32_t)(int32_t)(i)))
 
 #define OBJ_VAL(obj) \
     (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
 
 static inline double valueToNum(Value value) {
+    if (IS_INT(value)) return (double)AS_INT(value);
     double num;
     memcpy(&num, &value, sizeof(Value));
     return num;
@@ -52,6 +73,97 @@ static inline Value numToValue(double num) {
     return value;
 }
 
+// Ints compare as ints, any other pair of numbers as doubles
+#define COMPARE_NUMBERS(a, op, b) \
+    (BOTH_INTS(a, b) ? AS_INT(a) op AS_INT(b) : AS_NUMBER(a) op AS_NUMBER(b))
+
+// A 64-bit result back as an int when it still fits, otherwise as a double
+static inline Value wideToValue(int64_t wide) {
+    if (wide != (int32_t)wide) return numToValue((double)wide);
+    return INT_VAL(wide);
+}
+
+static inline Value addNumbers(Value a, Value b) {
+    if (BOTH_INTS(a, b)) return wideToValue((int64_t)AS_INT(a) + AS_INT(b));
+    return numToValue(valueToNum(a) + valueToNum(b));
+}
+
+static inline Value subtractNumbers(Value a, Value b) {
+    if (BOTH_INTS(a, b)) return wideToValue((int64_t)AS_INT(a) - AS_INT(b));
+    return numToValue(valueToNum(a) - valueToNum(b));
+}
+
+// A zero with a negative factor goes through doubles so that -3 * 0 keeps its sign
+static inline Value multiplyNumbers(Value a, Value b) {
+    if (BOTH_INTS(a, b)) {
+        int64_t wide = (int64_t)AS_INT(a) * AS_INT(b);
+        if (wide != 0 || (AS_INT(a) | AS_INT(b)) >= 0) return wideToValue(wide);
+    }
+    return numToValue(valueToNum(a) * valueToNum(b));
+}
+
+// Always a double, 1 / 2 is 0.5
+static inline Value divideNumbers(Value a, Value b) {
+    return numToValue(valueToNum(a) / valueToNum(b));
+}
+
+// Same for -0, and -INT32_MIN does not fit
+static inline Value negateNumber(Value a) {
+    if (IS_INT(a) && AS_INT(a) != 0 && AS_INT(a) != INT32_MIN) return INT_VAL(-AS_INT(a));
+    return numToValue(-valueToNum(a));
+}
+
+// A double result back as an int when it's whole and fits, -0 included
+static inline Value normalizeNumber(double num) {
+    if (num >= INT32_MIN && num <= INT32_MAX && num == (int32_t)num) return INT_VAL((int32_t)num);
+    return numToValue(num);
+}
+
+// The remainder takes the dividend's sign, as in C
+static inline Value moduloNumbers(Value a, Value b) {
+    if (BOTH_INTS(a, b) && AS_INT(b) != 0) return INT_VAL((int64_t)AS_INT(a) % AS_INT(b));
+    return normalizeNumber(fmod(valueToNum(a), valueToNum(b)));
+}
+
+// ~/ divides and drops the fraction
+static inline Value intDivideNumbers(Value a, Value b) {
+    if (BOTH_INTS(a, b) && AS_INT(b) != 0) return wideToValue((int64_t)AS_INT(a) / AS_INT(b));
+    return normalizeNumber(trunc(valueToNum(a) / valueToNum(b)));
+}
+
+bool wrapBits(double num, int32_t* bits);
+
+// The bitwise operators work on the low 32 bits of whole numbers, false for anything else
+static inline bool toBits(Value value, int32_t* bits) {
+    if (IS_INT(value)) {
+        *bits = AS_INT(value);
+        return true;
+    }
+    return IS_NUMBER(value) && wrapBits(AS_NUMBER(value), bits);
+}
+
+static inline bool bothToBits(Value a, Value b, int32_t* x, int32_t* y) {
+    if (BOTH_INTS(a, b)) {
+        *x = AS_INT(a);
+        *y = AS_INT(b);
+        return true;
+    }
+    return toBits(a, x) && toBits(b, y);
+}
+
+// Shift counts wrap at 32, >> keeps the sign
+static inline int32_t shiftLeft(int32_t bits, int32_t count) {
+    return (int32_t)((uint32_t)bits << (count & 31));
+}
+
+static inline int32_t shiftRight(int32_t bits, int32_t count) {
+    return bits >> (count & 31);
+}
+
+static inline bool isFalsey(Value value) {
+    return IS_NULL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
 typedef struct {
     int capacity;
     int count;
@@ -62,6 +174,8 @@ bool valuesEqual(Value a, Value b);
 void initValueArray(ValueArray* array);
 void writeValueArray(ValueArray* array, Value value);
 void freeValueArray(ValueArray* array);
+void fprintValue(FILE* file, Value value);
 void printValue(Value value);
+const char* valueTypeName(ValueType type);
 
 #endif
\ No newline at end of file
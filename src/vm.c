@@ -1,7 +1,9 @@
+#include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "common.h"
 #include "compiler.h"
@@ -9,27 +11,85 @@
 #include "memory.h"
 #include "vm.h"
 #include "native.h"
+#include "registers.h"
 
 VM vm;
+
+// Returned by one interpreter loop when the frame on top belongs to the other one
+#define INTERPRET_SWITCH ((InterpretResult)-1)
+#define IS_REGISTER_FRAME(frame) ((frame)->closure->function->registers != NULL)
+
 static void resetStack() {
     vm.stackTop = vm.stack;
     vm.frameCount = 0;
+    vm.scratchTop = 0;
     vm.openUpvalues = NULL;
+    vm.exception = NULL_VAL;
+    vm.hasException = false;
+}
+
+// How many frames a stack trace shows at either end
+#define TRACE_EDGE 16
+
+// Raises `value`. Whatever raised it gives up and returns INTERPRET_RUNTIME_ERROR
+// (natives just return), then run() unwinds to the nearest try around it.
+void throwValue(Value value) {
+    vm.exception = value;
+    vm.hasException = true;
 }
 
 // Error thing
 void runtimeError(const char* format, ...) {
     va_list args;
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    ObjString* message = makeString(length);
+    va_start(args, format);
+    vsnprintf(message->chars, length + 1, format, args);
     va_end(args);
+    throwValue(OBJ_VAL(internString(message)));
+}
+
+// Nothing caught the error, so it's printed with the stack as it was when it was raised
+static void reportError() {
+    fprintValue(stderr, vm.exception);
     fputs("\n", stderr);
 
     for (int i = vm.frameCount - 1; i >= 0; i--) {
+        // A deep trace keeps its innermost and outermost frames, the ones in between are counted
+        if (i == vm.frameCount - 1 - TRACE_EDGE && i >= TRACE_EDGE) {
+            fprintf(stderr, "... %d more frames ...\n", i - TRACE_EDGE + 1);
+            i = TRACE_EDGE - 1;
+        }
+
         CallFrame* frame = &vm.frames[i];
         ObjFunction* function = frame->closure->function;
-        size_t instruction = frame->ip - function->chunk.code - 1;
-        fprintf(stderr, "[line %d] in ", function->chunk.lines[instruction]);
+        bool running = i == vm.frameCount - 1;
+        int line;
+        InlinedCall* inlined;
+
+        // A frame the fuel check stopped on its way in hasn't run anything yet, and
+        // looking up offset -1 gives it the line it starts on
+        if (IS_REGISTER_FRAME(frame)) {
+            RegisterCode* registers = function->registers;
+            int resume = (int)(frame->rip - registers->code);
+            line = getLine(&registers->lines, resume - 1);
+            inlined = findInlinedCall(registers->inlinedCalls, registers->inlinedCount, resume, running);
+        } else {
+            int resume = (int)(frame->ip - function->chunk.code);
+            line = getLine(&function->chunk.lines, resume - 1);
+            inlined = findInlinedCall(function->chunk.inlinedCalls, function->chunk.inlinedCount, resume, running);
+        }
+
+        // An inlined copy still gets its own line in the trace, as if it had been called
+        if (inlined != NULL) {
+            fprintf(stderr, "[line %d] in %s()\n", line, inlined->name->chars);
+            line = inlined->line;
+        }
+
+        fprintf(stderr, "[line %d] in ", line);
         if (function->name == NULL) {
             fprintf(stderr, "script\n");
         } else {
@@ -44,7 +104,30 @@ static Value peek(int distance) {
     return vm.stackTop[-1 - distance];
 }
 
+// The stack moves when it grows, so everything pointing into it is moved along:
+// the frames' slots, the open upvalues and the stack top
+static void growStack(size_t needed) {
+    size_t capacity = vm.stackCapacity;
+    while (capacity < needed) capacity *= 2;
+
+    Value* stack = (Value*)realloc(vm.stack, sizeof(Value) * capacity);
+    if (stack == NULL) exit(1);
+
+    for (int i = 0; i < vm.frameCount; i++) {
+        vm.frames[i].slots = stack + (vm.frames[i].slots - vm.stack);
+    }
+    for (ObjUpvalue* upvalue = vm.openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
+        upvalue->location = stack + (upvalue->location - vm.stack);
+    }
+    vm.stackTop = stack + (vm.stackTop - vm.stack);
+    vm.stack = stack;
+    vm.stackCapacity = capacity;
+}
+
+// Calls reserve what their function can use, so this only grows the stack
+// in a frame whose depth the compiler couldn't work out
 void push(Value value) {
+    if (vm.stackTop == vm.stack + vm.stackCapacity) growStack(vm.stackCapacity + 1);
     *vm.stackTop = value;
     vm.stackTop++;
 }
@@ -54,10 +137,6 @@ Value pop() {
     return *vm.stackTop;
 }
 
-static bool isFalsey(Value value) {
-    return IS_NULL(value) || (IS_BOOL(value) && !AS_BOOL(value));
-}
-
 // Define a native function
 // * Native functions are functions that are defined in the code natively
 void defineNative(const char* name, NativeFn function) {
@@ -69,6 +148,19 @@ void defineNative(const char* name, NativeFn function) {
 }
 
 void initVM() {
+    vm.frameCapacity = FRAMES_INITIAL;
+    vm.frames = (CallFrame*)malloc(sizeof(CallFrame) * vm.frameCapacity);
+    vm.stackCapacity = FRAMES_INITIAL * FRAME_SLOTS;
+    vm.stack = (Value*)malloc(sizeof(Value) * vm.stackCapacity);
+    if (vm.frames == NULL || vm.stack == NULL) exit(1);
+    vm.maxFrames = FRAMES_DEFAULT_MAX;
+    vm.fuel = INT64_MAX;
+    vm.budget = -1;
+    vm.deadline = 0;
+    vm.fuelLimit = -1;
+    vm.timeLimit = 0;
+    vm.fuelHook = NULL;
+    vm.stopping = INTERPRET_OK;
     resetStack();
     vm.objects = NULL;
     vm.bytesAllocated = 0;
@@ -80,8 +172,13 @@ void initVM() {
 
     initTable(&vm.globals);
     initTable(&vm.strings);
+    initTable(&vm.constGlobals);
     vm.initString = NULL;
     vm.initString = copyString("init", 4);
+    vm.epoch = 0;
+    vm.useRegisters = false;
+    vm.optimize = false;
+    vm.lazy = false;
 
     defineNatives();
 }
@@ -89,26 +186,132 @@ void initVM() {
 void freeVM() {
     freeTable(&vm.globals);
     freeTable(&vm.strings);
+    freeTable(&vm.constGlobals);
     vm.initString = NULL;
     freeObjects();
+    free(vm.frames);
+    free(vm.stack);
 }
 
-static bool call(ObjClosure* closure, int argCount) {
-    if (argCount != closure->function->arity) {
-        runtimeError("Expected %d arguments but got %d.", closure->function->arity, argCount);
+// A register frame keeps the stack top above all of its registers so the GC sees them.
+// Whatever is left in the ones it hasn't written yet is stale, so those are cleared.
+static void claimRegisters(CallFrame* frame) {
+    Value* frameTop = frame->slots + frame->closure->function->registers->frameSize;
+    while (vm.stackTop < frameTop) {
+        *vm.stackTop++ = NULL_VAL;
+    }
+    vm.stackTop = frameTop;
+}
+
+// Under -l a body is compiled the first time anything calls it
+static bool ensureCompiled(ObjFunction* function) {
+    if (function->source == NULL || compileBody(function)) return true;
+    runtimeError("Could not compile %s().", function->name->chars);
+    return false;
+}
+
+// * Fuel: loop back-edges and calls are the only ways to run for long, so those are
+// * where the interpreter checks in, with a single decrement while fuel is left.
+// * Straight-line code never checks. Once the fuel runs out refuel() takes a look
+// * at the budget, the clock and the hook, and either fills up again or stops.
+
+#define FUEL_CHECK() (--vm.fuel < 0 && !refuel())
+
+static double wallClock() {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (double)now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Without a time limit or a hook only the budget, if any, has to be looked at
+static void fillTank() {
+    int64_t slice = vm.deadline != 0 || vm.fuelHook != NULL ? FUEL_SLICE : INT64_MAX;
+    if (vm.budget != -1 && vm.budget < slice) slice = vm.budget;
+    vm.fuel = slice;
+    if (vm.budget != -1) vm.budget -= slice;
+}
+
+static void armFuel() {
+    vm.budget = vm.fuelLimit;
+    vm.deadline = vm.timeLimit > 0 ? wallClock() + vm.timeLimit : 0;
+    fillTank();
+}
+
+// False when the program stops here, with vm.stopping saying how. An abort is raised
+// as an error no try can catch, a yield leaves everything as it is for resume().
+static bool refuel() {
+    FuelAction action = FUEL_CONTINUE;
+    if (vm.budget == 0) {
+        runtimeError("Fuel budget exhausted.");
+        action = FUEL_ABORT;
+    } else if (vm.deadline != 0 && wallClock() >= vm.deadline) {
+        runtimeError("Time limit exceeded.");
+        action = FUEL_ABORT;
+    } else if (vm.fuelHook != NULL) {
+        action = vm.fuelHook();
+        if (action == FUEL_ABORT) runtimeError("Stopped by the fuel hook.");
+    }
+
+    if (action == FUEL_ABORT) {
+        vm.stopping = INTERPRET_ABORTED;
         return false;
     }
 
-    if (vm.frameCount == FRAMES_MAX) {
+    fillTank();
+    if (action == FUEL_YIELD) {
+        vm.stopping = INTERPRET_YIELDED;
+        return false;
+    }
+    return true;
+}
+
+// Makes sure a frame of function's starting at slots fits, with room left for natives
+static void reserveSlots(ObjFunction* function, Value* slots) {
+    int size = function->stackSize != -1 ? function->stackSize : FRAME_SLOTS;
+    size_t needed = (size_t)(slots - vm.stack) + size + FRAME_SLACK;
+    if (needed > vm.stackCapacity) growStack(needed);
+}
+
+// Room for one more frame, and for everything it can put on the stack. Both interpreter
+// loops load their frame pointer again after a call, so they never hold on to a stale one.
+static bool reserveFrame(ObjFunction* function, int argCount) {
+    if (vm.frameCount == vm.maxFrames) {
         runtimeError("Stack overflow.");
         return false;
     }
 
+    if (vm.frameCount == vm.frameCapacity) {
+        int capacity = vm.frameCapacity * 2;
+        if (capacity > vm.maxFrames) capacity = vm.maxFrames;
+        CallFrame* frames = (CallFrame*)realloc(vm.frames, sizeof(CallFrame) * capacity);
+        if (frames == NULL) exit(1);
+        vm.frames = frames;
+        vm.frameCapacity = capacity;
+    }
+
+    reserveSlots(function, vm.stackTop - argCount - 1);
+    return true;
+}
+
+static bool call(ObjClosure* closure, int argCount) {
+    if (!ensureCompiled(closure->function)) return false;
+    if (argCount != closure->function->arity) {
+        runtimeError("Expected %d arguments but got %d.", closure->function->arity, argCount);
+        return false;
+    }
+
+    if (!reserveFrame(closure->function, argCount)) return false;
+
     CallFrame* frame = &vm.frames[vm.frameCount++];
     frame->closure = closure;
     frame->ip = closure->function->chunk.code;
     frame->slots = vm.stackTop - argCount - 1;
-    return true;
+    frame->scratchMark = vm.scratchTop;
+    if (IS_REGISTER_FRAME(frame)) {
+        frame->rip = closure->function->registers->code;
+        claimRegisters(frame);
+    }
+    return !FUEL_CHECK();
 }
 
 static bool callValue(Value callee, int argCount) {
@@ -136,7 +339,11 @@ static bool callValue(Value callee, int argCount) {
                 return call(AS_CLOSURE(callee), argCount);
             case OBJ_NATIVE: {
                 NativeFn native = AS_NATIVE(callee);
+                // The arguments are held by address, so the stack mustn't move under a native's own pushes
+                size_t needed = (size_t)(vm.stackTop - vm.stack) + FRAME_SLACK;
+                if (needed > vm.stackCapacity) growStack(needed);
                 Value result = native(argCount, vm.stackTop - argCount);
+                if (vm.hasException) return false;
                 vm.stackTop -= argCount + 1;
                 push(result);
                 return true;
@@ -177,19 +384,99 @@ static bool invoke(ObjString* name, int argCount) {
     return invokeFromClass(instance->klass, name, argCount);
 }
 
-static bool bindMethod(ObjClass* klass, ObjString* name) {
+// Whether a counted loop goes around again, `comparison` is the one its condition was written with
+static inline bool stepContinues(uint8_t comparison, Value counter, Value bound) {
+    switch (comparison) {
+        case OP_LESS:        return COMPARE_NUMBERS(counter, <, bound);
+        case OP_NOT_GREATER: return !COMPARE_NUMBERS(counter, >, bound);
+        case OP_GREATER:     return COMPARE_NUMBERS(counter, >, bound);
+        default:             return !COMPARE_NUMBERS(counter, <, bound);
+    }
+}
+
+// Only a store to a name some memo reads can make that memo stale
+static inline void touch(ObjString* name) {
+    if (name->isWatched) vm.epoch++;
+}
+
+// Stores to a global go through here, a math native the name held isn't there anymore
+static inline void touchGlobal(ObjString* name) {
+    name->intrinsic = MATH_NONE;
+    touch(name);
+}
+
+// What OP_MATH works out in place of the call. Anything the native would complain
+// about is left to a real call, so the same error comes out.
+static inline bool runMath(ObjString* name, Value* args, int argCount, Value* result) {
+    int arity = name->intrinsic >= MATH_HYPOT ? 2 : 1;
+    if (name->intrinsic == MATH_NONE || argCount != arity) return false;
+    for (int i = 0; i < argCount; i++) {
+        if (!IS_NUMBER(args[i])) return false;
+    }
+
+    double a = AS_NUMBER(args[0]);
+    switch (name->intrinsic) {
+        case MATH_SIN:   *result = NUMBER_VAL(sin(a)); break;
+        case MATH_COS:   *result = NUMBER_VAL(cos(a)); break;
+        case MATH_TAN:   *result = NUMBER_VAL(tan(a)); break;
+        case MATH_ASIN:  *result = NUMBER_VAL(asin(a)); break;
+        case MATH_ACOS:  *result = NUMBER_VAL(acos(a)); break;
+        case MATH_ATAN:  *result = NUMBER_VAL(atan(a)); break;
+        case MATH_ABS:   *result = NUMBER_VAL(fabs(a)); break;
+        case MATH_SQRT:  *result = NUMBER_VAL(sqrt(a)); break;
+        case MATH_HYPOT: *result = NUMBER_VAL(hypot(a, AS_NUMBER(args[1]))); break;
+        case MATH_POWR:  *result = NUMBER_VAL(pow(a, AS_NUMBER(args[1]))); break;
+    }
+    return true;
+}
+
+// A memo stays good for as long as its stamp says so, see loops.c
+static bool isMemoValid(Value stamp) {
+    return stamp == TRUE_VAL || stamp == NUMBER_VAL((double)vm.epoch);
+}
+
+// Bound methods are a new object on every read, so those are never kept
+static Value memoStamp(Value value, bool isPure) {
+    if (IS_BOUND_METHOD(value)) return NULL_VAL;
+    return isPure ? TRUE_VAL : NUMBER_VAL((double)vm.epoch);
+}
+
+// The guards in front of an inlined copy: is the callee the function that was copied?
+static bool isInlinedCall(Value callee, ObjFunction* expected) {
+    return IS_CLOSURE(callee) && AS_CLOSURE(callee)->function == expected;
+}
+
+static bool isInlinedMethod(Value receiver, ObjString* name, ObjFunction* expected) {
+    if (!IS_INSTANCE(receiver)) return false;
+
+    ObjInstance* instance = AS_INSTANCE(receiver);
+    Value method;
+    if (tableGet(&instance->fields, name, &method)) return false;
+    return tableGet(&instance->klass->methods, name, &method) && AS_CLOSURE(method)->function == expected;
+}
+
+static bool bindMethod(ObjClass* klass, ObjString* name, bool inFrame) {
     Value method;
     if (!tableGet(&klass->methods, name, &method)) {
         runtimeError("Undefined property '%s'.", name->chars);
         return false;
     }
 
-    ObjBoundMethod* bound = newBoundMethod(peek(0), AS_CLOSURE(method));
+    ObjClosure* closure = AS_CLOSURE(method);
+    ObjBoundMethod* bound = inFrame ? newFrameBoundMethod(peek(0), closure) : newBoundMethod(peek(0), closure);
     pop();
     push(OBJ_VAL(bound));
     return true;
 }
 
+// A frame's scratch objects are only ever given back in the reverse order they were made
+static void releaseScratch(Value value) {
+    if (!IS_OBJ(value) || !isScratch(AS_OBJ(value))) return;
+
+    size_t offset = (size_t)((uint8_t*)AS_OBJ(value) - (uint8_t*)vm.scratch);
+    if (offset < vm.scratchTop) vm.scratchTop = offset;
+}
+
 static ObjUpvalue* captureUpvalue(Value* local) {
     ObjUpvalue* prevUpvalue = NULL;
     ObjUpvalue* upvalue = vm.openUpvalues;
@@ -223,6 +510,43 @@ static void closeUpvalues(Value* last) {
     }
 }
 
+// The closure a call in tail position runs in the caller's frame, NULL for
+// callees (natives, classes) that get the ordinary call
+static ObjClosure* tailCallee(int argCount) {
+    Value callee = peek(argCount);
+    if (IS_CLOSURE(callee)) return AS_CLOSURE(callee);
+    if (IS_BOUND_METHOD(callee)) {
+        ObjBoundMethod* bound = AS_BOUND_METHOD(callee);
+        vm.stackTop[-argCount - 1] = bound->receiver;
+        return bound->method;
+    }
+    return NULL;
+}
+
+// The caller is done with its frame: its upvalues are closed and the callee and
+// arguments slide down over its slots, so the call takes no frame of its own
+static bool tailCall(ObjClosure* closure, int argCount) {
+    if (!ensureCompiled(closure->function)) return false;
+    if (argCount != closure->function->arity) {
+        runtimeError("Expected %d arguments but got %d.", closure->function->arity, argCount);
+        return false;
+    }
+
+    CallFrame* frame = &vm.frames[vm.frameCount - 1];
+    reserveSlots(closure->function, frame->slots);
+    closeUpvalues(frame->slots);
+    memmove(frame->slots, vm.stackTop - argCount - 1, sizeof(Value) * (argCount + 1));
+    vm.stackTop = frame->slots + argCount + 1;
+
+    frame->closure = closure;
+    frame->ip = closure->function->chunk.code;
+    if (IS_REGISTER_FRAME(frame)) {
+        frame->rip = closure->function->registers->code;
+        claimRegisters(frame);
+    }
+    return !FUEL_CHECK();
+}
+
 static void defineMethod(ObjString* name) {
     Value method = peek(0);
     ObjClass* klass = AS_CLASS(peek(1));
@@ -230,24 +554,62 @@ static void defineMethod(ObjString* name) {
     pop();
 }
 
+static ObjString* concatenateStrings(ObjString* a, ObjString* b) {
+    ObjString* result = makeString(a->length + b->length);
+    memcpy(result->chars, a->chars, a->length);
+    memcpy(result->chars + a->length, b->chars, b->length);
+    return internString(result);
+}
+
 static void concatenate() {
     ObjString* b = AS_STRING(peek(0));
     ObjString* a = AS_STRING(peek(1));
 
-    int length = a->length + b->length;
-    char* chars = ALLOCATE(char, length + 1);
-    memcpy(chars, a->chars, a->length);
-    memcpy(chars + a->length, b->chars, b->length);
-    chars[length] = '\0';
-
-    ObjString* result = takeString(chars, length);
+    ObjString* result = concatenateStrings(a, b);
     pop();
     pop();
     push(OBJ_VAL(result));
 }
 
+// Adds `count` consecutive values, leaving the sum in the first. All strings is the
+// fast path: one buffer sized up front. Anything else is added left to right,
+// exactly like a chain of OP_ADDs.
+static bool addAll(Value* operands, int count) {
+    int length = 0;
+    int strings = 0;
+    while (strings < count && IS_STRING(operands[strings])) {
+        length += AS_STRING(operands[strings])->length;
+        strings++;
+    }
+
+    if (strings == count) {
+        ObjString* result = makeString(length);
+        char* end = result->chars;
+        for (int i = 0; i < count; i++) {
+            ObjString* part = AS_STRING(operands[i]);
+            memcpy(end, part->chars, part->length);
+            end += part->length;
+        }
+
+        operands[0] = OBJ_VAL(internString(result));
+        return true;
+    }
+
+    for (int i = 1; i < count; i++) {
+        if (IS_STRING(operands[0]) && IS_STRING(operands[i])) {
+            operands[0] = OBJ_VAL(concatenateStrings(AS_STRING(operands[0]), AS_STRING(operands[i])));
+        } else if (IS_NUMBER(operands[0]) && IS_NUMBER(operands[i])) {
+            operands[0] = addNumbers(operands[0], operands[i]);
+        } else {
+            runtimeError("Operands must be two numbers or two strings.");
+            return false;
+        }
+    }
+    return true;
+}
+
 // * Finally, we can run the code
-static InterpretResult run() {
+static InterpretResult runStack() {
     // ? register: This increases speed (use only for heavily used variables)
     register CallFrame* frame = &vm.frames[vm.frameCount - 1];
 
@@ -258,15 +620,44 @@ static InterpretResult run() {
     #define READ_CONSTANT() \
         (frame->closure->function->chunk.constants.values[READ_BYTE()])
     #define READ_STRING() AS_STRING(READ_CONSTANT())
+    #define NOT_BOOL_VAL(b) BOOL_VAL(!(b))
     #define BINARY_OP(valueType, op) \
         do { \
             if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
                 runtimeError("Operands must be numbers."); \
                 return INTERPRET_RUNTIME_ERROR; \
             } \
-            double b = AS_NUMBER(pop()); \
-            double a = AS_NUMBER(pop()); \
-            push(valueType(a op b)); \
+            Value b = pop(); \
+            vm.stackTop[-1] = valueType(COMPARE_NUMBERS(vm.stackTop[-1], op, b)); \
+        } while (false)
+    #define ARITHMETIC_OP(combine) \
+        do { \
+            if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
+                runtimeError("Operands must be numbers."); \
+                return INTERPRET_RUNTIME_ERROR; \
+            } \
+            Value b = pop(); \
+            vm.stackTop[-1] = combine(vm.stackTop[-1], b); \
+        } while (false)
+    #define BITWISE_OP(result) \
+        do { \
+            int32_t x, y; \
+            if (!bothToBits(peek(1), peek(0), &x, &y)) { \
+                runtimeError("Operands must be whole numbers."); \
+                return INTERPRET_RUNTIME_ERROR; \
+            } \
+            pop(); \
+            vm.stackTop[-1] = INT_VAL(result); \
+        } while (false)
+    #define NUMBER_OP(valueType, op) \
+        do { \
+            Value b = pop(); \
+            vm.stackTop[-1] = valueType(COMPARE_NUMBERS(vm.stackTop[-1], op, b)); \
+        } while (false)
+    #define NUMBER_ARITHMETIC(combine) \
+        do { \
+            Value b = pop(); \
+            vm.stackTop[-1] = combine(vm.stackTop[-1], b); \
         } while (false)
 
     // THE loop
@@ -292,6 +683,11 @@ static InterpretResult run() {
                 frame->slots[slot] = peek(0);
                 break;
             }
+            case OP_SET_LOCAL_POP: {
+                uint8_t slot = READ_BYTE();
+                frame->slots[slot] = pop();
+                break;
+            }
             case OP_GET_GLOBAL: {
                 ObjString* name = READ_STRING();
                 Value value;
@@ -304,17 +700,28 @@ static InterpretResult run() {
             }
             case OP_DEFINE_GLOBAL: {
                 ObjString* name = READ_STRING();
+                name->type = READ_BYTE();
                 tableSet(&vm.globals, name, peek(0));
                 pop();
+                touchGlobal(name);
                 break;
             }
             case OP_SET_GLOBAL: {
                 ObjString* name = READ_STRING();
+                if (name->isConst) {
+                    runtimeError("Can't assign to constant '%s'.", name->chars);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if (!isOfType(peek(0), (ValueType)name->type)) {
+                    runtimeError("Expected a %s value for '%s'.", valueTypeName((ValueType)name->type), name->chars);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
                 if (tableSet(&vm.globals, name, peek(0))) {
                     tableDelete(&vm.globals, name);
                     runtimeError("Undefined variable '%s'.", name->chars);
                     return INTERPRET_RUNTIME_ERROR;
                 }
+                touchGlobal(name);
                 break;
             }
             case OP_GET_UPVALUE: {
@@ -327,7 +734,8 @@ static InterpretResult run() {
                 *frame->closure->upvalues[slot]->location = peek(0);
                 break;
             }
-            case OP_GET_PROPERTY: {
+            case OP_GET_PROPERTY:
+            case OP_FRAME_PROPERTY: {
                 if (!IS_INSTANCE(peek(0))) {
                     runtimeError("Only instances have properties.");
                     return INTERPRET_RUNTIME_ERROR;
@@ -343,7 +751,7 @@ static InterpretResult run() {
                     break;
                 }
 
-                if (!bindMethod(instance->klass, name)) {
+                if (!bindMethod(instance->klass, name, instruction == OP_FRAME_PROPERTY)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 break;
@@ -355,7 +763,9 @@ static InterpretResult run() {
                 }
 
                 ObjInstance* instance = AS_INSTANCE(peek(1));
-                tableSet(&instance->fields, READ_STRING(), peek(0));
+                ObjString* name = READ_STRING();
+                tableSet(&instance->fields, name, peek(0));
+                touch(name);
                 Value value = pop();
                 pop();
                 push(value);
@@ -365,7 +775,7 @@ static InterpretResult run() {
                 ObjString* name = READ_STRING();
                 ObjClass* superclass = AS_CLASS(pop());
                 
-                if (!bindMethod(superclass, name)) {
+                if (!bindMethod(superclass, name, false)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 break;
@@ -376,34 +786,81 @@ static InterpretResult run() {
                 push(BOOL_VAL(valuesEqual(a, b)));
                 break;
             }
+            case OP_NOT_EQUAL: {
+                Value b = pop();
+                Value a = pop();
+                push(BOOL_VAL(!valuesEqual(a, b)));
+                break;
+            }
             case OP_GREATER:  BINARY_OP(BOOL_VAL, >); break;
+            case OP_NOT_GREATER: BINARY_OP(NOT_BOOL_VAL, >); break;
             case OP_LESS:     BINARY_OP(BOOL_VAL, <); break;
+            case OP_NOT_LESS: BINARY_OP(NOT_BOOL_VAL, <); break;
             case OP_ADD: {
-                if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
+                if (BOTH_NUMBERS(peek(1), peek(0))) {
+                    Value b = pop();
+                    vm.stackTop[-1] = addNumbers(vm.stackTop[-1], b);
+                } else if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
                     concatenate();
-                } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-                    double b = AS_NUMBER(pop());
-                    double a = AS_NUMBER(pop());
-                    push(NUMBER_VAL(a + b));
                 } else {
                     runtimeError("Operands must be two numbers or two strings.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 break;
             }
-            case OP_SUBTRACT: BINARY_OP(NUMBER_VAL, -); break;
-            case OP_MULTIPLY: BINARY_OP(NUMBER_VAL, *); break;
-            case OP_DIVIDE:   BINARY_OP(NUMBER_VAL, /); break;
+            case OP_CONCAT_N: {
+                int count = READ_BYTE();
+                if (!addAll(vm.stackTop - count, count)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                vm.stackTop -= count - 1;
+                break;
+            }
+            case OP_SUBTRACT: ARITHMETIC_OP(subtractNumbers); break;
+            case OP_MULTIPLY: ARITHMETIC_OP(multiplyNumbers); break;
+            case OP_DIVIDE:   ARITHMETIC_OP(divideNumbers); break;
+            case OP_MODULO:     ARITHMETIC_OP(moduloNumbers); break;
+            case OP_INT_DIVIDE: ARITHMETIC_OP(intDivideNumbers); break;
+            case OP_BIT_AND:     BITWISE_OP(x & y); break;
+            case OP_BIT_OR:      BITWISE_OP(x | y); break;
+            case OP_BIT_XOR:     BITWISE_OP(x ^ y); break;
+            case OP_SHIFT_LEFT:  BITWISE_OP(shiftLeft(x, y)); break;
+            case OP_SHIFT_RIGHT: BITWISE_OP(shiftRight(x, y)); break;
             case OP_NOT:
                 push(BOOL_VAL(isFalsey(pop())));
                 break;
+            case OP_GREATER_NUM:     NUMBER_OP(BOOL_VAL, >); break;
+            case OP_NOT_GREATER_NUM: NUMBER_OP(NOT_BOOL_VAL, >); break;
+            case OP_LESS_NUM:        NUMBER_OP(BOOL_VAL, <); break;
+            case OP_NOT_LESS_NUM:    NUMBER_OP(NOT_BOOL_VAL, <); break;
+            case OP_ADD_NUM:         NUMBER_ARITHMETIC(addNumbers); break;
+            case OP_SUBTRACT_NUM:    NUMBER_ARITHMETIC(subtractNumbers); break;
+            case OP_MULTIPLY_NUM:    NUMBER_ARITHMETIC(multiplyNumbers); break;
+            case OP_DIVIDE_NUM:      NUMBER_ARITHMETIC(divideNumbers); break;
             case OP_NEGATE:
                 if (!IS_NUMBER(peek(0))) {
                     runtimeError("Operand must be a number.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                push(NUMBER_VAL(-AS_NUMBER(pop())));
+                push(negateNumber(pop()));
+                break;
+            case OP_BIT_NOT: {
+                int32_t bits;
+                if (!toBits(peek(0), &bits)) {
+                    runtimeError("Operand must be a whole number.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                vm.stackTop[-1] = INT_VAL(~bits);
+                break;
+            }
+            case OP_CHECK_TYPE: {
+                ValueType type = (ValueType)READ_BYTE();
+                if (!isOfType(peek(0), type)) {
+                    runtimeError("Expected a %s value.", valueTypeName(type));
+                    return INTERPRET_RUNTIME_ERROR;
+                }
                 break;
+            }
             case OP_JUMP: {
                 uint16_t offset = READ_SHORT();
                 frame->ip += offset;
@@ -416,15 +873,81 @@ static InterpretResult run() {
             }
             case OP_LOOP: {
                 uint16_t offset = READ_SHORT();
+                // An abort is reported from the end of the loop, a yield resumes at its top
+                if (FUEL_CHECK()) {
+                    if (vm.stopping == INTERPRET_YIELDED) frame->ip -= offset;
+                    return INTERPRET_RUNTIME_ERROR;
+                }
                 frame->ip -= offset;
                 break;
             }
+            case OP_SWITCH: {
+                // Reads the chosen jump's offset rather than dispatching it
+                SwitchTable* table = &frame->closure->function->chunk.switches[READ_BYTE()];
+                frame->ip += 3 * findSwitchCase(table, pop()) + 1;
+                uint16_t offset = READ_SHORT();
+                frame->ip += offset;
+                break;
+            }
+            case OP_FOR_STEP: {
+                Value* counter = &frame->slots[READ_BYTE()];
+                Value step = READ_CONSTANT();
+                uint8_t arithmetic = READ_BYTE();
+                uint8_t comparison = READ_BYTE();
+                uint8_t load = READ_BYTE();
+                uint8_t operand = READ_BYTE();
+                uint16_t offset = READ_SHORT();
+
+                // Same checks, in the same order, as the increment and condition it stands for
+                if (!IS_NUMBER(*counter)) {
+                    runtimeError(arithmetic == OP_ADD ? "Operands must be two numbers or two strings."
+                                                      : "Operands must be numbers.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                *counter = arithmetic == OP_ADD ? addNumbers(*counter, step) : subtractNumbers(*counter, step);
+
+                Value bound;
+                if (load == OP_GET_LOCAL) {
+                    bound = frame->slots[operand];
+                } else if (load == OP_CONSTANT) {
+                    bound = frame->closure->function->chunk.constants.values[operand];
+                } else {
+                    ObjString* name = AS_STRING(frame->closure->function->chunk.constants.values[operand]);
+                    if (!tableGet(&vm.globals, name, &bound)) {
+                        runtimeError("Undefined variable '%s'.", name->chars);
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                }
+                if (!IS_NUMBER(bound)) {
+                    runtimeError("Operands must be numbers.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                if (stepContinues(comparison, *counter, bound)) {
+                    if (FUEL_CHECK()) {
+                        if (vm.stopping == INTERPRET_YIELDED) frame->ip -= offset;
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    frame->ip -= offset;
+                }
+                break;
+            }
             case OP_CALL: {
                 int argCount = READ_BYTE();
                 if (!callValue(peek(argCount), argCount)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 frame = &vm.frames[vm.frameCount - 1];
+                if (IS_REGISTER_FRAME(frame)) return INTERPRET_SWITCH;
+                break;
+            }
+            case OP_TAIL_CALL: {
+                int argCount = READ_BYTE();
+                ObjClosure* closure = tailCallee(argCount);
+                bool ok = closure != NULL ? tailCall(closure, argCount) : callValue(peek(argCount), argCount);
+                if (!ok) return INTERPRET_RUNTIME_ERROR;
+                frame = &vm.frames[vm.frameCount - 1];
+                if (IS_REGISTER_FRAME(frame)) return INTERPRET_SWITCH;
                 break;
             }
             case OP_INVOKE: {
@@ -434,6 +957,27 @@ static InterpretResult run() {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 frame = &vm.frames[vm.frameCount - 1];
+                if (IS_REGISTER_FRAME(frame)) return INTERPRET_SWITCH;
+                break;
+            }
+            case OP_MATH: {
+                ObjString* name = READ_STRING();
+                int argCount = READ_BYTE();
+                Value* args = vm.stackTop - argCount;
+                if (runMath(name, args, argCount, &args[-1])) {
+                    vm.stackTop = args;
+                    break;
+                }
+
+                if (!tableGet(&vm.globals, name, &args[-1])) {
+                    runtimeError("Undefined variable '%s'.", name->chars);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if (!callValue(args[-1], argCount)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                frame = &vm.frames[vm.frameCount - 1];
+                if (IS_REGISTER_FRAME(frame)) return INTERPRET_SWITCH;
                 break;
             }
             case OP_SUPER_INVOKE: {
@@ -444,11 +988,65 @@ static InterpretResult run() {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 frame = &vm.frames[vm.frameCount - 1];
+                if (IS_REGISTER_FRAME(frame)) return INTERPRET_SWITCH;
+                break;
+            }
+            case OP_CALL_INLINED: {
+                int argCount = READ_BYTE();
+                ObjFunction* expected = AS_FUNCTION(READ_CONSTANT());
+                uint16_t offset = READ_SHORT();
+                if (isInlinedCall(peek(argCount), expected)) break;
+
+                // Wrong guess, make the call and come back after the copy
+                if (!callValue(peek(argCount), argCount)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                frame->ip += offset;
+                frame = &vm.frames[vm.frameCount - 1];
+                if (IS_REGISTER_FRAME(frame)) return INTERPRET_SWITCH;
+                break;
+            }
+            case OP_INVOKE_INLINED: {
+                ObjString* method = READ_STRING();
+                int argCount = READ_BYTE();
+                ObjFunction* expected = AS_FUNCTION(READ_CONSTANT());
+                uint16_t offset = READ_SHORT();
+                if (isInlinedMethod(peek(argCount), method, expected)) break;
+
+                if (!invoke(method, argCount)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                frame->ip += offset;
+                frame = &vm.frames[vm.frameCount - 1];
+                if (IS_REGISTER_FRAME(frame)) return INTERPRET_SWITCH;
+                break;
+            }
+            case OP_MEMO: {
+                uint8_t slot = READ_BYTE();
+                uint16_t offset = READ_SHORT();
+                if (isMemoValid(frame->slots[slot + 1])) frame->ip += offset;
                 break;
             }
-            case OP_CLOSURE: {
+            case OP_MEMO_STORE: {
+                uint8_t slot = READ_BYTE();
+                bool isPure = READ_BYTE();
+                Value value = pop();
+                frame->slots[slot] = value;
+                frame->slots[slot + 1] = memoStamp(value, isPure);
+                break;
+            }
+            case OP_INLINE_RETURN: {
+                uint8_t base = READ_BYTE();
+                uint16_t offset = READ_SHORT();
+                frame->slots[base] = pop();
+                vm.stackTop = frame->slots + base + 1;
+                frame->ip += offset;
+                break;
+            }
+            case OP_CLOSURE:
+            case OP_FRAME_CLOSURE: {
                 ObjFunction* function = AS_FUNCTION(READ_CONSTANT());
-                ObjClosure* closure = newClosure(function);
+                ObjClosure* closure = instruction == OP_FRAME_CLOSURE ? newFrameClosure(function) : newClosure(function);
                 push(OBJ_VAL(closure));
                 for (int i = 0; i < closure->upvalueCount; i++) {
                     uint8_t isLocal = READ_BYTE();
@@ -465,9 +1063,16 @@ static InterpretResult run() {
                 closeUpvalues(vm.stackTop - 1);
                 pop();
                 break;
+            case OP_RELEASE:
+                releaseScratch(pop());
+                break;
+            case OP_THROW:
+                throwValue(pop());
+                return INTERPRET_RUNTIME_ERROR;
             case OP_RETURN: {
                 Value result = pop();
                 closeUpvalues(frame->slots);
+                vm.scratchTop = frame->scratchMark;
                 vm.frameCount--;
                 if (vm.frameCount == 0) {
                     pop();
@@ -477,6 +1082,7 @@ static InterpretResult run() {
                 vm.stackTop = frame->slots;
                 push(result);
                 frame = &vm.frames[vm.frameCount - 1];
+                if (IS_REGISTER_FRAME(frame)) return INTERPRET_SWITCH;
                 break;
             }
             case OP_CLASS:
@@ -504,7 +1110,397 @@ static InterpretResult run() {
     #undef READ_SHORT
     #undef READ_CONSTANT
     #undef READ_STRING
+    #undef NOT_BOOL_VAL
     #undef BINARY_OP
+    #undef ARITHMETIC_OP
+    #undef NUMBER_ARITHMETIC
+    #undef BITWISE_OP
+    #undef NUMBER_OP
+}
+
+// * The register twin of runStack. Same frames, same stack, but operands are
+// * addressed in place instead of being pushed and popped.
+static InterpretResult runRegisters() {
+    CallFrame* frame;
+    register uint32_t* ip;
+    register Value* R;
+    Value* K;
+
+    #define LOAD_FRAME() \
+        do { \
+            frame = &vm.frames[vm.frameCount - 1]; \
+            ip = frame->rip; \
+            R = frame->slots; \
+            K = frame->closure->function->chunk.constants.values; \
+            claimRegisters(frame); \
+        } while (false)
+    #define SAVE_IP() (frame->rip = ip)
+    #define RK_B(i) (((i) & REG_CONSTANT_B) ? K[REG_B(i)] : R[REG_B(i)])
+    #define RK_C(i) (((i) & REG_CONSTANT_C) ? K[REG_C(i)] : R[REG_C(i)])
+    #define REGISTER_ERROR(...) \
+        do { \
+            SAVE_IP(); \
+            runtimeError(__VA_ARGS__); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } while (false)
+    #define BINARY_OP(valueType, op) \
+        do { \
+            Value b = RK_B(instruction); \
+            Value c = RK_C(instruction); \
+            if (!BOTH_NUMBERS(b, c)) REGISTER_ERROR("Operands must be numbers."); \
+            R[REG_A(instruction)] = valueType(COMPARE_NUMBERS(b, op, c)); \
+        } while (false)
+    #define ARITHMETIC_OP(combine) \
+        do { \
+            Value b = RK_B(instruction); \
+            Value c = RK_C(instruction); \
+            if (!BOTH_NUMBERS(b, c)) REGISTER_ERROR("Operands must be numbers."); \
+            R[REG_A(instruction)] = combine(b, c); \
+        } while (false)
+    #define NUMBER_OP(valueType, op) \
+        do { \
+            Value b = RK_B(instruction); \
+            Value c = RK_C(instruction); \
+            R[REG_A(instruction)] = valueType(COMPARE_NUMBERS(b, op, c)); \
+        } while (false)
+    #define NUMBER_ARITHMETIC(combine) \
+        (R[REG_A(instruction)] = combine(RK_B(instruction), RK_C(instruction)))
+    #define BITWISE_OP(result) \
+        do { \
+            int32_t x, y; \
+            if (!bothToBits(RK_B(instruction), RK_C(instruction), &x, &y)) { \
+                REGISTER_ERROR("Operands must be whole numbers."); \
+            } \
+            R[REG_A(instruction)] = INT_VAL(result); \
+        } while (false)
+    #define NOT_BOOL_VAL(b) BOOL_VAL(!(b))
+
+    LOAD_FRAME();
+
+    for (;;) {
+        register uint32_t instruction = *ip++;
+        switch (REG_OP(instruction)) {
+            case REG_MOVE:
+                R[REG_A(instruction)] = RK_B(instruction);
+                break;
+            case REG_GET_GLOBAL: {
+                ObjString* name = AS_STRING(K[REG_B(instruction)]);
+                if (!tableGet(&vm.globals, name, &R[REG_A(instruction)])) {
+                    REGISTER_ERROR("Undefined variable '%s'.", name->chars);
+                }
+                break;
+            }
+            case REG_DEFINE_GLOBAL: {
+                ObjString* name = AS_STRING(K[REG_C(instruction)]);
+                name->type = REG_A(instruction);
+                tableSet(&vm.globals, name, RK_B(instruction));
+                touchGlobal(name);
+                break;
+            }
+            case REG_SET_GLOBAL: {
+                ObjString* name = AS_STRING(K[REG_C(instruction)]);
+                if (name->isConst) REGISTER_ERROR("Can't assign to constant '%s'.", name->chars);
+                if (!isOfType(RK_B(instruction), (ValueType)name->type)) {
+                    REGISTER_ERROR("Expected a %s value for '%s'.", valueTypeName((ValueType)name->type), name->chars);
+                }
+                if (tableSet(&vm.globals, name, RK_B(instruction))) {
+                    tableDelete(&vm.globals, name);
+                    REGISTER_ERROR("Undefined variable '%s'.", name->chars);
+                }
+                touchGlobal(name);
+                break;
+            }
+            case REG_GET_UPVALUE:
+                R[REG_A(instruction)] = *frame->closure->upvalues[REG_B(instruction)]->location;
+                break;
+            case REG_SET_UPVALUE:
+                *frame->closure->upvalues[REG_C(instruction)]->location = RK_B(instruction);
+                break;
+            case REG_GET_PROPERTY:
+            case REG_FRAME_PROPERTY: {
+                Value receiver = R[REG_B(instruction)];
+                if (!IS_INSTANCE(receiver)) REGISTER_ERROR("Only instances have properties.");
+
+                ObjInstance* instance = AS_INSTANCE(receiver);
+                ObjString* name = AS_STRING(K[REG_C(instruction)]);
+                Value value;
+                if (tableGet(&instance->fields, name, &value)) {
+                    R[REG_A(instruction)] = value;
+                    break;
+                }
+
+                Value method;
+                if (!tableGet(&instance->klass->methods, name, &method)) {
+                    REGISTER_ERROR("Undefined property '%s'.", name->chars);
+                }
+                ObjClosure* closure = AS_CLOSURE(method);
+                bool inFrame = REG_OP(instruction) == REG_FRAME_PROPERTY;
+                R[REG_A(instruction)] = OBJ_VAL(inFrame ? newFrameBoundMethod(receiver, closure) : newBoundMethod(receiver, closure));
+                break;
+            }
+            case REG_SET_PROPERTY: {
+                Value receiver = R[REG_A(instruction)];
+                if (!IS_INSTANCE(receiver)) REGISTER_ERROR("Only instances have fields.");
+                ObjString* name = AS_STRING(K[REG_C(instruction)]);
+                tableSet(&AS_INSTANCE(receiver)->fields, name, RK_B(instruction));
+                touch(name);
+                break;
+            }
+            case REG_EQUAL:
+                R[REG_A(instruction)] = BOOL_VAL(valuesEqual(RK_B(instruction), RK_C(instruction)));
+                break;
+            case REG_NOT_EQUAL:
+                R[REG_A(instruction)] = BOOL_VAL(!valuesEqual(RK_B(instruction), RK_C(instruction)));
+                break;
+            case REG_GREATER:     BINARY_OP(BOOL_VAL, >); break;
+            case REG_NOT_GREATER: BINARY_OP(NOT_BOOL_VAL, >); break;
+            case REG_LESS:        BINARY_OP(BOOL_VAL, <); break;
+            case REG_NOT_LESS:    BINARY_OP(NOT_BOOL_VAL, <); break;
+            case REG_ADD: {
+                Value b = RK_B(instruction);
+                Value c = RK_C(instruction);
+                if (BOTH_NUMBERS(b, c)) {
+                    R[REG_A(instruction)] = addNumbers(b, c);
+                } else if (IS_STRING(b) && IS_STRING(c)) {
+                    R[REG_A(instruction)] = OBJ_VAL(concatenateStrings(AS_STRING(b), AS_STRING(c)));
+                } else {
+                    REGISTER_ERROR("Operands must be two numbers or two strings.");
+                }
+                break;
+            }
+            case REG_SUBTRACT: ARITHMETIC_OP(subtractNumbers); break;
+            case REG_MULTIPLY: ARITHMETIC_OP(multiplyNumbers); break;
+            case REG_DIVIDE:   ARITHMETIC_OP(divideNumbers); break;
+            case REG_MODULO:     ARITHMETIC_OP(moduloNumbers); break;
+            case REG_INT_DIVIDE: ARITHMETIC_OP(intDivideNumbers); break;
+            case REG_BIT_AND:     BITWISE_OP(x & y); break;
+            case REG_BIT_OR:      BITWISE_OP(x | y); break;
+            case REG_BIT_XOR:     BITWISE_OP(x ^ y); break;
+            case REG_SHIFT_LEFT:  BITWISE_OP(shiftLeft(x, y)); break;
+            case REG_SHIFT_RIGHT: BITWISE_OP(shiftRight(x, y)); break;
+            case REG_GREATER_NUM:     NUMBER_OP(BOOL_VAL, >); break;
+            case REG_NOT_GREATER_NUM: NUMBER_OP(NOT_BOOL_VAL, >); break;
+            case REG_LESS_NUM:        NUMBER_OP(BOOL_VAL, <); break;
+            case REG_NOT_LESS_NUM:    NUMBER_OP(NOT_BOOL_VAL, <); break;
+            case REG_ADD_NUM:         NUMBER_ARITHMETIC(addNumbers); break;
+            case REG_SUBTRACT_NUM:    NUMBER_ARITHMETIC(subtractNumbers); break;
+            case REG_MULTIPLY_NUM:    NUMBER_ARITHMETIC(multiplyNumbers); break;
+            case REG_DIVIDE_NUM:      NUMBER_ARITHMETIC(divideNumbers); break;
+            case REG_CONCAT: {
+                Value* operands = &R[REG_B(instruction)];
+                SAVE_IP();
+                if (!addAll(operands, REG_C(instruction))) return INTERPRET_RUNTIME_ERROR;
+                R[REG_A(instruction)] = operands[0];
+                break;
+            }
+            case REG_NOT:
+                R[REG_A(instruction)] = BOOL_VAL(isFalsey(RK_B(instruction)));
+                break;
+            case REG_NEGATE: {
+                Value operand = RK_B(instruction);
+                if (!IS_NUMBER(operand)) REGISTER_ERROR("Operand must be a number.");
+                R[REG_A(instruction)] = negateNumber(operand);
+                break;
+            }
+            case REG_BIT_NOT: {
+                int32_t bits;
+                if (!toBits(RK_B(instruction), &bits)) REGISTER_ERROR("Operand must be a whole number.");
+                R[REG_A(instruction)] = INT_VAL(~bits);
+                break;
+            }
+            case REG_CHECK_TYPE: {
+                ValueType type = (ValueType)REG_A(instruction);
+                if (!isOfType(RK_B(instruction), type)) REGISTER_ERROR("Expected a %s value.", valueTypeName(type));
+                break;
+            }
+            case REG_JUMP:
+                ip += REG_SBX(instruction);
+                break;
+            case REG_LOOP:
+                if (FUEL_CHECK()) {
+                    if (vm.stopping == INTERPRET_YIELDED) ip += REG_SBX(instruction);
+                    SAVE_IP();
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                ip += REG_SBX(instruction);
+                break;
+            case REG_MEMO:
+                if (isMemoValid(R[REG_A(instruction) + 1])) ip += REG_SBX(instruction);
+                break;
+            case REG_MEMO_STORE: {
+                Value value = RK_B(instruction);
+                R[REG_A(instruction)] = value;
+                R[REG_A(instruction) + 1] = memoStamp(value, REG_C(instruction));
+                break;
+            }
+            case REG_JUMP_IF_FALSE:
+                if (isFalsey(R[REG_A(instruction)])) ip += REG_SBX(instruction);
+                break;
+            case REG_SWITCH: {
+                SwitchTable* table = &frame->closure->function->chunk.switches[REG_B(instruction)];
+                ip += findSwitchCase(table, R[REG_A(instruction)]);
+                ip += REG_SBX(*ip) + 1;
+                break;
+            }
+            case REG_FOR_STEP: {
+                uint32_t jump = *ip++;
+                Value* counter = &R[REG_A(instruction)];
+                Value bound = RK_B(instruction);
+                Value step = RK_C(instruction);
+                bool isAdd = REG_OP(jump) == REG_ADD;
+
+                if (!IS_NUMBER(*counter)) {
+                    REGISTER_ERROR(isAdd ? "Operands must be two numbers or two strings." : "Operands must be numbers.");
+                }
+                *counter = isAdd ? addNumbers(*counter, step) : subtractNumbers(*counter, step);
+                if (!IS_NUMBER(bound)) REGISTER_ERROR("Operands must be numbers.");
+
+                if (stepContinues(REG_A(jump), *counter, bound)) {
+                    if (FUEL_CHECK()) {
+                        if (vm.stopping == INTERPRET_YIELDED) ip += REG_SBX(jump);
+                        SAVE_IP();
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    ip += REG_SBX(jump);
+                }
+                break;
+            }
+            case REG_CALL:
+            case REG_TAIL_CALL:
+            case REG_INVOKE:
+            case REG_MATH:
+            case REG_CALL_INLINED:
+            case REG_INVOKE_INLINED: {
+                Value* base = &R[REG_A(instruction)];
+                int argCount = REG_B(instruction);
+                int op = REG_OP(instruction);
+
+                // Otherwise the name was rebound and the call goes to whatever it holds now
+                if (op == REG_MATH) {
+                    ObjString* name = AS_STRING(K[REG_C(instruction)]);
+                    if (runMath(name, base + 1, argCount, base)) break;
+                    if (!tableGet(&vm.globals, name, base)) REGISTER_ERROR("Undefined variable '%s'.", name->chars);
+                }
+
+                // A guard that holds skips the JUMP over the inlined copy and runs it
+                if (op == REG_CALL_INLINED && isInlinedCall(*base, AS_FUNCTION(K[REG_C(instruction)]))) {
+                    ip++;
+                    break;
+                }
+                if (op == REG_INVOKE_INLINED) {
+                    ObjFunction* expected = AS_FUNCTION(K[REG_A(*ip++)]);
+                    if (isInlinedMethod(*base, AS_STRING(K[REG_C(instruction)]), expected)) {
+                        ip++;
+                        break;
+                    }
+                }
+
+                int frameCount = vm.frameCount;
+                SAVE_IP();
+                vm.stackTop = base + argCount + 1;
+
+                ObjClosure* tail = op == REG_TAIL_CALL ? tailCallee(argCount) : NULL;
+                bool ok;
+                if (tail != NULL) {
+                    ok = tailCall(tail, argCount);
+                } else if (op == REG_INVOKE || op == REG_INVOKE_INLINED) {
+                    ok = invoke(AS_STRING(K[REG_C(instruction)]), argCount);
+                } else {
+                    ok = callValue(*base, argCount);
+                }
+                if (!ok) return INTERPRET_RUNTIME_ERROR;
+
+                // Natives and bare classes are done already, closures have pushed a frame or taken this one.
+                // Either way the frame is loaded again: a native that runs code can move the stack.
+                if ((vm.frameCount != frameCount || tail != NULL) && !IS_REGISTER_FRAME(&vm.frames[vm.frameCount - 1])) {
+                    return INTERPRET_SWITCH;
+                }
+                LOAD_FRAME();
+                break;
+            }
+            case REG_RELEASE:
+                releaseScratch(RK_B(instruction));
+                break;
+            case REG_THROW:
+                SAVE_IP();
+                throwValue(RK_B(instruction));
+                return INTERPRET_RUNTIME_ERROR;
+            case REG_RETURN: {
+                Value result = RK_B(instruction);
+                closeUpvalues(R);
+                vm.scratchTop = frame->scratchMark;
+                vm.frameCount--;
+                if (vm.frameCount == 0) {
+                    vm.stackTop = R;
+                    return INTERPRET_OK;
+                }
+
+                vm.stackTop = R;
+                push(result);
+                if (!IS_REGISTER_FRAME(&vm.frames[vm.frameCount - 1])) return INTERPRET_SWITCH;
+                LOAD_FRAME();
+                break;
+            }
+        }
+    }
+
+    #undef LOAD_FRAME
+    #undef SAVE_IP
+    #undef RK_B
+    #undef RK_C
+    #undef REGISTER_ERROR
+    #undef BINARY_OP
+    #undef ARITHMETIC_OP
+    #undef NUMBER_ARITHMETIC
+    #undef BITWISE_OP
+    #undef NUMBER_OP
+    #undef NOT_BOOL_VAL
+}
+
+// Looks for the innermost try around where each frame stopped, top frame first, and
+// unwinds to its catch with the error on top of the stack. Until something fails this
+// costs nothing, the tables are only read here. Register code never has a try.
+static bool catchError() {
+    for (int i = vm.frameCount - 1; i >= 0; i--) {
+        CallFrame* frame = &vm.frames[i];
+        if (IS_REGISTER_FRAME(frame)) continue;
+
+        Chunk* chunk = &frame->closure->function->chunk;
+        ExceptionHandler* handler = findHandler(chunk, (int)(frame->ip - chunk->code) - 1);
+        if (handler == NULL) continue;
+
+        // The frames above are gone, and with them their scratch objects
+        if (i + 1 < vm.frameCount) vm.scratchTop = vm.frames[i + 1].scratchMark;
+        vm.frameCount = i + 1;
+        closeUpvalues(frame->slots + handler->depth);
+        vm.stackTop = frame->slots + handler->depth;
+        push(vm.exception);
+        frame->ip = chunk->code + handler->handler;
+
+        vm.exception = NULL_VAL;
+        vm.hasException = false;
+        return true;
+    }
+    return false;
+}
+
+// Both loops return INTERPRET_RUNTIME_ERROR for an error and for a fuel check that stopped the program
+static InterpretResult stop() {
+    InterpretResult result = vm.stopping;
+    vm.stopping = INTERPRET_OK;
+    if (result == INTERPRET_YIELDED) return result;
+    if (result == INTERPRET_OK && catchError()) return INTERPRET_SWITCH;
+
+    reportError();
+    return result == INTERPRET_ABORTED ? result : INTERPRET_RUNTIME_ERROR;
+}
+
+static InterpretResult run() {
+    for (;;) {
+        InterpretResult result = IS_REGISTER_FRAME(&vm.frames[vm.frameCount - 1]) ? runRegisters() : runStack();
+        if (result == INTERPRET_RUNTIME_ERROR) result = stop();
+        if (result != INTERPRET_SWITCH) return result;
+    }
 }
 
 // Interpret the code
@@ -516,6 +1512,15 @@ InterpretResult interpret(const char* source) {
     ObjClosure* closure = newClosure(function);
     pop();
     push(OBJ_VAL(closure));
-    call(closure, 0);
+
+    // A program interpret()ed from inside another one runs on the outer one's fuel
+    if (vm.frameCount == 0) armFuel();
+    if (!call(closure, 0)) return stop();
+    return run();
+}
+
+// Carries on with a program the fuel hook made yield
+InterpretResult resume() {
+    if (vm.frameCount == 0) return INTERPRET_OK;
     return run();
 }
\ No newline at end of file
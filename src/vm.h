@@ -9,22 +9,65 @@
 // But this one is very important
 // wink wink
 
-#define FRAMES_MAX 88
-#define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+// The stack and the frames start small and grow as calls get deeper, up to vm.maxFrames
+#define FRAMES_INITIAL 16
+#define FRAMES_DEFAULT_MAX (256 * 1024)
+// A call gets its function's stackSize above its slots, and FRAME_SLOTS when the compiler couldn't
+// work that out; push() grows the stack for those. FRAME_SLACK is for what natives push while they run.
+#define FRAME_SLOTS (2 * UINT8_COUNT)
+#define FRAME_SLACK 8
+#define SCRATCH_MAX (64 * 1024)
+
+// With a time limit or a fuel hook, how many fuel checks pass between looks at them
+#define FUEL_SLICE (64 * 1024)
+
+typedef enum {
+    INTERPRET_OK,
+    INTERPRET_COMPILE_ERROR,
+    INTERPRET_RUNTIME_ERROR,
+    INTERPRET_YIELDED, // the fuel hook asked to yield, resume() carries on
+    INTERPRET_ABORTED  // out of fuel or time, or the fuel hook said to stop
+} InterpretResult;
+
+// What the fuel hook wants done with the running program
+typedef enum {
+    FUEL_CONTINUE,
+    FUEL_YIELD,
+    FUEL_ABORT
+} FuelAction;
+
+typedef FuelAction (*FuelHook)();
 
 typedef struct {
     ObjClosure* closure;
     uint8_t* ip;
+    uint32_t* rip; // Only used when the function runs as register code
     Value* slots;
+    size_t scratchMark; // where the frame's scratch objects start
 } CallFrame;
 
 typedef struct {
-    CallFrame frames[FRAMES_MAX];
+    CallFrame* frames;
     int frameCount;
-    Value stack[STACK_MAX];
+    int frameCapacity;
+    int maxFrames; // deeper than this is a stack overflow
+    Value* stack;
     Value* stackTop;
+    size_t stackCapacity;
+    Value exception; // what is being thrown, while hasException says something is
+    bool hasException;
+    int64_t fuel;       // loop back-edges and calls left until refuel() has a look
+    int64_t budget;     // what's left of fuelLimit beyond the fuel, -1 for no limit
+    double deadline;    // wall clock seconds the program has to be done by, 0 for none
+    int64_t fuelLimit;  // back-edges and calls each program gets, -1 for no limit
+    double timeLimit;   // seconds each program gets, 0 for no limit
+    FuelHook fuelHook;  // asked every FUEL_SLICE checks, NULL for none
+    InterpretResult stopping; // set when a fuel check stops the program
+    uint64_t scratch[SCRATCH_MAX / sizeof(uint64_t)]; // closures and bound methods that don't escape their frame
+    size_t scratchTop;
     Table globals;
     Table strings;
+    Table constGlobals; // the values of global consts the compiler substitutes
     ObjString* initString;
     ObjUpvalue* openUpvalues;
     size_t bytesAllocated;
@@ -33,22 +76,27 @@ typedef struct {
     int grayCount;
     int grayCapacity;
     Obj** grayStack;
+    uint64_t epoch; // moves on with every store to a global or field a memo reads, see loops.c
+    bool useRegisters;
+    bool optimize;
+    bool lazy;
 } VM;
 
-typedef enum {
-    INTERPRET_OK,
-    INTERPRET_COMPILE_ERROR,
-    INTERPRET_RUNTIME_ERROR
-} InterpretResult;
-
 extern VM vm;
 
+static inline bool isScratch(Obj* object) {
+    uintptr_t address = (uintptr_t)object;
+    return address >= (uintptr_t)vm.scratch && address < (uintptr_t)vm.scratch + SCRATCH_MAX;
+}
+
 void init(const char** args, int argsCountt);
 void runtimeError(const char* format, ...);
+void throwValue(Value value);
 void defineNative(const char* name, NativeFn function);
 void initVM();
 void freeVM();
 InterpretResult interpret(const char* source);
+InterpretResult resume();
 void push(Value value);
 Value pop();
 